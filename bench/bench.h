@@ -0,0 +1,56 @@
+#ifndef QUEBEC_BENCH_H
+#define QUEBEC_BENCH_H
+
+/* Shared by the `make bench-codegen` kernels, which have to build with both
+   quebec and the system `cc`. Quebec only compiles single values so far, so
+   arithmetic goes through these macros and loops are self tail calls, which
+   quebec (and `cc -O2`) turn into jumps. A pass recurses a few thousand calls
+   deep at most, since `cc -O0` keeps every one of them. */
+
+int   atoi  (const char* s);
+int   printf(const char* format, ...);
+void* calloc(unsigned long count, unsigned long size);
+void* memset(void* s, int c, unsigned long n);
+unsigned long strlen(const char* s);
+
+/* `OUT = A op B` on `int`s wrapping like QBE's, `A` and `B` variables, `K` a constant.
+   `REPEAT` is `OUT = FN(OUT)` `N` times, `NEXT` steps a pointer. */
+#ifdef __QUEBEC__
+
+#define BENCH_OP(OP, OUT, A, B)  __qbe__ (OUT : A, B : ) { "%" #OUT " =w " OP " %" #A ", %" #B }
+#define BENCH_OPK(OP, OUT, A, K) __qbe__ (OUT : A : ) { "%" #OUT " =w " OP " %" #A ", " #K }
+
+#define ADD(OUT, A, B)  BENCH_OP("add", OUT, A, B)
+#define MUL(OUT, A, B)  BENCH_OP("mul", OUT, A, B)
+#define LESS(OUT, A, B) BENCH_OP("csltw", OUT, A, B)
+#define ADDK(OUT, A, K) BENCH_OPK("add", OUT, A, K)
+#define SUBK(OUT, A, K) BENCH_OPK("sub", OUT, A, K)
+#define MULK(OUT, A, K) BENCH_OPK("mul", OUT, A, K)
+#define REMK(OUT, A, K) BENCH_OPK("rem", OUT, A, K)
+#define XORK(OUT, A, K) BENCH_OPK("xor", OUT, A, K)
+
+#define REPEAT(N, OUT, FN) __qbe__ (OUT : N, OUT : left, loop, next, done) { \
+    "%left =w copy %" #N ";"                                                  \
+    "@loop; jnz %left, @next, @done;"                                         \
+    "@next; %" #OUT " =w call $" #FN "(w %" #OUT ");"                         \
+    "%left =w sub %left, 1; jmp @loop;"                                       \
+    "@done" }
+#define NEXT(P) __qbe__ (P : P : ) { "%" #P " =l add %" #P ", 1" }
+
+#else
+
+#define ADD(OUT, A, B)  ((OUT) = (int)((unsigned)(A) + (unsigned)(B)))
+#define MUL(OUT, A, B)  ((OUT) = (int)((unsigned)(A) * (unsigned)(B)))
+#define LESS(OUT, A, B) ((OUT) = (A) < (B))
+#define ADDK(OUT, A, K) ((OUT) = (int)((unsigned)(A) + (unsigned)(K)))
+#define SUBK(OUT, A, K) ((OUT) = (int)((unsigned)(A) - (unsigned)(K)))
+#define MULK(OUT, A, K) ((OUT) = (int)((unsigned)(A) * (unsigned)(K)))
+#define REMK(OUT, A, K) ((OUT) = (A) % (K))
+#define XORK(OUT, A, K) ((OUT) = (A) ^ (K))
+
+#define REPEAT(N, OUT, FN) for (int left = (N); left; left--) (OUT) = FN(OUT)
+#define NEXT(P) ((P) = (P) + 1)
+
+#endif
+
+#endif /* QUEBEC_BENCH_H */
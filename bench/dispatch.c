@@ -0,0 +1,62 @@
+/* Switch dispatch: a bytecode interpreter over 4096 opcodes, each also charged from a constant table */
+#include "bench.h"
+
+char* program;
+
+int cost(int op) {
+    switch (op) {
+        case 0: return 3;
+        case 1: return 1;
+        case 2: return 4;
+        case 3: return 1;
+        case 4: return 5;
+        case 5: return 9;
+        case 6: return 2;
+        default: return 0;
+    }
+}
+
+int run(int pc, int acc) {
+    int op = program[pc];
+    switch (op) {
+        case 0: ADDK(acc, acc, 7); break;
+        case 1: SUBK(acc, acc, 3); break;
+        case 2: MULK(acc, acc, 3); break;
+        case 3: XORK(acc, acc, 85); break;
+        case 4: ADDK(acc, acc, 1000); break;
+        case 5: REMK(acc, acc, 65521); break;
+        case 6: XORK(acc, acc, 4660); break;
+        case 7: return acc;
+    }
+    int charge = cost(op);
+    ADD(acc, acc, charge);
+    ADDK(pc, pc, 1);
+    return run(pc, acc);
+}
+
+void load(int i) {
+    switch (i) {
+        case 4096: return;
+    }
+    int op = 0;
+    MULK(op, i, 5);
+    REMK(op, op, 7);
+    program[i] = op;
+    ADDK(i, i, 1);
+    load(i);
+}
+
+int pass(int acc) {
+    return run(0, acc);
+}
+
+int main(int argc, char** argv) {
+    int reps = atoi(argv[1]);
+    int acc  = 0;
+    program = calloc(4097, 1);
+    load(0);
+    program[4096] = 7;
+    REPEAT(reps, acc, pass);
+    printf("%d\n", acc);
+    return 0;
+}
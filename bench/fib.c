@@ -0,0 +1,33 @@
+/* Recursion: naive Fibonacci, two calls per level */
+#include "bench.h"
+
+int depth = 20;
+
+int fib(int n) {
+    switch (n) {
+        case 0:
+        case 1: return n;
+    }
+    int a = 0;
+    int b = 0;
+    SUBK(a, n, 1);
+    SUBK(b, n, 2);
+    a = fib(a);
+    b = fib(b);
+    ADD(a, a, b);
+    return a;
+}
+
+int pass(int acc) {
+    int value = fib(depth);
+    ADD(acc, acc, value);
+    return acc;
+}
+
+int main(int argc, char** argv) {
+    int reps = atoi(argv[1]);
+    int acc  = 0;
+    REPEAT(reps, acc, pass);
+    printf("%d\n", acc);
+    return 0;
+}
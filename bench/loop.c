@@ -0,0 +1,24 @@
+/* Integer loop: a multiplicative hash over 2048 counters a pass, each step depending on the last */
+#include "bench.h"
+
+int hash(int i, int acc) {
+    switch (i) {
+        case 0: return acc;
+    }
+    MULK(acc, acc, 31);
+    ADD(acc, acc, i);
+    SUBK(i, i, 1);
+    return hash(i, acc);
+}
+
+int pass(int acc) {
+    return hash(2048, acc);
+}
+
+int main(int argc, char** argv) {
+    int reps = atoi(argv[1]);
+    int acc  = 0;
+    REPEAT(reps, acc, pass);
+    printf("%d\n", acc);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#!/bin/sh
+# Builds every kernel with quebec, `cc -O0` and `cc -O2`, runs each build
+# $BENCH_RUNS times and tabulates the median runtime, text size and user-space
+# instruction count (when `perf` can count them). Results go to
+# $BENCH_OUT/results.tsv, compared against $BENCH_BASELINE when there is one.
+# Usage: bench/run.sh [path/to/quebec], or `make bench-codegen`
+set -u
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+QUEBEC=$(cd "$(dirname "${1:-./quebec}")" && pwd)/$(basename "${1:-./quebec}")
+CC=${CC:-cc}
+RUNS=${BENCH_RUNS:-5}
+OUT=${BENCH_OUT:-$BENCH/out}
+BASELINE=${BENCH_BASELINE:-$BENCH/baseline.tsv}
+
+# Each kernel's repetitions, around a second at `cc -O0`
+KERNELS="loop:20000 fib:4000 sieve:3000 scan:10000 dispatch:10000"
+COMPILERS="quebec cc-O0 cc-O2"
+
+mkdir -p "$OUT"
+RESULTS=$OUT/results.tsv
+printf 'kernel\tcompiler\tmedian_ms\ttext_bytes\tinstructions\toutput\n' > "$RESULTS"
+failed=0
+
+build() { # compiler kernel binary
+    case $1 in
+        quebec) (cd "$OUT" && "$QUEBEC" -f "$BENCH/$2.c" -o "$3") > "$3.log" 2>&1 ;;
+        cc-O0)  $CC -O0 -w -o "$3" "$BENCH/$2.c" > "$3.log" 2>&1 ;;
+        cc-O2)  $CC -O2 -w -o "$3" "$BENCH/$2.c" > "$3.log" 2>&1 ;;
+    esac
+    [ -x "$3" ]
+}
+
+# Milliseconds of each run, one per line
+timeRuns() { # binary reps
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        start=$(date +%s%N)
+        "$1" "$2" > /dev/null
+        end=$(date +%s%N)
+        echo "$start $end" | awk '{ printf "%.1f\n", ($2 - $1) / 1e6 }'
+        i=$((i + 1))
+    done
+}
+
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print NR % 2 ? v[(NR+1)/2] : (v[NR/2] + v[NR/2+1]) / 2 }'
+}
+
+textSize() {
+    if command -v size > /dev/null; then size "$1" | awk 'NR == 2 { print $1 }'
+    else wc -c < "$1" | tr -d ' '
+    fi
+}
+
+instructions() { # binary reps
+    count=-
+    if command -v perf > /dev/null && perf stat -x, -e instructions:u -o "$OUT/perf.txt" "$1" "$2" > /dev/null 2>&1; then
+        count=$(awk -F, '/instructions/ && $1 ~ /^[0-9]+$/ { print $1 }' "$OUT/perf.txt")
+    fi
+    echo "${count:--}"
+}
+
+for entry in $KERNELS; do
+    kernel=${entry%%:*}
+    reps=${entry#*:}
+    expected=
+    for compiler in $COMPILERS; do
+        binary=$OUT/$kernel.$compiler
+        rm -f "$binary"
+        if ! build "$compiler" "$kernel" "$binary"; then
+            echo "$kernel: $compiler build failed, see $binary.log" >&2
+            printf '%s\t%s\t-\t-\t-\tbuild-failed\n' "$kernel" "$compiler" >> "$RESULTS"
+            failed=1
+            continue
+        fi
+        # Every build has to agree with the first one that ran
+        output=$("$binary" "$reps")
+        check=ok
+        if [ -z "$expected" ]; then expected=$output
+        elif [ "$output" != "$expected" ]; then check=mismatch; failed=1
+        fi
+        ms=$(timeRuns "$binary" "$reps" | median)
+        printf '%s\t%s\t%s\t%s\t%s\t%s\n' "$kernel" "$compiler" "$ms" "$(textSize "$binary")" "$(instructions "$binary" "$reps")" "$check" >> "$RESULTS"
+    done
+done
+
+# Time and instructions as a ratio of the baseline's, for rows it has too
+awk -F'\t' -v baseline="$BASELINE" '
+    BEGIN {
+        while ((getline line < baseline) > 0) {
+            split(line, field, "\t")
+            base_ms[field[1] "/" field[2]] = field[3]
+            base_ins[field[1] "/" field[2]] = field[5]
+        }
+    }
+    function ratio(now, then) { return (now + 0 > 0 && then + 0 > 0) ? sprintf("x%.2f", now / then) : "-" }
+    NR == 1 { printf "%-10s %-8s %10s %10s %14s %8s %9s %9s\n", $1, $2, $3, $4, $5, $6, "vs_ms", "vs_instr"; next }
+    {
+        key = $1 "/" $2
+        printf "%-10s %-8s %10s %10s %14s %8s %9s %9s\n", $1, $2, $3, $4, $5, $6, ratio($3, base_ms[key]), ratio($5, base_ins[key])
+    }' "$RESULTS"
+
+exit $failed
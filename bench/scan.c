@@ -0,0 +1,60 @@
+/* String scanning: vowels and spaces counted over a 4 KiB string, measured with `strlen` first */
+#include "bench.h"
+
+char* text;
+int   turn;
+
+void fill(int i) {
+    switch (i) {
+        case 4096: return;
+    }
+    int letter = 0;
+    int column = 0;
+    REMK(letter, i, 26);
+    ADDK(letter, letter, 97);
+    REMK(column, i, 7);
+    switch (column) {
+        case 0: letter = 32;
+    }
+    text[i] = letter;
+    ADDK(i, i, 1);
+    fill(i);
+}
+
+int scan(const char* s, int found) {
+    switch (*s) {
+        case 0: return found;
+        case ' ': ADDK(found, found, 16); break;
+        case 'a':
+        case 'e':
+        case 'i':
+        case 'o':
+        case 'u': ADDK(found, found, 1); break;
+    }
+    NEXT(s);
+    return scan(s, found);
+}
+
+/* Each pass changes a letter, so no pass repeats the last */
+int pass(int acc) {
+    int letter = 0;
+    REMK(letter, acc, 26);
+    ADDK(letter, letter, 97);
+    ADDK(turn, turn, 1);
+    REMK(turn, turn, 4096);
+    text[turn] = letter;
+    int length = strlen(text);
+    int found  = scan(text, length);
+    ADD(acc, acc, found);
+    return acc;
+}
+
+int main(int argc, char** argv) {
+    int reps = atoi(argv[1]);
+    int acc  = 0;
+    text = calloc(4097, 1);
+    fill(0);
+    REPEAT(reps, acc, pass);
+    printf("%d\n", acc);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* Sieve of Eratosthenes over a byte array, primes below `limit` counted each pass */
+#include "bench.h"
+
+char* composite;
+int   limit = 8192;
+
+int cross(int i, int step) {
+    int inside = 0;
+    LESS(inside, i, limit);
+    switch (inside) {
+        case 0: return 0;
+    }
+    composite[i] = 1;
+    ADD(i, i, step);
+    return cross(i, step);
+}
+
+int count(int i, int primes) {
+    int inside = 0;
+    LESS(inside, i, limit);
+    switch (inside) {
+        case 0: return primes;
+    }
+    int square = 0;
+    switch (composite[i]) {
+        case 0:
+            ADDK(primes, primes, 1);
+            MUL(square, i, i);
+            cross(square, i);
+    }
+    ADDK(i, i, 1);
+    return count(i, primes);
+}
+
+int pass(int acc) {
+    memset(composite, 0, limit);
+    int primes = count(2, 0);
+    ADD(acc, acc, primes);
+    return acc;
+}
+
+int main(int argc, char** argv) {
+    int reps  = atoi(argv[1]);
+    int acc   = 0;
+    composite = calloc(limit, 1);
+    REPEAT(reps, acc, pass);
+    printf("%d\n", acc);
+    return 0;
+}
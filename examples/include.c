@@ -0,0 +1,11 @@
+#include "include/greeting.h"
+#include "include/greeting.h"
+
+void printGreeting() {
+    __qbe__ printf(GREETING("World"));
+}
+
+int main() {
+    printGreeting();
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef GREETING_H
+#define GREETING_H
+
+#define GREETING(WHO) "Hello, " WHO "!\n"
+
+void printGreeting();
+
+#endif /* GREETING_H */
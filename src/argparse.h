@@ -6,12 +6,18 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <ctype.h>
 
-typedef struct tucky_arg_s {
-    const char*  txt;
-    struct tucky_arg_s* next;
-} *TuckyArg;
-#define TUCKY_NO_ARGS NULL
+/* Define both before including to route the parser's allocations elsewhere */
+#ifndef TUCKY_MALLOC
+#define TUCKY_MALLOC(SIZE) malloc(SIZE)
+#define TUCKY_FREE(PTR)    free(PTR)
+#endif
+
+#define TUCKY_FLAG_SLOTS         128 /* One per ASCII character */
+#define TUCKY_KEYWORD_SLOTS      128 /* Power of two, well above the number of options */
+#define TUCKY_MAX_RESPONSE_DEPTH  16 /* `@file`s naming other `@file`s */
+#define TUCKY_KEYWORD_LENGTH      64 /* Longest keyword given as `--keyword=value` */
 
 enum TuckyArgumentStatus {
     OPTIONAL=0,
@@ -25,15 +31,26 @@ typedef struct tucky_argument_s {
     uint     nargs;
     const char*    keyword;
     const char*    help;
-    TuckyArg args;
+    const char**   args;     /* Values in command-line order */
+    uint           num_args;
+    uint           capacity;
     struct tucky_argument_s* next;
 } *TuckyArgument;
 
+/* Shared by every copy of the parser, so lookups stay O(1) however it's passed around */
+typedef struct tucky_index_s {
+    struct tucky_argument_s* by_flag   [TUCKY_FLAG_SLOTS];
+    struct tucky_argument_s* by_keyword[TUCKY_KEYWORD_SLOTS];
+    char** files; /* Response file contents, values point into them */
+    uint   num_files;
+} *TuckyIndex;
+
 typedef struct {
     int     argc;
     char**  argv;
     char*   invoker;
     TuckyArgument args;
+    TuckyIndex    index;
 } TuckyArgParser;
 
 /****************************************************************/
@@ -62,39 +79,29 @@ static inline void parseArgs(TuckyArgParser parser);
 
 /****************************************************************/
 
-static inline TuckyArg newArg(const char* txt) {
-    TuckyArg arg = (TuckyArg)malloc(sizeof(struct tucky_arg_s));
-    arg->txt  = txt;
-    arg->next = NULL;
-    return arg;
-}
-
-static inline void appendArg(TuckyArg* head_ptr, TuckyArg arg) {
-    if (head_ptr==NULL || (*head_ptr)==NULL) {
-        (*head_ptr) = arg;
-        return;
+static inline void appendArg(TuckyArgument argument, const char* txt) {
+    if (argument->num_args == argument->capacity) {
+        argument->capacity = argument->capacity ? 2*argument->capacity : 8;
+        const char** args = (const char**)TUCKY_MALLOC(argument->capacity * sizeof(const char*));
+        if (argument->num_args) memcpy(args, argument->args, argument->num_args * sizeof(const char*));
+        TUCKY_FREE(argument->args);
+        argument->args = args;
     }
-
-    if ( (*head_ptr)->next == NULL) {
-        (*head_ptr)->next = arg;
-        return;
-    }
-
-    appendArg( &((*head_ptr)->next), arg);
+    argument->args[argument->num_args++] = txt;
 }
 
-static inline void printArg(const TuckyArg arg) {
-    if (arg) {
-        printf("(%s) ", arg->txt);
-        printArg(arg->next);
-    }
+/* First value, or NULL if none were given */
+static inline const char* getArgumentValue(const TuckyArgument argument) {
+    return argument->num_args ? argument->args[0] : NULL;
 }
 
-static inline void delArg(TuckyArg* arg_ptr) {
-    if (arg_ptr==NULL || *arg_ptr==NULL) return;
-    if ((*arg_ptr)->next) delArg(&((*arg_ptr)->next));
-    free(*arg_ptr);
-    (*arg_ptr) = NULL;
+static inline uint hashKeyword(const char* keyword) {
+    uint hash = 2166136261u; /* FNV-1a */
+    while (*keyword) {
+        hash ^= (unsigned char)*keyword++;
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
 static inline TuckyArgument newArgument(
@@ -103,14 +110,16 @@ static inline TuckyArgument newArgument(
     const enum TuckyArgumentStatus status,
     const char* help) {
         
-    TuckyArgument argument = (TuckyArgument)malloc(sizeof(struct tucky_argument_s));
+    TuckyArgument argument = (TuckyArgument)TUCKY_MALLOC(sizeof(struct tucky_argument_s));
     argument->flag    = flag;
     argument->nargs   = nargs;
     argument->keyword = keyword;
     argument->help    = help;
     argument->status  = status;
     argument->enabled = false;
-    argument->args    = TUCKY_NO_ARGS;
+    argument->args    = NULL;
+    argument->num_args= 0;
+    argument->capacity= 0;
     argument->next    = NULL;
 
     return argument;
@@ -140,19 +149,26 @@ static inline void addArgument(
     TuckyArgument argument = newArgument(flag, keyword, nargs, status, help);
     appendTuckyArgument(&(parser->args), argument);
 
+    parser->index->by_flag[(unsigned char)flag % TUCKY_FLAG_SLOTS] = argument;
+    uint slot = hashKeyword(keyword);
+    while (parser->index->by_keyword[slot % TUCKY_KEYWORD_SLOTS]) slot++;
+    parser->index->by_keyword[slot % TUCKY_KEYWORD_SLOTS] = argument;
     return;
 }
 
 static inline void delArgument(TuckyArgument* arg_ptr) {
     if (arg_ptr==NULL || *arg_ptr==NULL) return;
     delArgument(&((*arg_ptr)->next));
-    delArg(&((*arg_ptr)->args));
-    free(*(arg_ptr));
+    TUCKY_FREE((*arg_ptr)->args);
+    TUCKY_FREE(*(arg_ptr));
     (*arg_ptr) = NULL;
 }
 
 static inline void delArgParser(TuckyArgParser parser) {
     delArgument(&(parser.args));
+    for (uint i = 0; i<parser.index->num_files; i++) TUCKY_FREE(parser.index->files[i]);
+    TUCKY_FREE(parser.index->files);
+    TUCKY_FREE(parser.index);
 }
 
 static inline void printArguments(const TuckyArgParser parser) {
@@ -174,7 +190,7 @@ static inline void dumpArgs(const TuckyArgParser parser) {
     TuckyArgument temp = parser.args;
     while (temp) {
         printf("%10s : ", temp->keyword);
-        if (temp->nargs > 0) printArg(temp->args);
+        if (temp->nargs > 0) for (uint i = 0; i<temp->num_args; i++) printf("(%s) ", temp->args[i]);
         else printf("%s", temp->enabled?"ENABLED":"DISABLED");
         printf("\n");
         temp = temp->next;
@@ -182,19 +198,14 @@ static inline void dumpArgs(const TuckyArgParser parser) {
 }
 
 static inline TuckyArgument getArgumentFromFlag   (TuckyArgParser parser, const char flag) {
-    TuckyArgument argument = parser.args;
-    while (argument) {
-        if (argument->flag==flag) return argument;
-        argument = argument->next;
-    }
-    return NULL;
+    TuckyArgument argument = parser.index->by_flag[(unsigned char)flag % TUCKY_FLAG_SLOTS];
+    return argument && argument->flag==flag ? argument : NULL;
 }
 
 static inline TuckyArgument getArgumentFromKeyword(TuckyArgParser parser, const char* keyword) {
-    TuckyArgument argument = parser.args;
-    while (argument) {
+    for (uint slot = hashKeyword(keyword); parser.index->by_keyword[slot % TUCKY_KEYWORD_SLOTS]; slot++) {
+        TuckyArgument argument = parser.index->by_keyword[slot % TUCKY_KEYWORD_SLOTS];
         if (strcmp(argument->keyword, keyword)==0) return argument;
-        argument = argument->next;
     }
     return NULL;
 }
@@ -217,8 +228,10 @@ TuckyArgParser newArgParser(int argc, char** argv) {
         .argc=argc,
         .argv=argv,
         .invoker=argv[0],
-        .args=TUCKY_NO_ARGS
+        .args=NULL,
+        .index=(TuckyIndex)TUCKY_MALLOC(sizeof(struct tucky_index_s))
     };
+    memset(TUCKY_ACTIVE_PARSER.index, 0, sizeof(struct tucky_index_s));
     addArgument(&TUCKY_ACTIVE_PARSER, 'h', "help"   , 0, OPTIONAL, "Display the help information");
     return TUCKY_ACTIVE_PARSER;
 }
@@ -243,47 +256,107 @@ static inline void help(const TuckyArgParser parser);
     }
 #endif /* TUCKY_HELP_OVERRIDE */
 
-static inline void parseArgs(TuckyArgParser parser) {
-    TuckyArgument last_arg   = NULL;
-    TuckyArg      string_arg = NULL;
-
-    #define pushToArgument() {\
-        if (last_arg) {\
-            if ((last_arg->nargs==AS_MANY || last_arg->nargs>0) && string_arg) {\
-                appendArg(&(last_arg->args), string_arg);\
-                string_arg = NULL;\
-            } else {\
-                last_arg->enabled = true;\
-            }\
-        }\
+typedef struct {
+    TuckyArgument last_arg;
+    bool          has_values;
+} TuckyParseState;
+
+static inline void finishArgument(TuckyParseState* state) {
+    if (state->last_arg && !state->has_values) state->last_arg->enabled = true;
+}
+
+static inline void readResponseFile(TuckyArgParser parser, TuckyParseState* state, const char* path, const uint depth);
+
+static inline void parseArg(TuckyArgParser parser, TuckyParseState* state, const char* arg, const uint depth) {
+    if (arg[0] == '@' && arg[1]) {
+        readResponseFile(parser, state, arg+1, depth+1);
+        return;
     }
 
-    for (int i = 1; i<parser.argc; i++) { /* Start at 1 to skip executable name */
-        const char* arg = parser.argv[i];
-
-        if (arg[0] == '-') {
-            pushToArgument();
-            if (arg[1] == '-') {
-                /* Keyword */
-                last_arg = getArgumentFromKeyword(parser, arg+2);
-                if (last_arg == NULL)
-                    TUCKY_EXIT_MSG("TuckyBadArgument: `--%s`", arg+2);
-                continue;
+    if (arg[0] == '-') {
+        finishArgument(state);
+        state->has_values = false;
+        if (arg[1] == '-') {
+            /* Keyword, its value can follow an `=` like `--out=a.out` */
+            const char*  equals = strchr(arg+2, '=');
+            const size_t length = equals ? (size_t)(equals - (arg+2)) : 0;
+            char keyword[TUCKY_KEYWORD_LENGTH] = {0};
+            if (length < sizeof(keyword)) memcpy(keyword, arg+2, length);
+            state->last_arg = getArgumentFromKeyword(parser, equals ? keyword : arg+2);
+            if (state->last_arg == NULL || length >= sizeof(keyword))
+                TUCKY_EXIT_MSG("TuckyBadArgument: `--%s`", arg+2);
+            if (equals && state->last_arg->nargs != STORE_TRUE) {
+                appendArg(state->last_arg, equals+1);
+                state->has_values = true;
             }
-
-            /* Flag */
-            last_arg = getArgumentFromFlag(parser, arg[1]);
-            if (last_arg == NULL)
-                TUCKY_EXIT_MSG("TuckyBadArgument: `-%c`", arg[1]);
-            continue;
+            return;
         }
 
-        if (last_arg != NULL) {
-            TuckyArg temp_string_arg = newArg(arg);
-            appendArg(&string_arg, temp_string_arg);
+        /* Flag, or a keyword spelled with one dash like `-MD` */
+        state->last_arg = arg[1] && arg[2] ? getArgumentFromKeyword(parser, arg+1) : NULL;
+        if (state->last_arg == NULL) state->last_arg = getArgumentFromFlag(parser, arg[1]);
+        if (state->last_arg == NULL)
+            TUCKY_EXIT_MSG("TuckyBadArgument: `-%c`", arg[1]);
+        return;
+    }
+
+    if (state->last_arg != NULL && state->last_arg->nargs != STORE_TRUE) {
+        appendArg(state->last_arg, arg);
+        state->has_values = true;
+    }
+}
+
+/* `@path` stands for the arguments in that file. Whitespace separates them,
+   quotes group them and a backslash escapes the next character. The file is
+   read once and split in place, values point straight into it. */
+static inline void readResponseFile(TuckyArgParser parser, TuckyParseState* state, const char* path, const uint depth) {
+    if (depth > TUCKY_MAX_RESPONSE_DEPTH)
+        TUCKY_EXIT_MSG("TuckyBadArgument: `@%s` nests response files too deeply", path);
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        TUCKY_EXIT_MSG("TuckyBadArgument: Could not read response file `%s`", path);
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* text = (char*)TUCKY_MALLOC(size > 0 ? size+1 : 1);
+    text[size > 0 ? fread(text, 1, size, fp) : 0] = 0;
+    fclose(fp);
+
+    TuckyIndex index = parser.index;
+    char** files = (char**)TUCKY_MALLOC((index->num_files+1) * sizeof(char*));
+    if (index->num_files) memcpy(files, index->files, index->num_files * sizeof(char*));
+    TUCKY_FREE(index->files);
+    index->files = files;
+    index->files[index->num_files++] = text;
+
+    char* read = text;
+    while (true) {
+        while (isspace((unsigned char)*read)) read++;
+        if (*read == 0) break;
+
+        char* start = read;
+        char* write = read;
+        char  quote = 0;
+        while (*read && (quote || !isspace((unsigned char)*read))) {
+            if      (quote && *read == quote)                 { quote = 0; read++; }
+            else if (!quote && (*read=='"' || *read=='\'')) quote = *read++;
+            else if (*read == '\\' && read[1])               { read++; *write++ = *read++; }
+            else                                              *write++ = *read++;
         }
+        const bool last = *read == 0;
+        *write = 0;
+        if (!last) read++;
+        parseArg(parser, state, start, depth);
+        if (last) break;
     }
-    pushToArgument();
+}
+
+static inline void parseArgs(TuckyArgParser parser) {
+    TuckyParseState state = { .last_arg = NULL, .has_values = false };
+    for (int i = 1; i<parser.argc; i++) /* Start at 1 to skip executable name */
+        parseArg(parser, &state, parser.argv[i], 0);
+    finishArgument(&state);
 
     const bool help_set = getArgumentFromFlag(parser, 'h')->enabled;
     if (help_set) {
@@ -296,7 +369,7 @@ static inline void parseArgs(TuckyArgParser parser) {
         if (
             temp->status == REQUIRED &&
             temp->nargs  >  0        &&
-            temp->args   == NULL
+            temp->num_args == 0
         ) {
             TUCKY_EXIT_MSG("TuckyMissingValue: Missing value for argument `--%s`", temp->keyword);
         }
@@ -304,6 +377,9 @@ static inline void parseArgs(TuckyArgParser parser) {
     }
 }
 
-#define TUCKY_FOREACH(ARG, ARGS) for (TuckyArg ARG = ARGS; ARG!=NULL; ARG=ARG->next)
+/* Visits each value of `ARGUMENT` as `const char* ARG` */
+#define TUCKY_FOREACH(ARG, ARGUMENT) \
+    for (const char **ARG##_at = (ARGUMENT)->args, *ARG = NULL; \
+         ARG##_at < (ARGUMENT)->args + (ARGUMENT)->num_args && (ARG = *ARG##_at, true); ARG##_at++)
 
 #endif /* TUCKY_PARSER_H */
\ No newline at end of file
@@ -4,9 +4,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "trace.h"
+
 typedef unsigned int uint;
 
-#define ERRO(EXIT_CODE, ...) { printf("[ERRO] "); printf(__VA_ARGS__); printf("\n"); exit(EXIT_CODE); }
+#define ERRO(EXIT_CODE, ...) { printf("[ERRO] "); printf(__VA_ARGS__); printf("\n"); closeTrace(); fflush(stdout); exit(EXIT_CODE); }
 #define WARN(...)            { printf("[WARN] "); printf(__VA_ARGS__); printf("\n"); }
 #define INFO(...)            { printf("[INFO] "); printf(__VA_ARGS__); printf("\n"); }
 
@@ -0,0 +1,183 @@
+#include "ctypes.h"
+
+#include <string.h>
+
+#include "token_types.h"
+
+CType parseCType(const pToken tokens, const char** identifier, const Aggregate* aggregates) {
+    CType type = CTYPE(CT_Int);
+    bool  has_kind = false, tag_next = false;
+    if (identifier) *identifier = NULL;
+
+    for (pToken token = tokens; token; token = token->next) {
+        switch (token->type) {
+            default: break;
+            case TOKEN_void  : type.kind = CT_Void;   has_kind = true; break;
+            case TOKEN_char  : type.kind = CT_Char;   has_kind = true; break;
+            case TOKEN_float : type.kind = CT_Float;  has_kind = true; break;
+            case TOKEN_double: type.kind = CT_Double; has_kind = true; break;
+            case TOKEN_long  : type.kind = CT_Long;   has_kind = true; break;
+            case TOKEN_short : type.kind = CT_Short;  has_kind = true; break;
+            case TOKEN_int   : if (!has_kind) type.kind = CT_Int; has_kind = true; break; /* `long int`, `short int` */
+            case TOKEN_unsigned: type.is_unsigned = true;  break;
+            case TOKEN_signed  : type.is_unsigned = false; break;
+            case TOKEN_struct:
+            case TOKEN_union : type.kind = CT_Struct; has_kind = tag_next = true; break;
+            case TOKEN_identifier:
+                if (tag_next) {
+                    for (const Aggregate* aggregate = aggregates; aggregate; aggregate = aggregate->next)
+                        if (aggregate->tag == token->text) type.aggregate = aggregate;
+                    tag_next = false;
+                } else if (identifier) {
+                    *identifier = token->text;
+                }
+                break;
+            case TOKEN_operator: {
+                const char* s = token->text;
+                if (strcmp(s, "*")==0) type.pointers++;
+                if (s[1] == 0 && strchr("=([,);", s[0])) return type;
+                break;
+            }
+        }
+    }
+    return type;
+}
+
+CType elementCType(const CType type) {
+    CType element = type;
+    if      (element.length)   element.length = 0;
+    else if (element.pointers) element.pointers--;
+    return element;
+}
+
+static uint sizeofScalar(const CType type) {
+    if (type.pointers) return 8;
+    switch (type.kind) {
+        case CT_Void  : return 1; /* Like GCC, so `void*` arithmetic works */
+        case CT_Char  : return 1;
+        case CT_Short : return 2;
+        case CT_Int   : return 4;
+        case CT_Long  : return 8;
+        case CT_Float : return 4;
+        case CT_Double: return 8;
+        case CT_Struct: return type.aggregate ? type.aggregate->size : 0;
+        default: break;
+    }
+    return 4;
+}
+
+uint sizeofCType(const CType type) {
+    return type.length ? type.length * sizeofScalar(elementCType(type)) : sizeofScalar(type);
+}
+
+uint alignofCType(const CType type) {
+    const CType scalar = type.length ? elementCType(type) : type;
+    if (isAggregateCType(scalar)) return scalar.aggregate ? scalar.aggregate->align : 1;
+    return sizeofScalar(scalar);
+}
+
+bool isIntegerCType(const CType type) {
+    return type.pointers || type.length || (type.kind != CT_Float && type.kind != CT_Double && type.kind != CT_Struct);
+}
+
+bool isAggregateCType(const CType type) {
+    return type.kind == CT_Struct && type.pointers == 0 && type.length == 0;
+}
+
+void layoutAggregate(pAggregate aggregate) {
+    uint size = 0, align = 1;
+    for (uint i = 0; i<aggregate->num_fields; i++) {
+        Field* field = &(aggregate->fields[i]);
+        const uint field_align = alignofCType(field->type);
+        field->offset = aggregate->is_union ? 0 : (size + field_align-1) / field_align * field_align;
+        const uint end = field->offset + sizeofCType(field->type);
+        if (end > size)          size  = end;
+        if (field_align > align) align = field_align;
+    }
+    aggregate->align    = align;
+    aggregate->size     = (size + align-1) / align * align;
+    aggregate->complete = true;
+}
+
+const Field* findField(const Aggregate* aggregate, const char* name) {
+    for (uint i = 0; i<aggregate->num_fields; i++)
+        if (aggregate->fields[i].name == name) return &(aggregate->fields[i]);
+    return NULL;
+}
+
+enum QbeType qbeBaseType(const CType type) {
+    if (type.pointers || type.length) return QBE_Long;
+    switch (type.kind) {
+        case CT_Long  : return QBE_Long;
+        case CT_Float : return QBE_Single;
+        case CT_Double: return QBE_Double;
+        case CT_Struct: return QBE_Long;
+        default: break;
+    }
+    return QBE_Word;
+}
+
+enum QbeType qbeMemoryType(const CType type) {
+    if (type.pointers == 0 && type.length == 0) switch (type.kind) {
+        case CT_Char : return QBE_Byte;
+        case CT_Short: return QBE_HalfWorld;
+        default: break;
+    }
+    return qbeBaseType(type);
+}
+
+const char* loadInstr(const CType type) {
+    switch (qbeMemoryType(type)) {
+        case QBE_Byte     : return type.is_unsigned ? "loadub" : "loadsb";
+        case QBE_HalfWorld: return type.is_unsigned ? "loaduh" : "loadsh";
+        case QBE_Word     : return type.is_unsigned ? "loaduw" : "loadsw";
+        case QBE_Long     : return "loadl";
+        case QBE_Single   : return "loads";
+        case QBE_Double   : return "loadd";
+        default: break;
+    }
+    return "loadw";
+}
+
+/* Whether every value of `from` is also one of `to` */
+static bool fitsIn(const CType to, const CType from) {
+    const uint   to_size = sizeofCType(to), from_size = sizeofCType(from);
+    const bool   to_unsigned = to.is_unsigned || to.pointers, from_unsigned = from.is_unsigned || from.pointers;
+    if (from_size < to_size)  return from_unsigned || !to_unsigned;
+    return from_size == to_size && from_unsigned == to_unsigned;
+}
+
+const char* convertInstr(const CType to, const CType from) {
+    const enum QbeType to_base = qbeBaseType(to), from_base = qbeBaseType(from);
+    const bool from_unsigned = from.is_unsigned || from.pointers || from.length;
+
+    if (to_base == QBE_Single || to_base == QBE_Double) {
+        if (from_base == to_base)     return NULL;
+        if (from_base == QBE_Single)  return "exts";
+        if (from_base == QBE_Double)  return "truncd";
+        if (from_base == QBE_Long)    return from_unsigned ? "ultof" : "sltof";
+        return from_unsigned ? "uwtof" : "swtof";
+    }
+    if (from_base == QBE_Single) return to.is_unsigned ? "stoui" : "stosi";
+    if (from_base == QBE_Double) return to.is_unsigned ? "dtoui" : "dtosi";
+
+    if (to_base == QBE_Long) return from_base == QBE_Long ? NULL : from_unsigned ? "extuw" : "extsw";
+    if (fitsIn(to, from)) return NULL;
+    switch (qbeMemoryType(to)) {
+        case QBE_Byte     : return to.is_unsigned ? "extub" : "extsb";
+        case QBE_HalfWorld: return to.is_unsigned ? "extuh" : "extsh";
+        default: break;
+    }
+    return NULL; /* A `w` result drops the top of a `l` by itself */
+}
+
+int64_t foldCType(const CType type, const int64_t value) {
+    if (!isIntegerCType(type)) return value;
+    switch (sizeofCType(type)) {
+        case 1: return type.is_unsigned ? (int64_t)(uint8_t) value : (int64_t)(int8_t) value;
+        case 2: return type.is_unsigned ? (int64_t)(uint16_t)value : (int64_t)(int16_t)value;
+        case 4: return type.is_unsigned ? (int64_t)(uint32_t)value : (int64_t)(int32_t)value;
+        default: break;
+    }
+    return value;
+}
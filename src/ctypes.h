@@ -0,0 +1,90 @@
+#ifndef QUEBEC_CTYPES_H
+#define QUEBEC_CTYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parse.h"
+#include "qbe.h"
+
+enum CTypeKind {
+    CT_Void,
+    CT_Char,
+    CT_Short,
+    CT_Int,
+    CT_Long,
+    CT_Float,
+    CT_Double,
+    CT_Struct, /* Unions too */
+CT_KIND_LENGTH
+};
+__attribute_maybe_unused__ static const char* ctypeKind2Str[CT_KIND_LENGTH] = {
+    "void",
+    "char",
+    "short",
+    "int",
+    "long",
+    "float",
+    "double",
+    "struct",
+};
+
+/* A C type as far as codegen cares: a scalar or aggregate, any number of
+   pointers to it, and optionally an array of those. Plain values, so jobs on
+   different threads can pass them around freely. */
+typedef struct {
+    enum CTypeKind kind;
+    bool is_unsigned;
+    uint pointers;
+    uint length;    /* Elements when an array, 0 otherwise */
+    const struct aggregate_s* aggregate; /* Of a `CT_Struct`, NULL until it's defined */
+} CType;
+
+#define CTYPE(KIND) ((CType){ .kind = (KIND) })
+
+typedef struct {
+    const char* name; /* Interned */
+    CType       type;
+    uint        offset;
+} Field;
+
+/* A `struct` or `union`, registered by its tag before its fields are parsed
+   so they can point back at it */
+typedef struct aggregate_s {
+    const char* tag;       /* Interned */
+    const char* symbol;    /* Its QBE `:type`, unique within the module */
+    bool        is_union;
+    bool        complete;  /* Laid out, see `layoutAggregate` */
+    uint        size, align;
+    Field*      fields;
+    uint        num_fields;
+    struct aggregate_s* next;
+} Aggregate, *pAggregate;
+
+/* Declaration specifiers and `*`s up to the first `=`, `(`, `[`, `,`, `)`
+   or `;`. `identifier` is set to the declared name if there is one, `struct`
+   and `union` tags are looked up in `aggregates`. */
+CType parseCType  (const pToken tokens, const char** identifier, const Aggregate* aggregates);
+CType elementCType(const CType type); /* What `x[i]` or `*x` reads */
+
+uint  sizeofCType (const CType type);
+uint  alignofCType(const CType type);
+bool  isIntegerCType(const CType type); /* Pointers count */
+bool  isAggregateCType(const CType type); /* A `struct` or `union` itself, not a pointer to one */
+
+/* Offsets by C's rules: each field at a multiple of its alignment, every
+   field of a union at 0, the size rounded up to the strictest alignment */
+void  layoutAggregate(pAggregate aggregate);
+const Field* findField(const Aggregate* aggregate, const char* name); /* `name` interned */
+
+/* `w`/`l`/`s`/`d` for temporaries, narrow integers are widened in a `w`.
+   Arrays and aggregates are their address. */
+enum QbeType qbeBaseType  (const CType type);
+/* `b`/`h` as well, for loads, stores and data */
+enum QbeType qbeMemoryType(const CType type);
+
+const char* loadInstr   (const CType type); /* `loadsb`, `loaduh`, `loadl`... */
+const char* convertInstr(const CType to, const CType from); /* NULL when `copy` will do */
+int64_t     foldCType   (const CType type, const int64_t value); /* Wraps a constant as the type would */
+
+#endif /* QUEBEC_CTYPES_H */
@@ -1,8 +0,0 @@
-#ifndef QUEBEC_FLAGS_H
-#define QUEBEC_FLAGS_H
-
-#include <stdbool.h>
-
-extern bool global_VERBOSE;
-
-#endif /* QUEBEC_FLAGS_H */
\ No newline at end of file
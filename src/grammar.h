@@ -30,6 +30,9 @@ static inline bool isOperator(const char c1, const char c2) {
         (c1=='-' && c2=='>') ||
         (c1=='<' && c2=='<') ||
         (c1=='>' && c2=='>') ||
+        (c1=='&' && c2=='&') ||
+        (c1=='|' && c2=='|') ||
+        (c1=='#' && c2=='#') ||
         0
     );
 }
@@ -0,0 +1,148 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "memory.h"
+
+#define INTERN_CHUNK_SIZE (64*1024)
+#define INTERN_SHARDS     64 /* Picked by the top hash bits so lexer threads rarely share a lock */
+
+typedef struct intern_chunk_s {
+    size_t used, capacity;
+    struct intern_chunk_s* next;
+    char data[];
+} *pInternChunk;
+
+typedef struct {
+    uint        hash;
+    const char* text;
+} InternSlot;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pInternChunk    chunks;
+    InternSlot*     slots;
+    uint            count;
+    uint            capacity; /* Always a power of two */
+} InternShard;
+
+static InternShard global_InternShards[INTERN_SHARDS] = {
+    [0 ... INTERN_SHARDS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static inline InternShard* shardOf(const uint hash) {
+    return &global_InternShards[hash >> 26];
+}
+
+uint hashStringN(const char* s, const size_t len) {
+    uint hash = 2166136261u; /* FNV-1a */
+    for (size_t i = 0; i<len; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint hashString(const char* s) {
+    return hashStringN(s, strlen(s));
+}
+
+static char* storeString(InternShard* shard, const char* s, const size_t len) {
+    pInternChunk chunk = shard->chunks;
+    if (chunk == NULL || chunk->used + len + 1 > chunk->capacity) {
+        const size_t capacity = len+1 > INTERN_CHUNK_SIZE ? len+1 : INTERN_CHUNK_SIZE;
+        chunk = allocMemory(MEM_Lexer, sizeof(*chunk) + capacity);
+        chunk->used     = 0;
+        chunk->capacity = capacity;
+        chunk->next     = shard->chunks;
+        shard->chunks   = chunk;
+    }
+    char* text = chunk->data + chunk->used;
+    memcpy(text, s, len);
+    text[len] = 0;
+    chunk->used += len + 1;
+    return text;
+}
+
+static void growInternSlots(InternShard* shard) {
+    const uint   capacity = shard->capacity ? 2*shard->capacity : 256;
+    InternSlot*  slots    = callocMemory(MEM_Lexer, capacity, sizeof(InternSlot));
+
+    for (uint i = 0; i<shard->capacity; i++) {
+        const InternSlot slot = shard->slots[i];
+        if (slot.text == NULL) continue;
+        uint index = slot.hash & (capacity-1);
+        while (slots[index].text) index = (index+1) & (capacity-1);
+        slots[index] = slot;
+    }
+
+    freeMemory(shard->slots);
+    shard->slots    = slots;
+    shard->capacity = capacity;
+}
+
+/* Linear probing; returns the slot holding `s` or the empty slot it belongs in */
+static InternSlot* findSlot(InternShard* shard, const char* s, const size_t len, const uint hash) {
+    if (2*(shard->count+1) > shard->capacity) growInternSlots(shard);
+
+    uint index = hash & (shard->capacity-1);
+    for (;;) {
+        InternSlot* slot = &shard->slots[index];
+        if (slot->text == NULL) return slot;
+        if (slot->hash == hash && strncmp(slot->text, s, len)==0 && slot->text[len]==0) return slot;
+        index = (index+1) & (shard->capacity-1);
+    }
+}
+
+const char* internStringN(const char* s, const size_t len) {
+    const uint   hash  = hashStringN(s, len);
+    InternShard* shard = shardOf(hash);
+    pthread_mutex_lock(&shard->lock);
+    InternSlot*  slot  = findSlot(shard, s, len, hash);
+    if (slot->text == NULL) {
+        *slot = (InternSlot){ .hash=hash, .text=storeString(shard, s, len) };
+        shard->count++;
+    }
+    const char* text = slot->text;
+    pthread_mutex_unlock(&shard->lock);
+    return text;
+}
+
+const char* internString(const char* s) {
+    return internStringN(s, strlen(s));
+}
+
+const char* adoptString(const char* s) {
+    const size_t len   = strlen(s);
+    const uint   hash  = hashStringN(s, len);
+    InternShard* shard = shardOf(hash);
+    pthread_mutex_lock(&shard->lock);
+    InternSlot*  slot  = findSlot(shard, s, len, hash);
+    if (slot->text == NULL) {
+        *slot = (InternSlot){ .hash=hash, .text=s };
+        shard->count++;
+    }
+    const char* text = slot->text;
+    pthread_mutex_unlock(&shard->lock);
+    return text;
+}
+
+void clearInternedStrings(void) {
+    for (uint i = 0; i<INTERN_SHARDS; i++) {
+        InternShard* shard = &global_InternShards[i];
+        pInternChunk chunk = shard->chunks;
+        while (chunk) {
+            pInternChunk next = chunk->next;
+            freeMemory(chunk);
+            chunk = next;
+        }
+        freeMemory(shard->slots);
+
+        shard->chunks   = NULL;
+        shard->slots    = NULL;
+        shard->count    = 0;
+        shard->capacity = 0;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef QUEBEC_INTERN_H
+#define QUEBEC_INTERN_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Every token's text lives in a single invocation-wide string pool, so
+   equal spellings share one pointer and tokens never own their text.
+   Interning is safe from several threads, clearing the pool is not. */
+
+uint        hashString   (const char* s);
+uint        hashStringN  (const char* s, const size_t len);
+
+const char* internString (const char* s);
+const char* internStringN(const char* s, const size_t len);
+const char* adoptString  (const char* s); /* Interns `s` in place, `s` must outlive the pool */
+
+void        clearInternedStrings(void);
+
+#endif /* QUEBEC_INTERN_H */
@@ -5,40 +5,28 @@
 #include <string.h>
 #include <stdbool.h>
 
-pSyntaxNode newSyntaxNode(const pToken tokens) {
-    pSyntaxNode snp = malloc(sizeof(*snp));
-    snp->type     = NT_INVALID;
-    snp->tokens   = tokens;
-    snp->parent   = NULL;
-    snp->next     = NULL;
-    snp->children = NULL;
-    return snp;
-}
-void delSyntaxNode(pSyntaxNode* head) {
-    if (head == NULL || *head == NULL) return;
-    delToken( &((*head)->tokens) );
-    delSyntaxNode( &((*head)->next) );
-    delSyntaxNode( &((*head)->children) );
-    free(*head);
-    *head = NULL;
-}
-void dumpSyntaxTree(const pSyntaxNode head, const size_t level) {
-    if (head == NULL) return;
-    for (size_t i = 0; i<level; i++) printf(" * ");
-    listTokens(head->tokens);
-    printf("\n");
-    // printf("(%s)\n", nodeType2Str[head->type]);
-    dumpSyntaxTree(head->children, level+1);
-    dumpSyntaxTree(head->next, level);
+#include "memory.h"
+
+void delSyntaxTree(pSyntaxTree* tree) {
+    if (tree == NULL || *tree == NULL) return;
+    freeMemory(*tree);
+    *tree = NULL;
 }
-void appendSyntaxNode(pSyntaxNode* head, pSyntaxNode next) {
-    if (head==NULL || *head==NULL)   *head        = next;
-    else if ((*head)->next == NULL) (*head)->next = next;
-    else appendSyntaxNode( &((*head)->next), next );
+
+static void dumpSyntaxNodes(const pSyntaxTree tree, NodeId id, const size_t level) {
+    for (; id != NO_NODE; id = treeNode(tree, id)->next) {
+        const pSyntaxNode node = treeNode(tree, id);
+        char   buf[256];
+        size_t len = 0;
+        for (size_t i = 0; i<level && len<sizeof(buf); i++) len += snprintf(buf+len, sizeof(buf)-len, " * ");
+        for (pToken t = nodeTokens(tree, node); t && len<sizeof(buf); t = t->next)
+            len += snprintf(buf+len, sizeof(buf)-len, "`%s` ", t->text);
+        traceRecord(TRACE_Tree, TRACE_Dump, "%s", buf);
+        dumpSyntaxNodes(tree, node->children, level+1);
+    }
 }
-void addChildSyntaxNode(pSyntaxNode parent, pSyntaxNode child) {
-    child->parent = parent;
-    appendSyntaxNode( &(parent->children), child );
+void dumpSyntaxTree(const pSyntaxTree tree) {
+    dumpSyntaxNodes(tree, treeNode(tree, NO_NODE)->children, 1);
 }
 
 static bool isUpToken(const pToken token) {
@@ -61,35 +49,127 @@ static bool isStatementToken(const pToken token) {
     return strcmp(token->text, ";")==0;
 }
 
-pSyntaxNode buildTreeFromTokens(const pToken tokens) {
-    pSyntaxNode master  = newSyntaxNode(NULL);
-    pSyntaxNode current = master;
+pSyntaxTree buildTreeFromTokens(pToken tokens) {
+    uint32_t num_tokens = 0;
+    for (pToken t = tokens; t; t = t->next) num_tokens++;
+
+    pSyntaxTree tree = allocMemory(MEM_Tree, sizeof(*tree) + num_tokens*sizeof(struct token_s) + (num_tokens+1)*sizeof(SyntaxNode));
+    tree->num_tokens = num_tokens;
+    tree->num_nodes  = 1;
+    tree->tokens     = (struct token_s*)(tree + 1);
+    tree->nodes      = (SyntaxNode*)(tree->tokens + num_tokens);
+    tree->nodes[NO_NODE] = (SyntaxNode){
+        .type        = NT_INVALID,
+        .parent      = NO_NODE,
+        .next        = NO_NODE,
+        .children    = NO_NODE,
+        .first_token = 0,
+        .num_tokens  = 0
+    };
 
-    pToken token = tokens;
-    pSyntaxNode temp = newSyntaxNode(NULL);
-    while (token) {
+    /* Flatten the token list into the tree */
+    uint32_t index = 0;
+    while (tokens) {
+        pToken next = tokens->next;
+        tree->tokens[index]      = *tokens;
+        tree->tokens[index].next = NULL;
+        freeMemory(tokens);
+        tokens = next;
+        index++;
+    }
+
+    /* Path from the root to the current node, with each one's last child so appends are O(1) */
+    uint32_t depth = 0, capacity = 64;
+    struct { NodeId node, last_child; } *path = allocMemory(MEM_Tree, capacity*sizeof(*path));
+    path[0].node       = NO_NODE;
+    path[0].last_child = NO_NODE;
+
+    #define addNode(LAST) ({\
+        const NodeId id = tree->num_nodes++;\
+        tree->nodes[id] = (SyntaxNode){\
+            .type        = NT_INVALID,\
+            .parent      = path[depth].node,\
+            .next        = NO_NODE,\
+            .children    = NO_NODE,\
+            .first_token = start,\
+            .num_tokens  = (LAST) + 1 - start\
+        };\
+        if (path[depth].last_child != NO_NODE) tree->nodes[path[depth].last_child].next = id;\
+        else                                   tree->nodes[path[depth].node].children   = id;\
+        path[depth].last_child = id;\
+        start = (LAST) + 1;\
+        id;\
+    })
 
-        pToken next = pluckToken(token);
-        appendToken( &(temp->tokens), token);
+    uint32_t start = 0;
+    for (index = 0; index<num_tokens; index++) {
+        const pToken token = &(tree->tokens[index]);
 
         if (isDownToken(token)) {
-            addChildSyntaxNode(current, temp);
-            current = temp;
-            temp    = newSyntaxNode(NULL);
+            const NodeId id = addNode(index);
+            if (++depth == capacity) path = reallocMemory(MEM_Tree, path, (capacity *= 2)*sizeof(*path));
+            path[depth].node       = id;
+            path[depth].last_child = NO_NODE;
         }
         if (isUpToken(token)) {
-            addChildSyntaxNode(current, temp);
-            current = current->parent;
-            temp    = newSyntaxNode(NULL);
+            addNode(index);
+            if (depth == 0) {
+                fprintfToken(stdout, token);
+                ERRO(EXIT_FAILURE, "Unbalanced `%s`", token->text);
+            }
+            depth--;
         }
-        if (isStatementToken(token)) {
-            addChildSyntaxNode(current, temp);
-            temp = newSyntaxNode(NULL);
+        if (isStatementToken(token)) addNode(index);
+    }
+    #undef addNode
+    freeMemory(path);
+    /* Trailing tokens that never reached a delimiter don't belong to any node */
+
+    /* Chain each node's tokens so they still read as a NULL-terminated list */
+    for (NodeId id = 1; id<tree->num_nodes; id++) {
+        const pSyntaxNode node = treeNode(tree, id);
+        for (uint32_t i = 1; i<node->num_tokens; i++)
+            tree->tokens[node->first_token + i-1].next = &(tree->tokens[node->first_token + i]);
+    }
+
+    return tree;
+}
+
+static void flushTreeBuilder(pTreeBuilder builder) {
+    if (builder->head == NULL) return;
+    builder->sink(builder->sink_context, buildTreeFromTokens(builder->head));
+    builder->head = NULL;
+    builder->tail = &(builder->head);
+}
+
+void feedTreeBuilder(pTreeBuilder builder, pToken tokens) {
+    if (builder->tail == NULL) {
+        builder->tail    = &(builder->head);
+        builder->at_node = true;
+    }
+
+    while (tokens) {
+        pToken token = tokens;
+        tokens = pluckToken(token);
+
+        if (builder->depth == 0 && builder->at_node) {
+            if (builder->unit_done) flushTreeBuilder(builder);
+            builder->in_body   = strcmp(token->text, "{")==0;
+            builder->unit_done = false;
         }
+        *(builder->tail) = token;
+        builder->tail    = &(token->next);
 
-        token = next;
+        builder->at_node = false;
+        if (isDownToken(token)) builder->depth++;
+        if (isUpToken(token) && builder->depth) builder->depth--;
+        if (builder->depth == 0 && (isUpToken(token) || isStatementToken(token))) {
+            builder->at_node   = true;
+            builder->unit_done = isStatementToken(token) || builder->in_body;
+        }
     }
-    if (temp != NULL) delSyntaxNode(&temp); /* We clearly didn't use this so delete it */
+}
 
-    return master;
-}
\ No newline at end of file
+void finishTreeBuilder(pTreeBuilder builder) {
+    flushTreeBuilder(builder);
+}
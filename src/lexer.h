@@ -1,6 +1,9 @@
 #ifndef QUEBEC_LEXER_H
 #define QUEBEC_LEXER_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "parse.h"
 
 enum NodeType {
@@ -26,18 +29,61 @@ __attribute_maybe_unused__ static const char* nodeType2Str[NT_LENGTH] = {
     "Return",
 };
 
+typedef uint32_t NodeId;
+#define NO_NODE 0 /* Node 0 is the root, which is never anyone's child or sibling */
+
 typedef struct syntax_node_s {
     enum NodeType type;
-    pToken tokens;
-    struct syntax_node_s *parent, *next, *children;
-} *pSyntaxNode;
+    NodeId   parent, next, children;
+    uint32_t first_token, num_tokens; /* Range into the tree's token array */
+} SyntaxNode, *pSyntaxNode;
+
+/* Nodes and tokens share one allocation: every node but the root owns at
+   least one token, so `num_tokens+1` nodes is always enough. Nodes are
+   created in pre-order, so walking the tree mostly walks the array. */
+typedef struct syntax_tree_s {
+    uint32_t   num_nodes;
+    uint32_t   num_tokens;
+    SyntaxNode*     nodes;
+    struct token_s* tokens;
+} *pSyntaxTree;
+
+static inline pSyntaxNode treeNode(const pSyntaxTree tree, const NodeId id) {
+    return &(tree->nodes[id]);
+}
+static inline pToken nodeTokens(const pSyntaxTree tree, const pSyntaxNode node) {
+    return node->num_tokens ? &(tree->tokens[node->first_token]) : NULL;
+}
+
+/* Whether a top-level node finishes the function or declaration it's part
+   of: a `;`, or a `{` body. Anything else carries on into the next node, like
+   the `(` of `x = 4 * (3 + 1) - 1;` or the `= {` of an initializer. */
+static inline bool endsUnit(const pSyntaxTree tree, const pSyntaxNode node) {
+    const char* first = tree->tokens[node->first_token].text;
+    const char* last  = tree->tokens[node->first_token + node->num_tokens-1].text;
+    return (last[0] == ';' && last[1] == 0) || (first[0] == '{' && first[1] == 0);
+}
+
+/* Cuts a token stream into top-level functions and declarations, the same
+   units codegen treats as jobs, and builds each into its own tree as soon as
+   the first token of the next one arrives */
+typedef void (*TreeSink)(void* context, pSyntaxTree tree);
+typedef struct tree_builder_s {
+    pToken   head;
+    pToken*  tail;
+    uint32_t depth;
+    bool     at_node;   /* The next token at depth 0 starts a new top-level node */
+    bool     in_body;   /* The current top-level node is a `{` body */
+    bool     unit_done; /* And the last one finished its unit, see `endsUnit` */
+    TreeSink sink;
+    void*    sink_context;
+} TreeBuilder, *pTreeBuilder;
 
-pSyntaxNode newSyntaxNode(const pToken tokens);
-void   delSyntaxNode(pSyntaxNode* head);
-void   dumpSyntaxTree(const pSyntaxNode head, const size_t level);
-void   appendSyntaxNode(pSyntaxNode* head, pSyntaxNode next);
-void   addChildSyntaxNode(pSyntaxNode parent, pSyntaxNode child);
+void feedTreeBuilder  (pTreeBuilder builder, pToken tokens);
+void finishTreeBuilder(pTreeBuilder builder);
 
-pSyntaxNode buildTreeFromTokens(const pToken tokens);
+pSyntaxTree buildTreeFromTokens(pToken tokens);
+void        delSyntaxTree (pSyntaxTree* tree);
+void        dumpSyntaxTree(const pSyntaxTree tree); /* As `TRACE_Tree` records */
 
 #endif /* QUEBEC_LEXER_H */
\ No newline at end of file
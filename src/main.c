@@ -1,12 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "common.h"
-#include "flags.h"
 #include "parse.h"
+#include "preprocess.h"
+#include "pch.h"
+#include "intern.h"
+#include "memory.h"
 #include "lexer.h"
 #include "qbe.h"
+#include "pipeline.h"
+#include "process.h"
+#include "profile.h"
+#include "watch.h"
 
 #define TUCKY_INFO_OVERRIDE
     #define TUCKY_APP       "Quebec C-Compiler"
@@ -14,83 +26,398 @@
     #define TUCKY_AUTHOR    "Jonah Hendler"
     #define TUCKY_DATE      "May 26th, 2024"
 
+#define TUCKY_MALLOC(SIZE) allocMemory(MEM_Driver, SIZE)
+#define TUCKY_FREE(PTR)    freeMemory(PTR)
+
 #include "argparse.h"
 
-bool global_VERBOSE;
+/* Everything a build needs again when `--watch` rebuilds it */
+typedef struct {
+    pPreprocessor pp;
+    const char**  sources;
+    uint          num_units;
+    uint          num_modules;                 /* One per translation unit, or just one with `--unity` */
+    char        (*paths)[SCRATCH_PATH_LENGTH]; /* `.ssa` then `.s` per module, then the executable */
+    pCodeCache*   caches;                      /* Per translation unit, only while watching */
+    bool*         stale;                       /* Couldn't be compiled, or assembled, last time */
+    int*          scratch;
+    uint          num_scratch;
+    char**        tool_argv;
+    const char*   outfile_path;
+    char*         dep_path;                    /* Rule for `outfile_path` rewritten by every link, see `-MD` */
+    const char*   pch_path;
+    bool          in_memory;
+    bool          pipelined;
+    CodeOptions   code;
+    uint          max_steps;
+} Build;
+
+static volatile sig_atomic_t global_Interrupted = 0;
+
+static void interrupt(int signal) {
+    (void)signal;
+    global_Interrupted = 1;
+}
+
+/* Into its own module unless `module` is shared */
+static bool compileSource(Build* build, const uint unit, pCodeFile module) {
+    const char* source = build->sources[unit];
+
+    INFO("Parsing...    STEP (%d/%d) %s", 1, build->max_steps, source);
+    pFileLine file_as_lines = readFileAsLines(source);
+    if (file_as_lines == NULL) return false;
+    pCodeFile file = module ? module : openCodeFile(build->paths[2*unit], &(build->code));
+
+    if (build->pipelined) {
+        INFO("Assembling... STEP (%d/%d) %s", 2, build->max_steps, source);
+        compilePipelined(build->pp, file_as_lines, file);
+        if (module == NULL) closeCodeFile(&file);
+        delFileLine(&file_as_lines);
+        return true;
+    }
+    pToken file_as_tokens = preprocessFile(build->pp, file_as_lines);
+
+    /************************************************/
+    pSyntaxTree tree = buildTreeFromTokens(file_as_tokens);
+    if (TRACING(TRACE_Tree, TRACE_Dump)) dumpSyntaxTree(tree);
+    TRACE(TRACE_Tree, TRACE_Info, "%s: %u node(s) over %u token(s)", source, tree->num_nodes, tree->num_tokens);
+
+    INFO("Assembling... STEP (%d/%d) %s", 2, build->max_steps, source);
+    compileTree(file, tree, build->pp->jobs, build->caches ? build->caches[unit] : NULL);
+    if (module == NULL) closeCodeFile(&file);
+
+    delSyntaxTree(&tree);
+    delFileLine(&file_as_lines);
+    return true;
+}
+
+/* Units that changed (all when `dirty` is NULL), marking those that can't be read stale */
+static bool compileSources(Build* build, const bool* dirty) {
+    bool ok = true;
+    if (build->num_modules == 1 && build->num_units > 1) {
+        /* `--unity`, every unit goes into the one module whatever changed */
+        pCodeFile module = openCodeFile(build->paths[0], &(build->code));
+        for (uint unit = 0; unit<build->num_units; unit++) {
+            startCodeUnit(module);
+            ok &= !(build->stale[unit] = !compileSource(build, unit, module));
+        }
+        closeCodeFile(&module);
+        return ok;
+    }
+    for (uint unit = 0; unit<build->num_units; unit++)
+        if (dirty == NULL || dirty[unit]) ok &= !(build->stale[unit] = !compileSource(build, unit, NULL));
+    return ok;
+}
+
+/* One `qbe` per module that changed (all when `dirty` is NULL), then a single link, no shell in between */
+static int assembleAndLink(Build* build, const bool* dirty) {
+    INFO("Compiling...  STEP (%d/%d)", 3, build->max_steps);
+    int ret = EXIT_SUCCESS;
+    for (uint module = 0; module<build->num_modules && ret == EXIT_SUCCESS; module++) {
+        if (dirty && build->num_modules == build->num_units && !dirty[module]) continue;
+        ret = runTool((char*[]){ "qbe", "-o", build->paths[2*module+1], build->paths[2*module], NULL });
+        TRACE(TRACE_Driver, TRACE_Info, "QBE ret code = %d", ret);
+    }
+    if (ret == EXIT_SUCCESS) {
+        uint n = 0;
+        build->tool_argv[n++] = "cc";
+        build->tool_argv[n++] = "-o";
+        build->tool_argv[n++] = build->in_memory ? build->paths[2*build->num_modules] : (char*)build->outfile_path;
+        build->tool_argv[n++] = "-x"; /* Scratch files have no extension to go by */
+        build->tool_argv[n++] = "assembler";
+        for (uint module = 0; module<build->num_modules; module++) build->tool_argv[n++] = build->paths[2*module+1];
+        build->tool_argv[n] = NULL;
+        ret = runTool(build->tool_argv);
+        TRACE(TRACE_Driver, TRACE_Info, "Link ret code = %d", ret);
+    }
+    if (ret != EXIT_SUCCESS) WARN("QBE did not compile successfully!\n");
+    if (ret == EXIT_SUCCESS && build->dep_path &&
+        !emitDepFile(build->pp, build->dep_path, build->outfile_path, build->sources, build->num_units, build->pch_path))
+        ret = EXIT_FAILURE;
+    return ret;
+}
+
+static int runProgram(Build* build, char** run_argv) {
+    INFO("Running...    STEP (%d/%d)", 4, build->max_steps);
+    const int exe = build->in_memory ? build->scratch[build->num_scratch-1] : open(build->outfile_path, O_RDONLY | O_CLOEXEC);
+    if (exe < 0) {
+        WARN("Could not open (%s) to run it", build->outfile_path);
+        return EXIT_FAILURE;
+    }
+    const int ret = execFile(exe, run_argv);
+    TRACE(TRACE_Driver, TRACE_Info, "Run ret code = %d", ret);
+    if (!build->in_memory) close(exe);
+    return ret;
+}
+
+static double elapsedMs(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)*1e3 + (now.tv_nsec - start->tv_nsec)/1e6;
+}
+
+/* Rebuilds whatever a change touches until interrupted. A changed header
+   rebuilds every unit, the lexer and code caches keep that cheap. */
+static int watchBuild(Build* build, const bool run_immed, char** run_argv) {
+    pWatcher watcher = newWatcher();
+    if (watcher == NULL) return EXIT_FAILURE;
+    bool* dirty = allocMemory(MEM_Driver, build->num_units * sizeof(bool));
+    int   ret   = EXIT_SUCCESS;
+
+    while (!global_Interrupted) {
+        for (uint unit = 0; unit<build->num_units; unit++) watchFile(watcher, build->sources[unit]);
+        for (pHeader header = build->pp->headers; header; header = header->next)
+            if (header->lines) watchFile(watcher, header->path);
+        INFO("Watching for changes, ^C to stop");
+        if (!waitForChanges(watcher)) break;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        bool headers_changed = false;
+        for (pHeader header = build->pp->headers, next; header; header = next) {
+            next = header->next;
+            if (!fileChanged(watcher, header->path)) continue;
+            forgetHeader(build->pp, header->path);
+            headers_changed = true;
+        }
+
+        uint num_dirty = 0;
+        for (uint unit = 0; unit<build->num_units; unit++) {
+            dirty[unit] = headers_changed || build->stale[unit] || fileChanged(watcher, build->sources[unit]);
+            num_dirty += dirty[unit];
+        }
+        if (num_dirty == 0) continue;
+        const bool ok = compileSources(build, dirty);
+        trimLexCache(build->pp->lex_cache);
+
+        ret = ok ? assembleAndLink(build, dirty) : EXIT_FAILURE;
+        for (uint unit = 0; unit<build->num_units; unit++) build->stale[unit] = dirty[unit] && ret != EXIT_SUCCESS;
+        INFO("Rebuilt %u of %u unit(s) in %.1fms", num_dirty, build->num_units, elapsedMs(&start));
+        if (ret == EXIT_SUCCESS && run_immed) ret = runProgram(build, run_argv);
+    }
+
+    freeMemory(dirty);
+    delWatcher(&watcher);
+    return ret;
+}
 
 int main(int argc, char** argv) {
     /****************************************************/
+    /* Everything after `--` belongs to the program `-r` runs */
+    int run_argc = 0;
+    for (int i = 1; i<argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            run_argc = argc-i-1;
+            argc     = i;
+            break;
+        }
+    }
+    char** run_args = argv + argc + 1;
+
     TuckyArgParser parser = newArgParser(argc, argv);
 
     addArgument(&parser, 'f', "file"   ,    AS_MANY, REQUIRED, "Input file path");
-    addArgument(&parser, 'o', "out"    ,          1, REQUIRED, "Output file path");
-    addArgument(&parser, 'v', "verbose", STORE_TRUE, OPTIONAL, "Enable verbose output");
+    addArgument(&parser, 'o', "out"    ,          1, OPTIONAL, "Output file path, `-r` alone links in memory");
+    addArgument(&parser, 'v', "verbose", STORE_TRUE, OPTIONAL, "Trace everything to stdout");
     addArgument(&parser, 'r', "run"    , STORE_TRUE, OPTIONAL, "After compilation, immediately run the program");
+    addArgument(&parser, 'I', "include",    AS_MANY, OPTIONAL, "Header search directory");
+    addArgument(&parser, 'P', "emit-pch", STORE_TRUE, OPTIONAL, "Precompile the input header into the output file instead");
+    addArgument(&parser, 'H', "include-pch",       1, OPTIONAL, "Start every input with this precompiled header");
+    addArgument(&parser, 'X', "macro-stats", STORE_TRUE, OPTIONAL, "Report expansion counts and token blow-up per macro");
+    addArgument(&parser, 'T', "trace",       1, OPTIONAL, "Write trace records to this file");
+    addArgument(&parser, 'C', "trace-categories", 1, OPTIONAL, "Categories to trace, e.g. `grammar=3,codegen` (default `all=2`)");
+    addArgument(&parser, 'B', "trace-binary", STORE_TRUE, OPTIONAL, "Write binary trace records instead of text");
+    addArgument(&parser, 'j', "jobs",         1, OPTIONAL, "Lex and generate code on this many threads");
+    addArgument(&parser, 'p', "pipeline",     STORE_TRUE, OPTIONAL, "Preprocess, build trees and generate code on separate threads");
+    addArgument(&parser, 'm', "mem-report",   STORE_TRUE, OPTIONAL, "Report allocations and peak live memory per phase");
+    addArgument(&parser, 'M', "MD",           STORE_TRUE, OPTIONAL, "Also write a Makefile rule on the sources and every header they include");
+    addArgument(&parser, 'F', "MF",                    1, OPTIONAL, "Write that rule here instead of next to the output, implies `-MD`");
+    addArgument(&parser, 'w', "watch",        STORE_TRUE, OPTIONAL, "Stay resident and rebuild whenever an input or header changes");
+    addArgument(&parser, 'U', "unity",        STORE_TRUE, OPTIONAL, "Compile every input into one QBE module, one `qbe` and `cc` for the lot");
+    addArgument(&parser, 'i', "instrument",   STORE_TRUE, OPTIONAL, "Count calls and blocks, the program appends them to $" PROFILE_ENV " (or " PROFILE_DEFAULT ") at exit");
+    addArgument(&parser, 'u', "profile-use",           1, OPTIONAL, "Lay out functions hottest first by the counts in this profile");
+    addArgument(&parser, 'g', "debug",        STORE_TRUE, OPTIONAL, "Emit `dbgfile`/`dbgloc` so profilers and debuggers can map code back to C lines");
 
     parseArgs(parser);
 
-    const char* file_path    = getArgumentFromFlag(parser, 'f')->args->txt;
-    const char* outfile_path = getArgumentFromFlag(parser, 'o')->args->txt;
-    const bool  run_immed    = getArgumentFromFlag(parser, 'r')->enabled;
+    const TuckyArgument file_paths   = getArgumentFromFlag(parser, 'f');
+    const char*         outfile_path = getArgumentValue(getArgumentFromFlag(parser, 'o'));
+    const bool          run_immed    = getArgumentFromFlag(parser, 'r')->enabled;
+    const bool          mem_report   = getArgumentFromFlag(parser, 'm')->enabled;
+    const bool          watching     = getArgumentFromFlag(parser, 'w')->enabled;
+    const bool          pipelined    = getArgumentFromFlag(parser, 'p')->enabled && !watching; /* Rebuilds go through the caches */
     
-    global_VERBOSE           = getArgumentFromFlag(parser, 'v')->enabled;
-    if (global_VERBOSE) { printf("[DEBG] Verbose output enabled\n"); }
+    /* Running without `-o` keeps every intermediate file in memory */
+    const bool in_memory = run_immed && outfile_path == NULL;
+    if (outfile_path == NULL && (!run_immed || getArgumentFromFlag(parser, 'P')->enabled)) {
+        WARN("Missing output path (`-o`)");
+        delArgParser(parser);
+        return EXIT_FAILURE;
+    }
 
-    uint       step      = 0;
-    const uint max_steps = run_immed ? 4 : 3;
+    const char* trace_path = getArgumentValue(getArgumentFromFlag(parser, 'T'));
+    const char* trace_spec = getArgumentValue(getArgumentFromFlag(parser, 'C'));
+    if (trace_path || trace_spec || getArgumentFromFlag(parser, 'v')->enabled) {
+        const bool verbose = getArgumentFromFlag(parser, 'v')->enabled && trace_path == NULL;
+        if (!setTraceLevels(trace_spec ? trace_spec : verbose ? "all=3" : "all=2") ||
+            !openTrace(trace_path, getArgumentFromFlag(parser, 'B')->enabled)) {
+            delArgParser(parser);
+            return EXIT_FAILURE;
+        }
+    }
 
-    /****************************************************/
-    INFO("Parsing...    STEP (%d/%d)", ++step, max_steps);
-    pFileLine file_as_lines = readFileAsLines(file_path);
-    if (file_as_lines == NULL) return EXIT_FAILURE;
+    const char*   jobs     = getArgumentValue(getArgumentFromFlag(parser, 'j'));
+    char*         jobs_end = NULL;
+    unsigned long num_jobs = jobs ? strtoul(jobs, &jobs_end, 10) : 1;
+    if (jobs && (jobs_end == jobs || *jobs_end || *jobs == '-' || num_jobs == 0 || num_jobs > UINT_MAX))
+        ERRO(EXIT_FAILURE, "Jobs (`-j %s`) must be a positive number", jobs);
+
+    pPreprocessor pp = newPreprocessor();
+    TUCKY_FOREACH(dir, getArgumentFromFlag(parser, 'I')) addIncludeDir(pp, dir);
+    pp->jobs = (uint)num_jobs;
 
-    pFileLine temp = file_as_lines;
-    pToken file_as_tokens = NULL;
-    while (temp) {
-        if (global_VERBOSE) { printf("[DEBG] "); dumpFileLine(temp); }
-        pToken line_as_tokens = tokenizeLine(temp);
-        if (line_as_tokens == NULL) goto next;
+    if (getArgumentFromFlag(parser, 'P')->enabled) {
+        INFO("Precompiling... %s", file_paths->args[0]);
+        pHeader header = NULL;
+        pToken  tokens = preprocessHeader(pp, file_paths->args[0], &header);
+        const int ret  = header ? emitPch(outfile_path, pp, header, tokens) : EXIT_FAILURE;
+        if (header == NULL) WARN("File (%s) does not exist", file_paths->args[0]);
 
-        appendToken(&file_as_tokens, line_as_tokens);
-next:
-        temp = temp->next;
+        delToken(&tokens);
+        delPreprocessor(&pp);
+        clearInternedStrings();
+        closeTrace();
+        delArgParser(parser);
+        if (mem_report) dumpMemoryReport();
+        return ret;
     }
 
-    /****************************************************/
-    pSyntaxNode master = buildTreeFromTokens(file_as_tokens);
-    if (global_VERBOSE) { printf("[DEBG]"); dumpSyntaxTree(master, 0); }
+    const char* pch_path = getArgumentValue(getArgumentFromFlag(parser, 'H'));
+    pPch pch = pch_path ? loadPch(pch_path) : NULL;
+    if (pch_path && pch == NULL) {
+        delPreprocessor(&pp);
+        closeTrace();
+        delArgParser(parser);
+        return EXIT_FAILURE;
+    }
+    pp->pch = pch;
 
-    INFO("Assembling... STEP (%d/%d)", ++step, max_steps);
-    compileFile(outfile_path, master);
+    const char* profile_path = getArgumentValue(getArgumentFromFlag(parser, 'u'));
+    pProfile profile = profile_path ? loadProfile(profile_path) : NULL;
+    if (profile_path && profile == NULL) {
+        delPreprocessor(&pp);
+        delPch(&pch);
+        closeTrace();
+        delArgParser(parser);
+        return EXIT_FAILURE;
+    }
 
     /****************************************************/
-    
-    INFO("Compiling...  STEP (%d/%d)", ++step, max_steps);
-    char cmd_buf[256] = {0};
-    sprintf(cmd_buf, "qbe -o temp.s temp.ssa && cc -o %s temp.s\n", outfile_path);
-    int ret = system(cmd_buf);
-    if (global_VERBOSE) printf("[DEBG] QBE ret code = %d\n", ret);
-    
-    if (ret != EXIT_SUCCESS) {
-        WARN("QBE did not compile successfully!\n");
-        goto cleanup;
+    const uint num_units   = file_paths->num_args;
+    const uint num_modules = getArgumentFromFlag(parser, 'U')->enabled ? 1 : num_units;
+    Build build = {
+        .pp           = pp,
+        .sources      = file_paths->args,
+        .num_units    = num_units,
+        .num_modules  = num_modules,
+        .paths        = allocMemory(MEM_Driver, (2*num_modules+1) * SCRATCH_PATH_LENGTH),
+        .caches       = watching ? allocMemory(MEM_Driver, num_units * sizeof(pCodeCache)) : NULL,
+        .stale        = callocMemory(MEM_Driver, num_units, sizeof(bool)),
+        .scratch      = allocMemory(MEM_Driver, (2*num_modules+1) * sizeof(int)),
+        .num_scratch  = 0,
+        .tool_argv    = allocMemory(MEM_Driver, (num_modules+6) * sizeof(char*)),
+        .outfile_path = outfile_path,
+        .dep_path     = NULL,
+        .pch_path     = pch_path,
+        .in_memory    = in_memory,
+        .pipelined    = pipelined,
+        .code         = {
+            .instrument  = getArgumentFromFlag(parser, 'i')->enabled,
+            .debug_lines = getArgumentFromFlag(parser, 'g')->enabled,
+            .profile     = profile
+        },
+        .max_steps    = run_immed ? 4 : 3
+    };
+    if (watching) pp->lex_cache = newLexCache();
+
+    const char* dep_path = getArgumentValue(getArgumentFromFlag(parser, 'F'));
+    if ((dep_path || getArgumentFromFlag(parser, 'M')->enabled) && outfile_path == NULL) {
+        WARN("Dependency files need an output (`-o`) to name as their target");
+    } else if (dep_path) {
+        build.dep_path = strdupMemory(MEM_Driver, dep_path);
+    } else if (getArgumentFromFlag(parser, 'M')->enabled) {
+        /* `out.exe` -> `out.d`, like `gcc -MD` */
+        const char*  slash  = strrchr(outfile_path, '/');
+        const char*  base   = slash ? slash+1 : outfile_path;
+        const char*  dot    = strrchr(base, '.');
+        const size_t length = dot && dot != base ? (size_t)(dot - outfile_path) : strlen(outfile_path);
+        build.dep_path = allocMemory(MEM_Driver, length + 3);
+        memcpy(build.dep_path, outfile_path, length);
+        strcpy(build.dep_path + length, ".d");
+    }
+
+    int  exit_code = EXIT_SUCCESS;
+    for (uint unit = 0; unit<num_units && build.caches; unit++) build.caches[unit] = newCodeCache();
+    for (uint module = 0; module<num_modules; module++) {
+        if (in_memory) {
+            if ((build.scratch[build.num_scratch++] = openScratchFile("quebec-ssa", build.paths[2*module  ])) < 0 ||
+                (build.scratch[build.num_scratch++] = openScratchFile("quebec-asm", build.paths[2*module+1])) < 0) {
+                build.num_scratch -= build.scratch[build.num_scratch-1] < 0;
+                exit_code = EXIT_FAILURE;
+            }
+        } else {
+            sprintf(build.paths[2*module  ], "temp%u.ssa", module);
+            sprintf(build.paths[2*module+1], "temp%u.s"  , module);
+        }
+    }
+    if (in_memory && exit_code == EXIT_SUCCESS &&
+        (build.scratch[build.num_scratch++] = openScratchFile("quebec-run", build.paths[2*num_modules])) < 0) {
+        build.num_scratch--;
+        exit_code = EXIT_FAILURE;
     }
 
+    const bool ready = exit_code == EXIT_SUCCESS;
+    if (ready && !compileSources(&build, NULL)) exit_code = EXIT_FAILURE;
+    if (exit_code == EXIT_SUCCESS && getArgumentFromFlag(parser, 'X')->enabled) dumpMacroStats(pp);
+    if (ready && watching) trimLexCache(pp->lex_cache);
+
     /****************************************************/
-    
-    if (run_immed) {
-        INFO("Running...    STEP (%d/%d)", ++step, max_steps);
-        sprintf(cmd_buf, "./%s", outfile_path);
-        ret = system(cmd_buf);
-        if (global_VERBOSE) printf("[DEBG] Run ret code = %d\n", ret);
+
+    char** run_argv = allocMemory(MEM_Driver, (run_argc+2) * sizeof(char*));
+    run_argv[0] = (char*)(outfile_path ? outfile_path : file_paths->args[0]);
+    memcpy(run_argv+1, run_args, run_argc * sizeof(char*));
+    run_argv[run_argc+1] = NULL;
+
+    if (exit_code == EXIT_SUCCESS) exit_code = assembleAndLink(&build, NULL);
+    if (exit_code != EXIT_SUCCESS) memset(build.stale, true, num_units * sizeof(bool));
+    else if (run_immed)            exit_code = runProgram(&build, run_argv);
+
+    if (watching && ready) {
+        struct sigaction action = { .sa_handler = interrupt }; /* No `SA_RESTART`, so the wait gives up */
+        sigaction(SIGINT, &action, NULL);
+        exit_code = watchBuild(&build, run_immed, run_argv);
     }
 
     /****************************************************/
-cleanup:
-    delSyntaxNode(&master);
-    delFileLine(&file_as_lines);
+    freeMemory(run_argv);
+    while (build.num_scratch) close(build.scratch[--build.num_scratch]);
+    for (uint unit = 0; build.caches && unit<num_units; unit++) delCodeCache(&build.caches[unit]);
+    freeMemory(build.caches);
+    freeMemory(build.stale);
+    freeMemory(build.dep_path);
+    freeMemory(build.tool_argv);
+    freeMemory(build.scratch);
+    freeMemory(build.paths);
+    delProfile(&profile);
+    delLexCache(&pp->lex_cache);
+    delPreprocessor(&pp);
+    clearInternedStrings();
+    delPch(&pch); /* Interned strings may point into the mapping */
+    closeTrace();
     delArgParser(parser);
+    if (mem_report) dumpMemoryReport(); /* Anything still live by now leaked */
 
     INFO("All Done!\n");
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return exit_code;
+}
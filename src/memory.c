@@ -0,0 +1,106 @@
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sits in front of every block, padded so the block stays as aligned as `malloc`'s */
+typedef union {
+    struct {
+        size_t        size;
+        enum MemPhase phase;
+    };
+    long double align;
+} MemHeader;
+
+static MemStats global_MemStats[MEM_PHASE_LENGTH] = {0};
+static size_t   global_MemLive = 0;
+static size_t   global_MemPeak = 0;
+
+/* Lexer threads allocate concurrently, so counters are updated atomically */
+#define ADD(X, N) __atomic_add_fetch(&(X), (N), __ATOMIC_RELAXED)
+#define SUB(X, N) __atomic_sub_fetch(&(X), (N), __ATOMIC_RELAXED)
+
+static void raisePeak(size_t* peak, const size_t live) {
+    size_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > seen && !__atomic_compare_exchange_n(peak, &seen, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void accountAlloc(const enum MemPhase phase, const size_t size) {
+    MemStats* stats = &global_MemStats[phase];
+    ADD(stats->allocations, 1);
+    ADD(stats->bytes, size);
+    raisePeak(&stats->peak, ADD(stats->live, size));
+    raisePeak(&global_MemPeak, ADD(global_MemLive, size));
+}
+
+static void accountFree(const enum MemPhase phase, const size_t size) {
+    ADD(global_MemStats[phase].frees, 1);
+    SUB(global_MemStats[phase].live, size);
+    SUB(global_MemLive, size);
+}
+
+void* allocMemory(const enum MemPhase phase, const size_t size) {
+    MemHeader* header = malloc(sizeof(MemHeader) + size);
+    if (header == NULL) ERRO(EXIT_FAILURE, "Out of memory allocating %zu byte(s) for %s", size, memPhase2Str[phase]);
+    header->size  = size;
+    header->phase = phase;
+    accountAlloc(phase, size);
+    return header + 1;
+}
+
+void* callocMemory(const enum MemPhase phase, const size_t count, const size_t size) {
+    void* ptr = allocMemory(phase, count*size);
+    memset(ptr, 0, count*size);
+    return ptr;
+}
+
+void* reallocMemory(const enum MemPhase phase, void* ptr, const size_t size) {
+    if (ptr == NULL) return allocMemory(phase, size);
+
+    MemHeader* header = (MemHeader*)ptr - 1;
+    const enum MemPhase owner = header->phase;
+    const size_t        old   = header->size;
+
+    header = realloc(header, sizeof(MemHeader) + size);
+    if (header == NULL) ERRO(EXIT_FAILURE, "Out of memory allocating %zu byte(s) for %s", size, memPhase2Str[owner]);
+    header->size = size;
+
+    /* Counted as a free and a fresh allocation */
+    accountFree (owner, old);
+    accountAlloc(owner, size);
+    return header + 1;
+}
+
+char* strdupMemory(const enum MemPhase phase, const char* s) {
+    const size_t len  = strlen(s);
+    char*        copy = allocMemory(phase, len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+void freeMemory(void* ptr) {
+    if (ptr == NULL) return;
+    MemHeader* header = (MemHeader*)ptr - 1;
+    accountFree(header->phase, header->size);
+    free(header);
+}
+
+MemStats memoryStats(const enum MemPhase phase) {
+    return global_MemStats[phase];
+}
+
+void dumpMemoryReport(void) {
+    printf("[INFO] Memory by phase:\n");
+    printf("       %-10s %12s %12s %14s %12s %12s\n", "phase", "allocs", "frees", "bytes", "peak live", "still live");
+    MemStats total = {0};
+    for (enum MemPhase phase = 0; phase<MEM_PHASE_LENGTH; phase++) {
+        const MemStats s = global_MemStats[phase];
+        printf("       %-10s %12zu %12zu %14zu %12zu %12zu\n", memPhase2Str[phase], s.allocations, s.frees, s.bytes, s.peak, s.live);
+        total.allocations += s.allocations;
+        total.frees       += s.frees;
+        total.bytes       += s.bytes;
+        total.live        += s.live;
+    }
+    printf("       %-10s %12zu %12zu %14zu %12zu %12zu\n", "total", total.allocations, total.frees, total.bytes, global_MemPeak, total.live);
+}
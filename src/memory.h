@@ -0,0 +1,46 @@
+#ifndef QUEBEC_MEMORY_H
+#define QUEBEC_MEMORY_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Every compiler allocation goes through here so `--mem-report` can show
+   what each phase allocated and how much of it was live at once. Blocks
+   remember their phase, so they may be freed from anywhere. */
+
+enum MemPhase {
+    MEM_Driver=0,
+    MEM_Lexer,      /* Lines, tokens and interned text */
+    MEM_Preprocess, /* Macros, headers, expansions and PCHs */
+    MEM_Tree,
+    MEM_Codegen,
+MEM_PHASE_LENGTH
+};
+
+__attribute_maybe_unused__ static const char* memPhase2Str[MEM_PHASE_LENGTH] = {
+    "driver",
+    "lexer",
+    "preprocess",
+    "tree",
+    "codegen",
+};
+
+typedef struct {
+    size_t allocations;
+    size_t frees;
+    size_t bytes; /* Requested over the whole run */
+    size_t live;
+    size_t peak;
+} MemStats;
+
+void* allocMemory  (const enum MemPhase phase, const size_t size);
+void* callocMemory (const enum MemPhase phase, const size_t count, const size_t size);
+void* reallocMemory(const enum MemPhase phase, void* ptr, const size_t size); /* Keeps the block's phase */
+char* strdupMemory (const enum MemPhase phase, const char* s);
+void  freeMemory   (void* ptr);
+
+MemStats memoryStats     (const enum MemPhase phase);
+void     dumpMemoryReport(void);
+
+#endif /* QUEBEC_MEMORY_H */
@@ -6,23 +6,31 @@
 #include <stdbool.h>
 
 #include "grammar.h"
+#include "intern.h"
+#include "memory.h"
+#include "pool.h"
 
 pFileLine newFileLine(const char* file_path, const char* text, uint line_num) {
-    pFileLine flp = malloc(sizeof(*flp));
+    pFileLine flp = allocMemory(MEM_Lexer, sizeof(*flp));
     *flp = (struct file_line_s){
         .line_num  = line_num,
         .file_path = file_path,
-        .text      = strdup(text),
+        .text      = strdupMemory(MEM_Lexer, text),
         .next      = NULL
     };
     return flp;
 }
 
 void delFileLine(pFileLine* flp) {
-    if (flp==NULL || *flp==NULL) return;
-    if ((*flp)->text) free((*flp)->text);
-    if ((*flp)->next) delFileLine( &((*flp)->next) );
-    free(*flp);
+    if (flp==NULL) return;
+    pFileLine line = *flp;
+    while (line) {
+        pFileLine next = line->next;
+        if (line->text) freeMemory(line->text);
+        freeMemory(line);
+        line = next;
+    }
+    *flp = NULL;
 }
 
 void fprintfFileLine(FILE* fp, const pFileLine flp) {
@@ -33,16 +41,11 @@ void dumpFileLine(const pFileLine flp) {
     fprintfFileLine(stdout, flp);
 }
 
-static void appendFileLine(pFileLine* head, pFileLine next) {
-    if (head==NULL || *head==NULL)   *head        = next;
-    else if ((*head)->next == NULL) (*head)->next = next;
-    else appendFileLine( &((*head)->next), next );
-}
-
 /************************************************************/
 
 pFileLine readFileAsLines(const char* file_path) {
-    pFileLine file_as_lines = NULL;
+    pFileLine  file_as_lines = NULL;
+    pFileLine* tail          = &file_as_lines;
 
     FILE* fp = fopen(file_path, "r");
     if (fp == NULL) {
@@ -50,21 +53,39 @@ pFileLine readFileAsLines(const char* file_path) {
         return NULL;
     }
 
-    uint line_num = 0;
-    char text[256] = {0};
-    for (; fgets(text, 256, fp) != NULL; ) {
-        // fgets(text, 256, fp);
+    uint    line_num = 0, first_num = 0;
+    char*   text     = NULL;
+    size_t  capacity = 0;
+    ssize_t len;
+    char*   spliced  = NULL; /* Lines joined by a `\` at their end, numbered as the first of them */
+    size_t  spliced_len = 0;
+    bool    splicing = false;
+    while ((len = getline(&text, &capacity, fp)) != -1) {
         ++line_num;
-        const uint len = strlen(text);
-        if (len == 1) continue;
-        if (text[len-1] == '\n') text[len-1] = 0;
-        pFileLine flp = newFileLine(file_path, text, line_num);
-        appendFileLine(&file_as_lines, flp);
+        while (len > 0 && (text[len-1] == '\n' || text[len-1] == '\r')) text[--len] = 0;
+        const bool continued = len > 0 && text[len-1] == '\\';
+        if (continued) text[--len] = 0;
+        if (continued || splicing) {
+            if (!splicing) first_num = line_num;
+            spliced = reallocMemory(MEM_Lexer, spliced, spliced_len + len + 1);
+            memcpy(spliced + spliced_len, text, len + 1);
+            spliced_len += len;
+            splicing     = continued;
+            if (continued) continue;
+        }
+        const char* line = spliced_len ? spliced : text;
+        if (*line == 0) continue;
+        *tail = newFileLine(file_path, line, spliced_len ? first_num : line_num);
+        tail  = &((*tail)->next);
+        spliced_len = 0;
+    }
+    if (splicing && spliced_len) { /* The last line ended in `\` */
+        *tail = newFileLine(file_path, spliced, first_num);
+        tail  = &((*tail)->next);
     }
 
-    pFileLine flp = newFileLine(file_path, text, line_num);
-    appendFileLine(&file_as_lines, flp);
-
+    freeMemory(spliced);
+    free(text); /* From `getline` */
     fclose(fp);
 
     return file_as_lines;
@@ -98,6 +119,7 @@ static bool isAlpha(const char c) {
 static bool isIntConst(const char* s) {
     const char* t = s;
     if (*t == '-') t++;
+    if (*t == 0) return false; /* A lone `-` */
     while (*t) {
         if (!isDecDigit(*t)) return false;
         t++;
@@ -152,7 +174,7 @@ static bool isPossibleIdentifier(const char* s) {
     if (!isAlpha(*t)) return false;
     t++;
     while (*t) {
-        if (!isAlpha(*t)) return false;
+        if (!isAlpha(*t) && !isDecDigit(*t)) return false;
         t++;
     } return true;
 }
@@ -183,22 +205,31 @@ static enum TokenType deduceTokenType(const char* s) {
 /************************************************************/
 
 pToken newToken(const pFileLine origin, const char* text, const uint offset) {
-    pToken ptok = malloc(sizeof(*ptok));
+    pToken ptok = allocMemory(MEM_Lexer, sizeof(*ptok));
     *ptok = (struct token_s) {
-        .offset = offset - strlen(text) + 1,
+        .offset = offset,
         .type   = deduceTokenType(text),
         .origin = origin,
-        .text   = strdup(text),
+        .text   = internString(text),
         .next   = NULL
     };
-    if (strlen(text)==1) ptok->offset += 1; /* Fixes weird bug w/ size 1 tokens */
+    return ptok;
+}
+pToken cloneToken(const pToken tp) {
+    pToken ptok = allocMemory(MEM_Lexer, sizeof(*ptok));
+    *ptok = *tp;
+    ptok->next = NULL;
     return ptok;
 }
 void delToken(pToken* tp) {
-    if (tp==NULL || *tp==NULL) return;
-    if ((*tp)->text) free((*tp)->text);
-    if ((*tp)->next) delToken( &((*tp)->next) );
-    free(*tp);
+    if (tp==NULL) return;
+    pToken token = *tp;
+    while (token) {
+        pToken next = token->next;
+        freeMemory(token);
+        token = next;
+    }
+    *tp = NULL;
 }
 void fprintfToken(FILE* fp, const pToken tp) {
     if (tp == NULL) fprintf(fp, "(null)\n");
@@ -235,58 +266,81 @@ pToken pluckToken(pToken token) {
     return next;
 }
 
-pToken tokenizeLine(const pFileLine flp) {
+pToken tokenizeLine(const pFileLine flp, bool* in_comment) {
     if (flp == NULL || strlen(flp->text)==0) return NULL;
 
-    pToken tokens = NULL;
+    pToken  tokens = NULL;
+    pToken* tail   = &tokens;
 
-    uint buffer_index =  0;
-    char buffer[256]  = {0};
-    #define pushToken(OFFSET) {\
+    /* No token outgrows its line, only long ones need the heap */
+    const uint len = strlen(flp->text);
+    char  small[256];
+    char* buffer = len < sizeof(small) ? small : allocMemory(MEM_Lexer, len+1);
+    uint  buffer_index = 0;
+    #define pushToken() {\
         if (buffer_index) {\
             buffer[buffer_index] = 0;\
-            appendToken(&tokens,\
-                newToken(\
-                    flp, buffer, OFFSET\
-                )\
-            );\
+            *tail = newToken(flp, buffer, token_start+1);\
+            tail  = &((*tail)->next);\
             buffer_index = 0;\
         }\
     }
 
-    #define pushChar(C) { buffer[buffer_index++]=C; }
+    #define pushChar(C) {\
+        if (buffer_index==0) token_start = offset;\
+        buffer[buffer_index++]=C;\
+    }
 
-    uint offset;
+    uint offset, token_start = 0;
     bool in_char   = false;
     bool in_string = false;
-    for (offset = 0; offset<strlen(flp->text); offset++) {
+    for (offset = 0; offset<len; offset++) {
         const char c1 = flp->text[offset];
         const char c2 = flp->text[offset+1];
 
+        if (*in_comment) {
+            if (c1 == '*' && c2 == '/') {
+                *in_comment = false;
+                offset++;
+            }
+            continue;
+        }
         if (in_string) {
+            if (c1 == '\\' && c2) { /* Keep escapes (e.g. `\"`) inside the literal */
+                pushChar(c1);
+                pushChar(c2);
+                offset++;
+                continue;
+            }
             pushChar(c1);
             if (c1 == '\"') {
                 in_string = false;
-                pushToken(offset);
+                pushToken();
             }
             continue;
         }
         if (in_char) {
+            if (c1 == '\\' && c2) { /* Keep escapes (e.g. `\'`) inside the literal */
+                pushChar(c1);
+                pushChar(c2);
+                offset++;
+                continue;
+            }
             pushChar(c1);
             if (c1 == '\'') {
                 in_char = false;
-                pushToken(offset);
+                pushToken();
             }
             continue;
         }
         if (c1 == '\"') {
-            pushToken(offset);
+            pushToken();
             in_string = true;
             pushChar(c1);
             continue;
         }
         if (c1 == '\'') {
-            pushToken(offset);
+            pushToken();
             in_char = true;
             pushChar(c1);
             continue;
@@ -294,8 +348,14 @@ pToken tokenizeLine(const pFileLine flp) {
         if (c1 == '/' && c2 == '/') {
             break; /* Break on comments */
         }
-        if (c1 == ' ') {
-            pushToken(offset);
+        if (c1 == '/' && c2 == '*') {
+            pushToken();
+            *in_comment = true;
+            offset++;
+            continue;
+        }
+        if (c1 == ' ' || c1 == '\t') {
+            pushToken();
             continue;
         }
         if (c1 == '.' && (isDecDigit(c2) || c2=='f')) {
@@ -307,23 +367,213 @@ pToken tokenizeLine(const pFileLine flp) {
             continue;
         }
         if (isOperator(c1, c2)) {
-            pushToken(offset);
+            pushToken();
             pushChar(c1);
             pushChar(c2);
-            pushToken(offset);
+            pushToken();
             offset++;
             continue;
         }
         if (isDelim(c1)) {
-            pushToken(offset);
+            pushToken();
             pushChar(c1);
-            pushToken(offset);
+            pushToken();
             continue;
         }
 
         pushChar(c1);
     }
-    pushToken(offset);
+    pushToken();
 
+    if (buffer != small) freeMemory(buffer);
     return tokens;
-}
\ No newline at end of file
+}
+/* Whether a line starting (or not) inside a block comment ends inside one */
+static bool scanBlockComments(const char* text, bool in_comment) {
+    for (const char* c = text; *c; c++) {
+        if (in_comment) {
+            if (c[0] == '*' && c[1] == '/') { in_comment = false; c++; }
+            continue;
+        }
+        if (c[0] == '\"' || c[0] == '\'') {
+            const char quote = *c++;
+            while (*c && *c != quote) if (*c++ == '\\' && *c) c++;
+            if (*c == 0) break;
+            continue;
+        }
+        if (c[0] == '/' && c[1] == '/') break;
+        if (c[0] == '/' && c[1] == '*') { in_comment = true; c++; }
+    }
+    return in_comment;
+}
+
+typedef struct {
+    pFileLine first, end;     /* Lines `first` up to, but not including, `end` */
+    bool      exits_comment[2]; /* Whether the chunk ends inside a block comment, per entry state */
+    bool      in_comment;     /* Entry state once resolved */
+    pToken    head;
+    pToken*   tail;
+} LexChunk;
+
+static void prescanChunk(void* context, const uint job) {
+    LexChunk* chunk = (LexChunk*)context + job;
+    for (int entry = 0; entry<2; entry++) {
+        bool in_comment = entry;
+        for (pFileLine line = chunk->first; line != chunk->end; line = line->next)
+            in_comment = scanBlockComments(line->text, in_comment);
+        chunk->exits_comment[entry] = in_comment;
+    }
+}
+
+static void lexChunk(void* context, const uint job) {
+    LexChunk* chunk = (LexChunk*)context + job;
+    bool in_comment = chunk->in_comment;
+    chunk->head = NULL;
+    chunk->tail = &chunk->head;
+    for (pFileLine line = chunk->first; line != chunk->end; line = line->next) {
+        *chunk->tail = tokenizeLine(line, &in_comment);
+        while (*chunk->tail) chunk->tail = &((*chunk->tail)->next);
+    }
+}
+
+pToken tokenizeLines(const pFileLine lines, const uint jobs) {
+    uint num_lines = 0;
+    for (pFileLine line = lines; line; line = line->next) {
+        TRACE(TRACE_Lexer, TRACE_Dump, "%s:%u: %s", line->file_path, line->line_num, line->text);
+        num_lines++;
+    }
+
+    /* Small inputs aren't worth a thread */
+    uint num_chunks = jobs ? jobs : 1;
+    if (num_lines/num_chunks < LEX_MIN_CHUNK_LINES) num_chunks = num_lines/LEX_MIN_CHUNK_LINES;
+    if (num_chunks < 2) {
+        LexChunk chunk = { .first = lines, .end = NULL, .in_comment = false };
+        lexChunk(&chunk, 0);
+        return chunk.head;
+    }
+
+    LexChunk* chunks = callocMemory(MEM_Lexer, num_chunks, sizeof(LexChunk));
+    pFileLine line = lines;
+    for (uint i = 0; i<num_chunks; i++) {
+        const uint count = num_lines/num_chunks + (i < num_lines%num_chunks);
+        chunks[i].first = line;
+        for (uint n = 0; n<count; n++) line = line->next;
+        chunks[i].end = line;
+    }
+
+    /* Where each chunk starts relative to block comments only depends on the ones before it */
+    runPool(num_chunks, num_chunks, prescanChunk, chunks);
+    for (uint i = 1; i<num_chunks; i++)
+        chunks[i].in_comment = chunks[i-1].exits_comment[chunks[i-1].in_comment];
+    runPool(num_chunks, num_chunks, lexChunk, chunks);
+
+    pToken  tokens = NULL;
+    pToken* tail   = &tokens;
+    for (uint i = 0; i<num_chunks; i++) {
+        if (chunks[i].head == NULL) continue;
+        *tail = chunks[i].head;
+        tail  = chunks[i].tail;
+    }
+    TRACE(TRACE_Lexer, TRACE_Info, "Lexed %u line(s) in %u chunk(s)", num_lines, num_chunks);
+    freeMemory(chunks);
+    return tokens;
+}
+
+/************************************************************/
+
+typedef struct lex_entry_s {
+    uint   hash;
+    char*  text;
+    bool   enters_comment;
+    bool   exits_comment;
+    bool   used;
+    pToken tokens; /* Origins are stale, they're rewritten on the way out */
+    struct lex_entry_s* next;
+} *pLexEntry;
+
+struct lex_cache_s {
+    pLexEntry buckets[LEX_CACHE_BUCKETS];
+};
+
+pLexCache newLexCache(void) {
+    return callocMemory(MEM_Lexer, 1, sizeof(struct lex_cache_s));
+}
+
+static void delLexEntry(pLexEntry entry) {
+    delToken(&(entry->tokens));
+    freeMemory(entry->text);
+    freeMemory(entry);
+}
+
+void delLexCache(pLexCache* cache) {
+    if (cache == NULL || *cache == NULL) return;
+    for (uint i = 0; i<LEX_CACHE_BUCKETS; i++) {
+        pLexEntry entry = (*cache)->buckets[i];
+        while (entry) {
+            pLexEntry next = entry->next;
+            delLexEntry(entry);
+            entry = next;
+        }
+    }
+    freeMemory(*cache);
+    *cache = NULL;
+}
+
+void trimLexCache(pLexCache cache) {
+    for (uint i = 0; i<LEX_CACHE_BUCKETS; i++) {
+        pLexEntry* link = &(cache->buckets[i]);
+        while (*link) {
+            pLexEntry entry = *link;
+            if (entry->used) {
+                entry->used = false;
+                link = &(entry->next);
+            } else {
+                *link = entry->next;
+                delLexEntry(entry);
+            }
+        }
+    }
+}
+
+/* Serial, but on a rebuild nearly every line is a hit */
+pToken tokenizeLinesCached(const pFileLine lines, pLexCache cache) {
+    pToken  tokens = NULL;
+    pToken* tail   = &tokens;
+    bool in_comment = false;
+    uint hits = 0, misses = 0;
+    for (pFileLine line = lines; line; line = line->next) {
+        const uint hash = hashString(line->text);
+        pLexEntry* bucket = &(cache->buckets[hash % LEX_CACHE_BUCKETS]);
+        pLexEntry  entry  = *bucket;
+        while (entry && (entry->hash != hash || entry->enters_comment != in_comment || strcmp(entry->text, line->text)!=0))
+            entry = entry->next;
+
+        if (entry) {
+            in_comment = entry->exits_comment;
+            hits++;
+        } else {
+            const bool enters_comment = in_comment;
+            entry = allocMemory(MEM_Lexer, sizeof(*entry));
+            *entry = (struct lex_entry_s){
+                .hash           = hash,
+                .text           = strdupMemory(MEM_Lexer, line->text),
+                .enters_comment = enters_comment,
+                .tokens         = tokenizeLine(line, &in_comment),
+                .next           = *bucket
+            };
+            entry->exits_comment = in_comment;
+            TRACE(TRACE_Lexer, TRACE_Dump, "Lexing %s:%u: %s", line->file_path, line->line_num, line->text);
+            *bucket = entry;
+            misses++;
+        }
+        entry->used = true;
+
+        for (pToken token = entry->tokens; token; token = token->next) {
+            *tail = cloneToken(token);
+            (*tail)->origin = line;
+            tail = &((*tail)->next);
+        }
+    }
+    TRACE(TRACE_Lexer, TRACE_Info, "Lexed %u line(s), reused %u", misses, hits);
+    return tokens;
+}
@@ -1,8 +1,13 @@
 #ifndef QUEBEC_PARSER_H
 #define QUEBEC_PARSER_H
 
+#include <stdbool.h>
+
 #include "common.h"
 
+#define LEX_MIN_CHUNK_LINES 4096 /* Per thread, below this `tokenizeLines` stays serial */
+#define LEX_CACHE_BUCKETS   4096
+
 typedef struct file_line_s {
     uint  line_num;
     const char* file_path;
@@ -33,11 +38,12 @@ typedef struct token_s {
     uint offset;
     enum TokenType type;
     pFileLine origin;
-    char* text;
+    const char* text; /* Interned, see `intern.h` */
     struct token_s* next;
 } *pToken;
 
 pToken newToken(const pFileLine origin, const char* text, const uint offset);
+pToken cloneToken(const pToken tp);
 void   delToken(pToken* tp);
 void   dumpToken(const pToken tp);
 void   listTokens(const pToken tp);
@@ -46,8 +52,19 @@ void   appendToken(pToken* head, pToken next);
 void   fprintfFileLine(FILE* fp, const pFileLine flp);
 void   fprintfToken    (FILE* fp, const pToken    tp);
 
-pToken tokenizeLine(const pFileLine flp);
+pToken tokenizeLine (const pFileLine flp, bool* in_comment); /* Carries block comments across lines */
+pToken tokenizeLines(const pFileLine lines, const uint jobs); /* Splits long inputs across `jobs` threads */
 pToken splitTokens(pToken head);
+
+/* Every distinct line lexed by earlier builds and its tokens, looked up by
+   content so a rebuild only re-lexes the lines that changed in between */
+typedef struct lex_cache_s* pLexCache;
+
+pLexCache newLexCache (void);
+void      delLexCache (pLexCache* cache);
+void      trimLexCache(pLexCache cache); /* Drops lines not asked for since the last trim */
+pToken    tokenizeLinesCached(const pFileLine lines, pLexCache cache);
+
 pToken pluckToken(pToken token);
 
 #endif /* QUEBEC_PARSER_H */
\ No newline at end of file
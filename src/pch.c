@@ -0,0 +1,380 @@
+#include "pch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "intern.h"
+#include "memory.h"
+
+#define PUSH(ARRAY, COUNT, CAPACITY, VALUE) {\
+    if ((COUNT) == (CAPACITY)) {\
+        (CAPACITY) = (CAPACITY) ? 2*(CAPACITY) : 64;\
+        (ARRAY)    = reallocMemory(MEM_Preprocess, (ARRAY), (CAPACITY)*sizeof(*(ARRAY)));\
+    }\
+    (ARRAY)[(COUNT)++] = (VALUE);\
+}
+
+#define ALIGN8(N) (((N)+7) & ~(size_t)7)
+
+/************************************************************/
+
+/* Pointer -> index map so every interned string and source line is written once */
+typedef struct {
+    const void* key;
+    uint32_t    value;
+} PtrSlot;
+
+typedef struct {
+    PtrSlot* slots;
+    uint     count, capacity;
+} PtrMap;
+
+static PtrSlot* findPtrSlot(PtrMap* map, const void* key) {
+    if (2*(map->count+1) > map->capacity) {
+        const uint capacity = map->capacity ? 2*map->capacity : 1024;
+        PtrSlot*   slots    = callocMemory(MEM_Preprocess, capacity, sizeof(PtrSlot));
+        for (uint i = 0; i<map->capacity; i++) {
+            if (map->slots[i].key == NULL) continue;
+            uint index = ((uintptr_t)map->slots[i].key >> 3) * 2654435761u & (capacity-1);
+            while (slots[index].key) index = (index+1) & (capacity-1);
+            slots[index] = map->slots[i];
+        }
+        freeMemory(map->slots);
+        map->slots    = slots;
+        map->capacity = capacity;
+    }
+
+    uint index = ((uintptr_t)key >> 3) * 2654435761u & (map->capacity-1);
+    while (map->slots[index].key && map->slots[index].key != key) index = (index+1) & (map->capacity-1);
+    return &(map->slots[index]);
+}
+
+typedef struct {
+    char*     strings; uint strings_size, strings_capacity;
+    PchLine*  lines;   uint num_lines,    lines_capacity;
+    PchToken* tokens;  uint num_tokens,   tokens_capacity;
+    PchMacro* macros;  uint num_macros,   macros_capacity;
+    uint32_t* params;  uint num_params,   params_capacity;
+    PchDecl*  decls;   uint num_decls,    decls_capacity;
+    PtrMap    string_ids, line_ids;
+} PchWriter;
+
+static uint32_t writeString(PchWriter* w, const char* s) {
+    PtrSlot* slot = findPtrSlot(&(w->string_ids), s);
+    if (slot->key) return slot->value;
+
+    const uint32_t offset = w->strings_size;
+    for (const char* c = s; ; c++) {
+        PUSH(w->strings, w->strings_size, w->strings_capacity, *c);
+        if (*c == 0) break;
+    }
+    *slot = (PtrSlot){ .key=s, .value=offset };
+    w->string_ids.count++;
+    return offset;
+}
+
+static uint32_t writeLine(PchWriter* w, const pFileLine line) {
+    if (line == NULL) return PCH_NONE;
+    PtrSlot* slot = findPtrSlot(&(w->line_ids), line);
+    if (slot->key) return slot->value;
+
+    const PchLine record = {
+        .file     = writeString(w, line->file_path),
+        .text     = writeString(w, line->text),
+        .line_num = line->line_num
+    };
+    *slot = (PtrSlot){ .key=line, .value=w->num_lines };
+    w->line_ids.count++;
+    PUSH(w->lines, w->num_lines, w->lines_capacity, record);
+    return slot->value;
+}
+
+static uint32_t writeTokens(PchWriter* w, const pToken tokens) {
+    const uint32_t first = w->num_tokens;
+    for (pToken t = tokens; t; t = t->next) {
+        const PchToken record = {
+            .text   = writeString(w, t->text),
+            .line   = writeLine(w, t->origin),
+            .offset = t->offset,
+            .type   = t->type
+        };
+        PUSH(w->tokens, w->num_tokens, w->tokens_capacity, record);
+    }
+    return first;
+}
+
+static bool isText(const pToken token, const char* text) {
+    return token && strcmp(token->text, text)==0;
+}
+
+/* Splits the header's token stream into top-level declarations */
+static void writeDeclarations(PchWriter* w, const pToken tokens) {
+    uint32_t index = 0, first_index = 0;
+    pToken   first = tokens, prev = NULL;
+
+    int  depth = 0;
+    bool has_body = false, has_braces = false, is_extern = false, assigned = false;
+    const char *name = NULL, *fn_name = NULL;
+
+    for (pToken t = tokens; t; prev = t, t = t->next, index++) {
+        if (depth==0) {
+            if (t->type == TOKEN_identifier && !assigned) name = t->text;
+            if (t->type == TOKEN_extern) is_extern = true;
+            if (isText(t, "=")) assigned = true;
+            if (isText(t, "(") && prev && prev->type == TOKEN_identifier && !fn_name) fn_name = prev->text;
+            if (isText(t, "{")) {
+                has_braces = true;
+                if (fn_name && isText(prev, ")")) has_body = true;
+            }
+        }
+        if (isText(t, "(") || isText(t, "[") || isText(t, "{")) depth++;
+        if (isText(t, ")") || isText(t, "]") || isText(t, "}")) depth--;
+
+        const bool ends = depth==0 && (isText(t, ";") || (has_body && isText(t, "}")));
+        if (!ends) continue;
+
+        enum DeclKind kind = DECL_Other;
+        if      (first->type == TOKEN_typedef) kind = DECL_Typedef;
+        else if (has_body)                     kind = DECL_Function;
+        else if (is_extern)                    kind = DECL_Extern;
+        else if (fn_name)                      kind = DECL_Prototype;
+        else if (name && !has_braces)          kind = DECL_Variable;
+
+        const PchDecl decl = {
+            .name        = writeString(w, (kind==DECL_Function || kind==DECL_Prototype) ? fn_name : name ? name : ""),
+            .kind        = kind,
+            .first_token = first_index,
+            .num_tokens  = index + 1 - first_index
+        };
+        PUSH(w->decls, w->num_decls, w->decls_capacity, decl);
+
+        first       = t->next;
+        first_index = index + 1;
+        has_body = has_braces = is_extern = assigned = false;
+        name = fn_name = NULL;
+    }
+}
+
+int emitPch(const char* pch_path, const pPreprocessor pp, const pHeader header, const pToken tokens) {
+    PchWriter w = {0};
+
+    const uint32_t source = writeString(&w, header->path);
+    writeTokens(&w, tokens);
+    writeDeclarations(&w, tokens);
+
+    for (uint i = 0; i<MACRO_BUCKETS; i++) {
+        for (pMacro macro = pp->macros[i]; macro; macro = macro->next) {
+            PchMacro record = {
+                .name        = writeString(&w, macro->name),
+                .flags       = (macro->function_like ? PCH_FunctionLike : 0) | (macro->variadic ? PCH_Variadic : 0),
+                .first_param = w.num_params,
+                .num_params  = macro->num_params,
+            };
+            for (uint p = 0; p<macro->num_params; p++) {
+                const uint32_t param = writeString(&w, macro->params[p]);
+                PUSH(w.params, w.num_params, w.params_capacity, param);
+            }
+            record.body       = writeTokens(&w, macro->body);
+            record.body_count = w.num_tokens - record.body;
+            PUSH(w.macros, w.num_macros, w.macros_capacity, record);
+        }
+    }
+
+    PchHeader out = {
+        .magic   = PCH_MAGIC,
+        .version = PCH_VERSION,
+        .source  = source,
+        .flags   = header->pragma_once ? PCH_PragmaOnce : 0,
+    };
+    size_t offset = ALIGN8(sizeof(PchHeader));
+    out.strings_offset = offset; out.strings_size = w.strings_size; offset = ALIGN8(offset + w.strings_size);
+    out.lines_offset   = offset; out.num_lines    = w.num_lines;    offset = ALIGN8(offset + w.num_lines *sizeof(PchLine));
+    out.tokens_offset  = offset; out.num_tokens   = w.num_tokens;   offset = ALIGN8(offset + w.num_tokens*sizeof(PchToken));
+    out.macros_offset  = offset; out.num_macros   = w.num_macros;   offset = ALIGN8(offset + w.num_macros*sizeof(PchMacro));
+    out.params_offset  = offset; out.num_params   = w.num_params;   offset = ALIGN8(offset + w.num_params*sizeof(uint32_t));
+    out.decls_offset   = offset; out.num_decls    = w.num_decls;    offset = ALIGN8(offset + w.num_decls *sizeof(PchDecl));
+    out.size = offset;
+
+    int ret = EXIT_FAILURE;
+    FILE* fp = fopen(pch_path, "wb");
+    if (fp == NULL) {
+        WARN("Could not open (%s) for writing", pch_path);
+        goto cleanup;
+    }
+
+    #define WRITE_SECTION(AT, DATA, SIZE) {\
+        const size_t size = (SIZE);\
+        fseek(fp, (AT), SEEK_SET);\
+        if (size > 0 && fwrite((DATA), 1, size, fp) != size) goto cleanup;\
+    }
+    WRITE_SECTION(0,                  &out,     sizeof(out));
+    WRITE_SECTION(out.strings_offset, w.strings, w.strings_size);
+    WRITE_SECTION(out.lines_offset,   w.lines,   w.num_lines *sizeof(PchLine));
+    WRITE_SECTION(out.tokens_offset,  w.tokens,  w.num_tokens*sizeof(PchToken));
+    WRITE_SECTION(out.macros_offset,  w.macros,  w.num_macros*sizeof(PchMacro));
+    WRITE_SECTION(out.params_offset,  w.params,  w.num_params*sizeof(uint32_t));
+    WRITE_SECTION(out.decls_offset,   w.decls,   w.num_decls *sizeof(PchDecl));
+    #undef WRITE_SECTION
+    if (ftruncate(fileno(fp), out.size) != 0) goto cleanup;
+
+    TRACE(TRACE_Lexer, TRACE_Info, "PCH (%s): %u strings bytes, %u lines, %u tokens, %u macros, %u declarations",
+        pch_path, w.strings_size, w.num_lines, w.num_tokens, w.num_macros, w.num_decls);
+    if (TRACING(TRACE_Lexer, TRACE_Dump)) {
+        for (uint i = 0; i<w.num_decls; i++)
+            traceRecord(TRACE_Lexer, TRACE_Dump, "  %-9s %s", declKind2Str[w.decls[i].kind], w.strings + w.decls[i].name);
+    }
+    ret = EXIT_SUCCESS;
+
+cleanup:
+    if (fp) fclose(fp);
+    if (ret != EXIT_SUCCESS) WARN("Failed to write precompiled header (%s)", pch_path);
+    freeMemory(w.strings); freeMemory(w.lines); freeMemory(w.tokens); freeMemory(w.macros); freeMemory(w.params); freeMemory(w.decls);
+    freeMemory(w.string_ids.slots); freeMemory(w.line_ids.slots);
+    return ret;
+}
+
+/************************************************************/
+
+static bool sectionFits(const PchHeader* header, const uint32_t offset, const uint64_t count, const size_t size) {
+    return (uint64_t)offset + count*size <= header->size;
+}
+
+pPch loadPch(const char* pch_path) {
+    const int fd = open(pch_path, O_RDONLY);
+    if (fd < 0) {
+        WARN("Precompiled header (%s) does not exist", pch_path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PchHeader)) {
+        close(fd);
+        WARN("Precompiled header (%s) is truncated", pch_path);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping keeps the file alive */
+    if (map == MAP_FAILED) {
+        WARN("Could not map precompiled header (%s)", pch_path);
+        return NULL;
+    }
+
+    const PchHeader* header = map;
+    const bool valid =
+        memcmp(header->magic, PCH_MAGIC, 4)==0 &&
+        header->version == PCH_VERSION         &&
+        header->size    == (uint64_t)st.st_size &&
+        sectionFits(header, header->strings_offset, header->strings_size, 1)                 &&
+        sectionFits(header, header->lines_offset,   header->num_lines,    sizeof(PchLine))   &&
+        sectionFits(header, header->tokens_offset,  header->num_tokens,   sizeof(PchToken))  &&
+        sectionFits(header, header->macros_offset,  header->num_macros,   sizeof(PchMacro))  &&
+        sectionFits(header, header->params_offset,  header->num_params,   sizeof(uint32_t))  &&
+        sectionFits(header, header->decls_offset,   header->num_decls,    sizeof(PchDecl))   &&
+        header->strings_size > 0 && ((const char*)map)[header->strings_offset + header->strings_size - 1] == 0;
+    if (!valid) {
+        munmap(map, st.st_size);
+        WARN("Precompiled header (%s) is stale or corrupt, rebuild it with `--emit-pch`", pch_path);
+        return NULL;
+    }
+
+    pPch pch = allocMemory(MEM_Preprocess, sizeof(*pch));
+    *pch = (struct pch_s){
+        .map     = map,
+        .size    = st.st_size,
+        .header  = header,
+        .strings = (const char*    )map + header->strings_offset,
+        .lines   = (const PchLine* )((const char*)map + header->lines_offset),
+        .tokens  = (const PchToken*)((const char*)map + header->tokens_offset),
+        .macros  = (const PchMacro*)((const char*)map + header->macros_offset),
+        .params  = (const uint32_t*)((const char*)map + header->params_offset),
+        .decls   = (const PchDecl* )((const char*)map + header->decls_offset),
+        .origins = NULL
+    };
+
+    pch->origins = allocMemory(MEM_Preprocess, (header->num_lines ? header->num_lines : 1) * sizeof(struct file_line_s));
+    for (uint i = 0; i<header->num_lines; i++) {
+        pch->origins[i] = (struct file_line_s){
+            .line_num  = pch->lines[i].line_num,
+            .file_path = pchString(pch, pch->lines[i].file),
+            .text      = (char*)pchString(pch, pch->lines[i].text),
+            .next      = NULL
+        };
+    }
+
+    TRACE(TRACE_Lexer, TRACE_Info, "Mapped PCH (%s) for (%s): %u tokens, %u macros, %u declarations",
+        pch_path, pchString(pch, header->source), header->num_tokens, header->num_macros, header->num_decls);
+    return pch;
+}
+
+void delPch(pPch* pch) {
+    if (pch==NULL || *pch==NULL) return;
+    freeMemory((*pch)->origins);
+    munmap((*pch)->map, (*pch)->size);
+    freeMemory(*pch);
+    *pch = NULL;
+}
+
+const char* pchString(const pPch pch, const uint32_t offset) {
+    if (offset >= pch->header->strings_size) ERRO(EXIT_FAILURE, "Corrupt precompiled header string (%u)", offset);
+    return pch->strings + offset;
+}
+
+pToken pchTokens(const pPch pch, const uint32_t first, const uint32_t count) {
+    if ((uint64_t)first + count > pch->header->num_tokens) ERRO(EXIT_FAILURE, "Corrupt precompiled header token range");
+
+    pToken  tokens = NULL;
+    pToken* tail   = &tokens;
+    for (uint32_t i = first; i<first+count; i++) {
+        const PchToken record = pch->tokens[i];
+        if (record.type >= NUM_TOKEN_TYPES || (record.line != PCH_NONE && record.line >= pch->header->num_lines))
+            ERRO(EXIT_FAILURE, "Corrupt precompiled header token (%u)", i);
+
+        pToken token = allocMemory(MEM_Preprocess, sizeof(*token));
+        *token = (struct token_s){
+            .offset = record.offset,
+            .type   = record.type,
+            .origin = record.line == PCH_NONE ? NULL : &(pch->origins[record.line]),
+            .text   = adoptString(pchString(pch, record.text)),
+            .next   = NULL
+        };
+        *tail = token;
+        tail  = &(token->next);
+    }
+    return tokens;
+}
+
+void pchDefineMacros(const pPch pch, pPreprocessor pp) {
+    for (uint i = 0; i<pch->header->num_macros; i++) {
+        const PchMacro record = pch->macros[i];
+        if ((uint64_t)record.first_param + record.num_params > pch->header->num_params)
+            ERRO(EXIT_FAILURE, "Corrupt precompiled header macro (%u)", i);
+
+        pMacro macro = defineMacro(pp, pchString(pch, record.name));
+        macro->function_like = record.flags & PCH_FunctionLike;
+        macro->variadic      = record.flags & PCH_Variadic;
+        macro->num_params    = record.num_params;
+        macro->params        = allocMemory(MEM_Preprocess, record.num_params * sizeof(char*));
+        for (uint p = 0; p<record.num_params; p++)
+            macro->params[p] = strdupMemory(MEM_Preprocess, pchString(pch, pch->params[record.first_param + p]));
+        macro->body = pchTokens(pch, record.body, record.body_count);
+    }
+}
+
+/* Every declaration is spliced into the unit. Prototypes and `extern`s emit
+   nothing, but `collectSymbols` needs their types for calls and stores. */
+pToken pchCodeTokens(const pPch pch) {
+    pToken  tokens = NULL;
+    pToken* tail   = &tokens;
+    for (uint i = 0; i<pch->header->num_decls; i++) {
+        const PchDecl decl = pch->decls[i];
+        *tail = pchTokens(pch, decl.first_token, decl.num_tokens);
+        while (*tail) tail = &((*tail)->next);
+    }
+    return tokens;
+}
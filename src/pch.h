@@ -0,0 +1,90 @@
+#ifndef QUEBEC_PCH_H
+#define QUEBEC_PCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "preprocess.h"
+
+/* Precompiled header layout, every section is an array of fixed-size
+   little-endian records addressed by offsets from the start of the file:
+
+   PchHeader | strings | PchLine[] | PchToken[] | PchMacro[] | uint32_t params[] | PchDecl[]
+
+   Strings are NUL-terminated and referenced by their offset into the
+   string section, so a mapped file can hand them out without copying. */
+
+#define PCH_MAGIC   "QPCH"
+#define PCH_VERSION 1
+#define PCH_NONE    UINT32_MAX
+
+enum PchFlags {
+    PCH_PragmaOnce = 1<<0,
+};
+
+enum PchMacroFlags {
+    PCH_FunctionLike = 1<<0,
+    PCH_Variadic     = 1<<1,
+};
+
+enum DeclKind {
+    DECL_Other=0,
+    DECL_Prototype,
+    DECL_Extern,
+    DECL_Typedef,
+    DECL_Function,
+    DECL_Variable,
+DECL_KIND_LENGTH
+};
+
+__attribute_maybe_unused__ static const char* declKind2Str[DECL_KIND_LENGTH] = {
+    "Other",
+    "Prototype",
+    "Extern",
+    "Typedef",
+    "Function",
+    "Variable",
+};
+
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint32_t size;
+    uint32_t source;
+    uint32_t flags;
+    uint32_t strings_offset, strings_size;
+    uint32_t lines_offset,   num_lines;
+    uint32_t tokens_offset,  num_tokens;
+    uint32_t macros_offset,  num_macros;
+    uint32_t params_offset,  num_params;
+    uint32_t decls_offset,   num_decls;
+} PchHeader;
+
+typedef struct { uint32_t file, text, line_num;                                   } PchLine;
+typedef struct { uint32_t text, line, offset, type;                               } PchToken;
+typedef struct { uint32_t name, flags, first_param, num_params, body, body_count; } PchMacro;
+typedef struct { uint32_t name, kind, first_token, num_tokens;                    } PchDecl;
+
+typedef struct pch_s {
+    void*             map;
+    size_t            size;
+    const PchHeader*  header;
+    const char*       strings;
+    const PchLine*    lines;
+    const PchToken*   tokens;
+    const PchMacro*   macros;
+    const uint32_t*   params;
+    const PchDecl*    decls;
+    struct file_line_s* origins; /* `pFileLine`s for `lines`, one allocation */
+} *pPch;
+
+int    emitPch(const char* pch_path, const pPreprocessor pp, const pHeader header, const pToken tokens);
+pPch   loadPch(const char* pch_path);
+void   delPch (pPch* pch);
+
+const char* pchString(const pPch pch, const uint32_t offset);
+pToken      pchTokens(const pPch pch, const uint32_t first, const uint32_t count);
+void        pchDefineMacros(const pPch pch, pPreprocessor pp);
+pToken      pchCodeTokens(const pPch pch);
+
+#endif /* QUEBEC_PCH_H */
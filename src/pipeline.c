@@ -0,0 +1,86 @@
+#include "pipeline.h"
+
+#include <pthread.h>
+
+#include "lexer.h"
+#include "qbe.h"
+#include "ring.h"
+
+typedef struct {
+    pPreprocessor pp;
+    pFileLine     lines;
+    pRing         batches; /* Preprocessor -> tree builder, `pToken` lists */
+    pRing         trees;   /* Tree builder -> codegen, one `pSyntaxTree` per top-level unit */
+} Pipeline;
+
+static void pushBatch(void* context, pToken batch) {
+    pushRing(context, batch);
+}
+
+static void pushTree(void* context, pSyntaxTree tree) {
+    pushRing(context, tree);
+}
+
+static void* runPreprocessStage(void* arg) {
+    Pipeline* pipe = arg;
+    pipe->pp->sink         = pushBatch;
+    pipe->pp->sink_context = pipe->batches;
+    pipe->pp->sink_lines   = 0;
+    preprocessFile(pipe->pp, pipe->lines);
+    pipe->pp->sink = NULL;
+
+    pushRing(pipe->batches, NULL);
+    return NULL;
+}
+
+static void* runTreeStage(void* arg) {
+    Pipeline* pipe = arg;
+    TreeBuilder builder = {
+        .head         = NULL,
+        .tail         = NULL,
+        .depth        = 0,
+        .at_node      = true,
+        .sink         = pushTree,
+        .sink_context = pipe->trees,
+    };
+
+    pToken batch;
+    while ((batch = popRing(pipe->batches))) feedTreeBuilder(&builder, batch);
+    finishTreeBuilder(&builder);
+
+    pushRing(pipe->trees, NULL);
+    return NULL;
+}
+
+void compilePipelined(pPreprocessor pp, const pFileLine lines, pCodeFile file) {
+    Pipeline pipe = {
+        .pp      = pp,
+        .lines   = lines,
+        .batches = newRing(PIPELINE_RING_SIZE),
+        .trees   = newRing(PIPELINE_RING_SIZE),
+    };
+
+    pthread_t preprocess_stage, tree_stage;
+    if (pthread_create(&preprocess_stage, NULL, runPreprocessStage, &pipe) != 0 ||
+        pthread_create(&tree_stage,       NULL, runTreeStage,       &pipe) != 0)
+        ERRO(EXIT_FAILURE, "Could not start pipeline threads");
+
+    /* Codegen runs here */
+    uint        num_units = 0;
+    size_t      num_nodes = 0;
+    pSyntaxTree tree;
+    while ((tree = popRing(pipe.trees))) {
+        if (TRACING(TRACE_Tree, TRACE_Dump)) dumpSyntaxTree(tree);
+        num_units++;
+        num_nodes += tree->num_nodes;
+        compileUnit(file, tree);
+        delSyntaxTree(&tree);
+    }
+
+    pthread_join(preprocess_stage, NULL);
+    pthread_join(tree_stage,       NULL);
+    TRACE(TRACE_Codegen, TRACE_Info, "Pipelined (%s): %u unit(s), %zu node(s)", lines->file_path, num_units, num_nodes);
+
+    delRing(&pipe.batches);
+    delRing(&pipe.trees);
+}
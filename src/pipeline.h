@@ -0,0 +1,15 @@
+#ifndef QUEBEC_PIPELINE_H
+#define QUEBEC_PIPELINE_H
+
+#include "preprocess.h"
+#include "qbe.h"
+
+#define PIPELINE_RING_SIZE 64
+
+/* Compiles one translation unit with the preprocessor, tree builder and
+   codegen each on their own thread, handing token batches and finished
+   top-level trees down through `ring.h` queues. Writes the same code to
+   `file` that `compileTree` would. */
+void compilePipelined(pPreprocessor pp, const pFileLine lines, pCodeFile file);
+
+#endif /* QUEBEC_PIPELINE_H */
@@ -0,0 +1,88 @@
+#include "pool.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "memory.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint            front, back; /* Jobs left are `front` up to, but not including, `back` */
+} PoolDeque;
+
+typedef struct {
+    PoolDeque* deques;
+    uint       workers;
+    PoolJob    job;
+    void*      context;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    uint  worker;
+} PoolWorker;
+
+static bool popFront(PoolDeque* deque, uint* job) {
+    pthread_mutex_lock(&deque->lock);
+    const bool found = deque->front < deque->back;
+    if (found) *job = deque->front++;
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool stealBack(PoolDeque* deque, uint* job) {
+    pthread_mutex_lock(&deque->lock);
+    const bool found = deque->front < deque->back;
+    if (found) *job = --deque->back;
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void* runWorker(void* arg) {
+    const PoolWorker* self = arg;
+    Pool* pool = self->pool;
+
+    uint job;
+    for (;;) {
+        bool found = popFront(&pool->deques[self->worker], &job);
+        for (uint i = 1; !found && i<pool->workers; i++)
+            found = stealBack(&pool->deques[(self->worker + i) % pool->workers], &job);
+        if (!found) break; /* Jobs never spawn jobs, so every deque is empty for good */
+        pool->job(pool->context, job);
+    }
+    return NULL;
+}
+
+void runPool(const uint workers, const uint num_jobs, PoolJob job, void* context) {
+    if (workers < 2 || num_jobs < 2) {
+        for (uint i = 0; i<num_jobs; i++) job(context, i);
+        return;
+    }
+
+    const uint threads = workers < num_jobs ? workers : num_jobs;
+    Pool pool = {
+        .deques  = allocMemory(MEM_Driver, threads*sizeof(PoolDeque)),
+        .workers = threads,
+        .job     = job,
+        .context = context,
+    };
+    PoolWorker* self = allocMemory(MEM_Driver, threads*sizeof(PoolWorker));
+    pthread_t*  tids = allocMemory(MEM_Driver, threads*sizeof(pthread_t));
+
+    for (uint w = 0; w<threads; w++) {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+        pool.deques[w].front = (uint)((size_t)num_jobs* w    / threads);
+        pool.deques[w].back  = (uint)((size_t)num_jobs*(w+1) / threads);
+        self[w] = (PoolWorker){ .pool = &pool, .worker = w };
+    }
+
+    for (uint w = 1; w<threads; w++)
+        if (pthread_create(&tids[w], NULL, runWorker, &self[w]) != 0) ERRO(EXIT_FAILURE, "Could not start worker thread");
+    runWorker(&self[0]);
+    for (uint w = 1; w<threads; w++) pthread_join(tids[w], NULL);
+
+    for (uint w = 0; w<threads; w++) pthread_mutex_destroy(&pool.deques[w].lock);
+    freeMemory(pool.deques);
+    freeMemory(self);
+    freeMemory(tids);
+}
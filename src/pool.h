@@ -0,0 +1,15 @@
+#ifndef QUEBEC_POOL_H
+#define QUEBEC_POOL_H
+
+#include "common.h"
+
+/* Runs `job(context, 0..num_jobs-1)` on `workers` threads, the calling one
+   included. Each worker starts on its own contiguous share of the jobs and
+   steals from the back of the others' once it runs dry, so uneven jobs
+   still keep every thread busy. Returns once every job has finished. */
+
+typedef void (*PoolJob)(void* context, const uint job);
+
+void runPool(const uint workers, const uint num_jobs, PoolJob job, void* context);
+
+#endif /* QUEBEC_POOL_H */
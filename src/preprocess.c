@@ -0,0 +1,1107 @@
+#include "preprocess.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "intern.h"
+#include "pch.h"
+#include "memory.h"
+
+typedef struct {
+    pToken  head;
+    pToken* tail;
+} TokenList;
+
+#define EMPTY_TOKEN_LIST(LIST) TokenList LIST = { .head=NULL, .tail=&(LIST.head) }
+
+static void pushTokenList(TokenList* list, pToken token) {
+    *(list->tail) = token;
+    while (token->next) token = token->next;
+    list->tail = &(token->next);
+}
+
+static bool isText(const pToken token, const char* text) {
+    return token && strcmp(token->text, text)==0;
+}
+
+static bool isName(const pToken token) {
+    const char c = token->text[0];
+    return (c>='A' && c<='Z') || (c>='a' && c<='z') || c=='_';
+}
+
+/* First token of the line following the one `line` belongs to */
+static pToken nextLine(const pToken line) {
+    pToken end = line;
+    while (end && end->origin == line->origin) end = end->next;
+    return end;
+}
+
+/************************************************************/
+
+static pMacro findMacro(const pPreprocessor pp, const char* name) {
+    pMacro macro = pp->macros[hashString(name) % MACRO_BUCKETS];
+    while (macro) {
+        if (strcmp(macro->name, name)==0) return macro;
+        macro = macro->next;
+    }
+    return NULL;
+}
+
+static void delMacro(pMacro* mp) {
+    if (mp==NULL || *mp==NULL) return;
+    pMacro macro = *mp;
+    pExpansion expansion = macro->cache;
+    while (expansion) {
+        pExpansion next = expansion->next;
+        freeMemory(expansion->key);
+        freeMemory(expansion->tokens);
+        freeMemory(expansion);
+        expansion = next;
+    }
+    for (uint i = 0; i<macro->num_params; i++) freeMemory(macro->params[i]);
+    freeMemory(macro->params);
+    freeMemory(macro->name);
+    delToken(&(macro->body));
+    freeMemory(macro);
+    *mp = NULL;
+}
+
+static pMacroStats findMacroStats(pPreprocessor pp, const char* name) {
+    pMacroStats* bucket = &(pp->stats[hashString(name) % MACRO_BUCKETS]);
+    for (pMacroStats stats = *bucket; stats; stats = stats->next)
+        if (strcmp(stats->name, name)==0) return stats;
+
+    pMacroStats stats = allocMemory(MEM_Preprocess, sizeof(*stats));
+    *stats = (struct macro_stats_s){
+        .name       = internString(name),
+        .expansions = 0,
+        .cache_hits = 0,
+        .tokens_in  = 0,
+        .tokens_out = 0,
+        .next       = *bucket
+    };
+    *bucket = stats;
+    return stats;
+}
+
+static void undefMacro(pPreprocessor pp, const char* name) {
+    pp->epoch++;
+    pMacro* link = &(pp->macros[hashString(name) % MACRO_BUCKETS]);
+    while (*link) {
+        if (strcmp((*link)->name, name)==0) {
+            pMacro next = (*link)->next;
+            delMacro(link);
+            *link = next;
+            return;
+        }
+        link = &((*link)->next);
+    }
+}
+
+pMacro defineMacro(pPreprocessor pp, const char* name) {
+    undefMacro(pp, name);
+
+    pMacro macro = allocMemory(MEM_Preprocess, sizeof(*macro));
+    *macro = (struct macro_s){
+        .name          = strdupMemory(MEM_Preprocess, name),
+        .function_like = false,
+        .variadic      = false,
+        .expanding     = false,
+        .num_params    = 0,
+        .params        = NULL,
+        .body          = NULL,
+        .num_cached    = 0,
+        .cache         = NULL,
+        .stats         = findMacroStats(pp, name),
+        .next          = NULL
+    };
+
+    pMacro* bucket = &(pp->macros[hashString(name) % MACRO_BUCKETS]);
+    macro->next = *bucket;
+    *bucket     = macro;
+    return macro;
+}
+
+static void clearMacros(pPreprocessor pp) {
+    for (uint i = 0; i<MACRO_BUCKETS; i++) {
+        pMacro macro = pp->macros[i];
+        while (macro) {
+            pMacro next = macro->next;
+            delMacro(&macro);
+            macro = next;
+        }
+        pp->macros[i] = NULL;
+    }
+}
+
+static void defineBuiltinMacro(pPreprocessor pp, const char* name, const char* value) {
+    pMacro macro = defineMacro(pp, name);
+    macro->body  = newToken(NULL, value, 0);
+}
+
+static int paramIndex(const pMacro macro, const pToken token) {
+    for (uint i = 0; i<macro->num_params; i++)
+        if (strcmp(macro->params[i], token->text)==0) return i;
+    return -1;
+}
+
+/************************************************************/
+
+pPreprocessor newPreprocessor(void) {
+    pPreprocessor pp = allocMemory(MEM_Preprocess, sizeof(*pp));
+    *pp = (struct preprocessor_s){
+        .macros           = {0},
+        .headers          = NULL,
+        .pch              = NULL,
+        .include_dirs     = NULL,
+        .num_include_dirs = 0,
+        .unit             = 0,
+        .depth            = 0,
+        .jobs             = 1,
+        .lex_cache        = NULL,
+        .sink             = NULL,
+        .sink_context     = NULL,
+        .sink_lines       = 0,
+        .stats            = {0},
+        .epoch            = 0,
+        .disabled         = NULL,
+        .num_disabled     = 0,
+        .disabled_capacity= 0,
+        .site_dependent   = false,
+        .key              = NULL,
+        .key_capacity     = 0,
+        .header_reads     = 0,
+        .header_hits      = 0,
+        .guard_skips      = 0
+    };
+    return pp;
+}
+
+static void delHeader(pHeader header) {
+    delToken(&(header->tokens));
+    delFileLine(&(header->lines));
+    freeMemory(header->guard);
+    freeMemory(header->path);
+    freeMemory(header);
+}
+
+void delPreprocessor(pPreprocessor* ppp) {
+    if (ppp==NULL || *ppp==NULL) return;
+    pPreprocessor pp = *ppp;
+
+    clearMacros(pp);
+
+    pHeader header = pp->headers;
+    while (header) {
+        pHeader next = header->next;
+        delHeader(header);
+        header = next;
+    }
+
+    for (uint i = 0; i<MACRO_BUCKETS; i++) {
+        pMacroStats stats = pp->stats[i];
+        while (stats) {
+            pMacroStats next = stats->next;
+            freeMemory(stats);
+            stats = next;
+        }
+    }
+    freeMemory(pp->key);
+    freeMemory(pp->disabled);
+
+    for (uint i = 0; i<pp->num_include_dirs; i++) freeMemory(pp->include_dirs[i]);
+    freeMemory(pp->include_dirs);
+    freeMemory(pp);
+    *ppp = NULL;
+}
+
+void addIncludeDir(pPreprocessor pp, const char* dir) {
+    pp->include_dirs = reallocMemory(MEM_Preprocess, pp->include_dirs, (pp->num_include_dirs+1)*sizeof(char*));
+    pp->include_dirs[pp->num_include_dirs++] = strdupMemory(MEM_Preprocess, dir);
+}
+
+/************************************************************/
+
+static void expandTokens(pPreprocessor pp, TokenList* out, const pToken begin, const pToken end, const pToken site);
+
+static void emitToken(TokenList* out, const pToken token, const pToken site) {
+    pToken copy = cloneToken(token);
+    if (site) {
+        /* Expanded tokens are attributed to the line that invoked the macro */
+        copy->origin = site->origin;
+        copy->offset = site->offset;
+    }
+    pushTokenList(out, copy);
+}
+
+static void emitText(TokenList* out, const char* text, const pToken site) {
+    pToken token = newToken(site->origin, text, site->offset);
+    pushTokenList(out, token);
+}
+
+static void stringifyTokens(TokenList* out, const pToken begin, const pToken end, const pToken site) {
+    size_t length = 3;
+    for (pToken t = begin; t != end; t = t->next) length += 2*strlen(t->text) + 1;
+
+    char* buf = allocMemory(MEM_Preprocess, length);
+    char* s   = buf;
+    *s++ = '\"';
+    pToken prev = NULL;
+    for (pToken t = begin; t != end; prev = t, t = t->next) {
+        if (prev && prev->offset + strlen(prev->text) < t->offset) *s++ = ' ';
+        const bool literal = t->type==TOKEN_stringConst || t->type==TOKEN_charConst;
+        for (const char* c = t->text; *c; c++) {
+            if (literal && (*c=='\"' || *c=='\\')) *s++ = '\\';
+            *s++ = *c;
+        }
+    }
+    *s++ = '\"';
+    *s   = 0;
+
+    emitText(out, buf, site);
+    freeMemory(buf);
+}
+
+/* Joins `A ## B` pairs in a substituted macro body */
+static void pasteTokens(TokenList* list) {
+    pToken* link = &(list->head);
+    while (*link) {
+        pToken lhs = *link;
+        if (!isText(lhs->next, "##")) {
+            if (isText(lhs, "##")) { /* Dangling paste against an empty argument */
+                *link = lhs->next;
+                lhs->next = NULL;
+                delToken(&lhs);
+                continue;
+            }
+            link = &(lhs->next);
+            continue;
+        }
+
+        pToken paste = lhs->next;
+        pToken rhs   = paste->next;
+        if (rhs == NULL) {
+            lhs->next = NULL;
+            delToken(&paste);
+            break;
+        }
+
+        char* text = allocMemory(MEM_Preprocess, strlen(lhs->text) + strlen(rhs->text) + 1);
+        strcpy(text, lhs->text);
+        strcat(text, rhs->text);
+        pToken joined = newToken(lhs->origin, text, lhs->offset);
+        freeMemory(text);
+
+        joined->next = rhs->next;
+        rhs->next    = NULL;
+        paste->next  = NULL;
+        lhs->next    = NULL;
+        delToken(&lhs);
+        delToken(&paste);
+        delToken(&rhs);
+        *link = joined;
+    }
+
+    list->tail = &(list->head);
+    while (*(list->tail)) list->tail = &((*(list->tail))->next);
+}
+
+/* Macros being rescanned can't expand again; which ones those are is part of an expansion's key */
+static void disableMacro(pPreprocessor pp, pMacro macro) {
+    if (pp->num_disabled == pp->disabled_capacity) {
+        pp->disabled_capacity = pp->disabled_capacity ? 2*pp->disabled_capacity : 16;
+        pp->disabled = reallocMemory(MEM_Preprocess, pp->disabled, pp->disabled_capacity*sizeof(pMacro));
+    }
+    pp->disabled[pp->num_disabled++] = macro;
+    macro->expanding = true;
+}
+
+static void enableMacro(pPreprocessor pp, pMacro macro) {
+    pp->num_disabled--;
+    macro->expanding = false;
+}
+
+typedef struct {
+    pToken starts[MAX_MACRO_PARAMS+1], ends[MAX_MACRO_PARAMS+1];
+    uint   num_args;
+    pToken close;
+} MacroArgs;
+
+static void collectMacroArgs(const pMacro macro, const pToken name, const pToken end, MacroArgs* args) {
+    uint num_args = 0;
+    int  depth    = 0;
+
+    pToken close = name->next->next;
+    args->starts[0] = close;
+    for (; close != end; close = close->next) {
+        if (isText(close, "(")) depth++;
+        if (isText(close, ")")) {
+            if (depth==0) break;
+            depth--;
+        }
+        const bool in_varargs = macro->variadic && num_args+1 >= macro->num_params;
+        if (isText(close, ",") && depth==0 && !in_varargs) {
+            if (num_args >= MAX_MACRO_PARAMS) ERRO(EXIT_FAILURE, "Too many arguments to macro `%s`", macro->name);
+            args->ends[num_args++] = close;
+            args->starts[num_args] = close->next;
+        }
+    }
+    if (close == end) ERRO(EXIT_FAILURE, "Unterminated invocation of macro `%s`", macro->name);
+    args->ends[num_args++] = close;
+    if (macro->num_params == 0 && args->starts[0] == close) num_args = 0; /* `F()` */
+
+    if (macro->variadic && num_args+1 == macro->num_params) { /* Empty `__VA_ARGS__` */
+        args->starts[num_args] = args->ends[num_args] = close;
+        num_args++;
+    }
+    if (num_args != macro->num_params)
+        ERRO(EXIT_FAILURE, "Macro `%s` expects %u argument(s), got %u", macro->name, macro->num_params, num_args);
+
+    args->num_args = num_args;
+    args->close    = close;
+}
+
+static void substituteMacro(pPreprocessor pp, TokenList* out, pMacro macro, const MacroArgs* args, const pToken name, const pToken site) {
+    EMPTY_TOKEN_LIST(substituted);
+    bool after_paste = false;
+    for (pToken b = macro->body; b; b = b->next) {
+        if (isText(b, "#") && b->next && paramIndex(macro, b->next)>=0) {
+            const int i = paramIndex(macro, b->next);
+            stringifyTokens(&substituted, args->starts[i], args->ends[i], name);
+            b = b->next;
+            after_paste = false;
+            continue;
+        }
+
+        const int i = paramIndex(macro, b);
+        if (i < 0) {
+            emitToken(&substituted, b, NULL);
+            after_paste = isText(b, "##");
+            continue;
+        }
+
+        if (after_paste || isText(b->next, "##")) { /* Operands of `##` aren't pre-expanded */
+            for (pToken a = args->starts[i]; a != args->ends[i]; a = a->next) emitToken(&substituted, a, NULL);
+        } else {
+            expandTokens(pp, &substituted, args->starts[i], args->ends[i], NULL);
+        }
+        after_paste = false;
+    }
+    pasteTokens(&substituted);
+
+    disableMacro(pp, macro);
+    expandTokens(pp, out, substituted.head, NULL, site);
+    enableMacro(pp, macro);
+
+    delToken(&(substituted.head));
+}
+
+/************************************************************/
+
+/* Memoized expansions: an invocation is keyed by the macros disabled around it and
+   the interned spelling of its arguments (plus where whitespace fell, for the sake
+   of `#`), so every identical invocation reuses one fully rescanned token range. */
+
+static const char WHITESPACE_KEY[] = " ";
+
+static uint buildExpansionKey(pPreprocessor pp, const pMacro macro, const MacroArgs* args) {
+    uint len = 0;
+    #define pushKey(TEXT) {\
+        if (len == pp->key_capacity) {\
+            pp->key_capacity = pp->key_capacity ? 2*pp->key_capacity : 64;\
+            pp->key = reallocMemory(MEM_Preprocess, pp->key, pp->key_capacity*sizeof(char*));\
+        }\
+        pp->key[len++] = (TEXT);\
+    }
+    for (uint i = 0; i<pp->num_disabled; i++) pushKey((const char*)pp->disabled[i]);
+    pushKey(NULL);
+    for (uint i = 0; macro->function_like && i<args->num_args; i++) {
+        pToken prev = NULL;
+        for (pToken a = args->starts[i]; a != args->ends[i]; prev = a, a = a->next) {
+            if (prev && prev->offset + strlen(prev->text) < a->offset) pushKey(WHITESPACE_KEY);
+            pushKey(a->text);
+        }
+        pushKey(NULL);
+    }
+    #undef pushKey
+    return len;
+}
+
+static pExpansion findExpansion(const pPreprocessor pp, const pMacro macro, const uint key_len, const uint hash) {
+    for (pExpansion expansion = macro->cache; expansion; expansion = expansion->next) {
+        if (expansion->hash    != hash      ) continue;
+        if (expansion->epoch   != pp->epoch ) continue;
+        if (expansion->key_len != key_len   ) continue;
+        if (memcmp(expansion->key, pp->key, key_len*sizeof(char*))==0) return expansion;
+    }
+    return NULL;
+}
+
+/* Takes ownership of `key` */
+static void storeExpansion(const pPreprocessor pp, pMacro macro, const char** key, const uint key_len, const uint hash, const pToken tokens) {
+    if (macro->num_cached >= MAX_CACHED_EXPANSIONS) {
+        freeMemory(key);
+        return;
+    }
+
+    uint num_tokens = 0;
+    for (pToken t = tokens; t; t = t->next) num_tokens++;
+
+    pExpansion expansion = allocMemory(MEM_Preprocess, sizeof(*expansion));
+    *expansion = (struct expansion_s){
+        .hash       = hash,
+        .epoch      = pp->epoch,
+        .key_len    = key_len,
+        .key        = key,
+        .num_tokens = num_tokens,
+        .tokens     = allocMemory(MEM_Preprocess, num_tokens*sizeof(struct token_s)),
+        .next       = macro->cache
+    };
+
+    uint i = 0;
+    for (pToken t = tokens; t; t = t->next, i++) {
+        expansion->tokens[i]      = *t;
+        expansion->tokens[i].next = NULL;
+    }
+
+    macro->cache = expansion;
+    macro->num_cached++;
+}
+
+static pToken expandMacro(pPreprocessor pp, TokenList* out, pMacro macro, const pToken name, const pToken end, const pToken site) {
+    MacroArgs args = { .num_args=0, .close=name };
+    if (macro->function_like) collectMacroArgs(macro, name, end, &args);
+
+    pMacroStats stats = macro->stats;
+    stats->expansions++;
+    for (pToken t = name; ; t = t->next) {
+        stats->tokens_in++;
+        if (t == args.close) break;
+    }
+
+    const uint key_len = buildExpansionKey(pp, macro, &args);
+    const uint hash    = hashStringN((const char*)pp->key, key_len*sizeof(char*));
+
+    const pExpansion hit = findExpansion(pp, macro, key_len, hash);
+    if (hit) {
+        for (uint i = 0; i<hit->num_tokens; i++) emitToken(out, &(hit->tokens[i]), site);
+        stats->cache_hits++;
+        stats->tokens_out += hit->num_tokens;
+        return args.close;
+    }
+
+    /* Nested expansions reuse the scratch key, keep a copy for recording this one */
+    const char** key = allocMemory(MEM_Preprocess, key_len*sizeof(char*));
+    memcpy(key, pp->key, key_len*sizeof(char*));
+
+    pToken* mark = out->tail;
+    const bool outer_site_dependent = pp->site_dependent;
+    pp->site_dependent = false;
+
+    if (macro->function_like) substituteMacro(pp, out, macro, &args, name, site);
+    else {
+        disableMacro(pp, macro);
+        expandTokens(pp, out, macro->body, NULL, site);
+        enableMacro(pp, macro);
+    }
+
+    for (pToken t = *mark; t; t = t->next) stats->tokens_out++;
+    if (!pp->site_dependent) storeExpansion(pp, macro, key, key_len, hash, *mark);
+    else freeMemory(key);
+    pp->site_dependent |= outer_site_dependent;
+
+    return args.close;
+}
+
+static void expandTokens(pPreprocessor pp, TokenList* out, const pToken begin, const pToken end, const pToken site) {
+    for (pToken t = begin; t != end; t = t->next) {
+        const pToken at = site ? site : t;
+
+        if (!isName(t)) {
+            emitToken(out, t, site);
+            continue;
+        }
+        if (strcmp(t->text, "__LINE__")==0 && at->origin) {
+            char buf[16];
+            sprintf(buf, "%u", at->origin->line_num);
+            emitText(out, buf, at);
+            pp->site_dependent = true;
+            continue;
+        }
+        if (strcmp(t->text, "__FILE__")==0 && at->origin) {
+            char* buf = allocMemory(MEM_Preprocess, strlen(at->origin->file_path) + 3);
+            sprintf(buf, "\"%s\"", at->origin->file_path);
+            emitText(out, buf, at);
+            freeMemory(buf);
+            pp->site_dependent = true;
+            continue;
+        }
+
+        pMacro macro = findMacro(pp, t->text);
+        if (macro == NULL || macro->expanding) {
+            emitToken(out, t, site);
+            continue;
+        }
+        if (macro->function_like && (t->next == end || !isText(t->next, "("))) { /* Function-like name without a call */
+            emitToken(out, t, site);
+            continue;
+        }
+
+        /* Expanded tokens are attributed to the line that invoked the outermost macro */
+        t = expandMacro(pp, out, macro, t, end, at);
+    }
+}
+
+/************************************************************/
+
+/* `#if` expressions: precedence climbing over the macro-expanded directive */
+
+static long evalConditional(pToken* cur, const int min_prec);
+
+static long evalPrimary(pToken* cur) {
+    pToken t = *cur;
+    if (t == NULL) ERRO(EXIT_FAILURE, "Unexpected end of `#if` expression");
+    *cur = t->next;
+
+    if (isText(t, "(")) {
+        const long value = evalConditional(cur, 0);
+        if (!isText(*cur, ")")) ERRO(EXIT_FAILURE, "Expected `)` in `#if` expression");
+        *cur = (*cur)->next;
+        return value;
+    }
+    if (isText(t, "!")) return !evalPrimary(cur);
+    if (isText(t, "~")) return ~evalPrimary(cur);
+    if (isText(t, "-")) return -evalPrimary(cur);
+    if (isText(t, "+")) return  evalPrimary(cur);
+
+    switch (t->type) {
+        case TOKEN_intConst:
+        case TOKEN_hexConst:  return strtol(t->text, NULL, 0);
+        case TOKEN_charConst: return t->text[1]=='\\' ? t->text[2]=='n' ? '\n' : t->text[2] : t->text[1];
+        default: break;
+    }
+    if (isName(t)) return 0; /* Identifiers left after expansion evaluate to 0 */
+
+    ERRO(EXIT_FAILURE, "Unexpected `%s` in `#if` expression", t->text);
+    return 0;
+}
+
+static int binaryPrecedence(const pToken t) {
+    static const struct { const char* op; int prec; } table[] = {
+        {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5},
+        {"==", 6}, {"!=", 6},
+        {"<",  7}, {">",  7}, {"<=", 7}, {">=", 7},
+        {"<<", 8}, {">>", 8},
+        {"+",  9}, {"-",  9},
+        {"*", 10}, {"/", 10}, {"%", 10},
+    };
+    if (t == NULL) return -1;
+    for (uint i = 0; i<sizeof(table)/sizeof(table[0]); i++)
+        if (strcmp(t->text, table[i].op)==0) return table[i].prec;
+    return -1;
+}
+
+static long evalConditional(pToken* cur, const int min_prec) {
+    long lhs = evalPrimary(cur);
+
+    int prec;
+    while ((prec = binaryPrecedence(*cur)) > min_prec) {
+        const char* op = (*cur)->text;
+        *cur = (*cur)->next;
+        const long rhs = evalConditional(cur, prec);
+
+        if ((op[0]=='/' || op[0]=='%') && rhs==0) ERRO(EXIT_FAILURE, "Division by zero in `#if` expression");
+        if      (strcmp(op, "||")==0) lhs = lhs || rhs;
+        else if (strcmp(op, "&&")==0) lhs = lhs && rhs;
+        else if (strcmp(op, "==")==0) lhs = lhs == rhs;
+        else if (strcmp(op, "!=")==0) lhs = lhs != rhs;
+        else if (strcmp(op, "<=")==0) lhs = lhs <= rhs;
+        else if (strcmp(op, ">=")==0) lhs = lhs >= rhs;
+        else if (strcmp(op, "<<")==0) lhs = lhs << rhs;
+        else if (strcmp(op, ">>")==0) lhs = lhs >> rhs;
+        else switch (op[0]) {
+            case '|': lhs = lhs |  rhs; break;
+            case '^': lhs = lhs ^  rhs; break;
+            case '&': lhs = lhs &  rhs; break;
+            case '<': lhs = lhs <  rhs; break;
+            case '>': lhs = lhs >  rhs; break;
+            case '+': lhs = lhs +  rhs; break;
+            case '-': lhs = lhs -  rhs; break;
+            case '*': lhs = lhs *  rhs; break;
+            case '/': lhs = lhs /  rhs; break;
+            case '%': lhs = lhs %  rhs; break;
+        }
+    }
+
+    if (min_prec == 0 && isText(*cur, "?")) {
+        *cur = (*cur)->next;
+        const long if_true = evalConditional(cur, 0);
+        if (!isText(*cur, ":")) ERRO(EXIT_FAILURE, "Expected `:` in `#if` expression");
+        *cur = (*cur)->next;
+        const long if_false = evalConditional(cur, 0);
+        return lhs ? if_true : if_false;
+    }
+    return lhs;
+}
+
+static bool evalIfDirective(pPreprocessor pp, const pToken begin, const pToken end) {
+    /* `defined` has to be resolved before macro expansion touches its operand */
+    EMPTY_TOKEN_LIST(resolved);
+    for (pToken t = begin; t != end; t = t->next) {
+        if (!isText(t, "defined")) {
+            emitToken(&resolved, t, NULL);
+            continue;
+        }
+        pToken name = t->next;
+        const bool parens = isText(name, "(");
+        if (parens) name = name->next;
+        if (name == end || name == NULL) ERRO(EXIT_FAILURE, "Expected a macro name after `defined`");
+        emitText(&resolved, findMacro(pp, name->text) ? "1" : "0", t);
+        t = name;
+        if (parens) {
+            if (!isText(t->next, ")")) ERRO(EXIT_FAILURE, "Expected `)` after `defined(%s`", name->text);
+            t = t->next;
+        }
+    }
+
+    EMPTY_TOKEN_LIST(expanded);
+    expandTokens(pp, &expanded, resolved.head, NULL, NULL);
+
+    pToken cur = expanded.head;
+    const long value = evalConditional(&cur, 0);
+    if (cur != NULL) ERRO(EXIT_FAILURE, "Unexpected `%s` in `#if` expression", cur->text);
+
+    delToken(&(resolved.head));
+    delToken(&(expanded.head));
+    return value != 0;
+}
+
+/************************************************************/
+
+static void parseDefine(pPreprocessor pp, const pToken name, const pToken end) {
+    if (name == end || !isName(name)) ERRO(EXIT_FAILURE, "Expected a macro name after `#define`");
+    pMacro macro = defineMacro(pp, name->text);
+
+    pToken body = name->next;
+    /* Only `NAME(` with no whitespace in between makes a function-like macro */
+    if (body != end && isText(body, "(") && body->offset == name->offset + strlen(name->text)) {
+        macro->function_like = true;
+        char* params[MAX_MACRO_PARAMS];
+
+        pToken t = body->next;
+        for (; t != end && !isText(t, ")"); t = t->next) {
+            if (isText(t, ",")) continue;
+            if (macro->num_params >= MAX_MACRO_PARAMS) ERRO(EXIT_FAILURE, "Too many parameters for macro `%s`", macro->name);
+            if (isText(t, ".")) {
+                while (isText(t->next, ".")) t = t->next;
+                macro->variadic = true;
+                params[macro->num_params++] = strdupMemory(MEM_Preprocess, "__VA_ARGS__");
+                continue;
+            }
+            if (!isName(t)) ERRO(EXIT_FAILURE, "Bad parameter `%s` for macro `%s`", t->text, macro->name);
+            params[macro->num_params++] = strdupMemory(MEM_Preprocess, t->text);
+        }
+        if (t == end) ERRO(EXIT_FAILURE, "Unterminated parameter list for macro `%s`", macro->name);
+
+        macro->params = allocMemory(MEM_Preprocess, macro->num_params*sizeof(char*));
+        memcpy(macro->params, params, macro->num_params*sizeof(char*));
+        body = t->next;
+    }
+
+    EMPTY_TOKEN_LIST(tokens);
+    for (pToken t = body; t != end; t = t->next) emitToken(&tokens, t, NULL);
+    macro->body = tokens.head;
+}
+
+static pHeader findHeader(const pPreprocessor pp, const char* path) {
+    pHeader header = pp->headers;
+    while (header) {
+        if (strcmp(header->path, path)==0) return header;
+        header = header->next;
+    }
+    return NULL;
+}
+
+void forgetHeader(pPreprocessor pp, const char* path) {
+    for (pHeader* link = &(pp->headers); *link; link = &((*link)->next)) {
+        if (strcmp((*link)->path, path)!=0) continue;
+        pHeader header = *link;
+        *link = header->next;
+        delHeader(header);
+        return;
+    }
+}
+
+static bool isDirective(const pToken line, const char* name) {
+    return isText(line, "#") && line->next && line->next->origin == line->origin && isText(line->next, name);
+}
+
+/* Recognizes the `#ifndef X / #define X / ... / #endif` idiom wrapping the whole header */
+static char* detectIncludeGuard(const pToken tokens) {
+    if (!isDirective(tokens, "ifndef")) return NULL;
+    const pToken guard = tokens->next->next;
+    if (guard == NULL || guard->origin != tokens->origin) return NULL;
+
+    pToken line = nextLine(tokens);
+    if (!isDirective(line, "define") || !isText(line->next->next, guard->text)) return NULL;
+
+    int depth = 1;
+    for (line = nextLine(line); line; line = nextLine(line)) {
+        if (!isText(line, "#")) continue;
+        if (isDirective(line, "if") || isDirective(line, "ifdef") || isDirective(line, "ifndef")) depth++;
+        if (isDirective(line, "endif") && --depth == 0) break;
+    }
+    if (line == NULL || nextLine(line) != NULL) return NULL;
+    return strdupMemory(MEM_Preprocess, guard->text);
+}
+
+static pToken lexLines(const pPreprocessor pp, const pFileLine lines) {
+    return pp->lex_cache ? tokenizeLinesCached(lines, pp->lex_cache) : tokenizeLines(lines, pp->jobs);
+}
+
+static pHeader loadHeader(pPreprocessor pp, const char* path) {
+    pHeader header = allocMemory(MEM_Preprocess, sizeof(*header));
+    *header = (struct header_s){
+        .path        = strdupMemory(MEM_Preprocess, path),
+        .lines       = NULL,
+        .tokens      = NULL,
+        .guard       = NULL,
+        .pragma_once = false,
+        .last_unit   = 0,
+        .next        = pp->headers
+    };
+    header->lines  = readFileAsLines(header->path);
+    header->tokens = lexLines(pp, header->lines);
+    header->guard  = detectIncludeGuard(header->tokens);
+
+    pp->headers = header;
+    pp->header_reads++;
+    return header;
+}
+
+static pHeader resolveInclude(pPreprocessor pp, const char* name, const bool quoted, const pFileLine from) {
+    char* path = allocMemory(MEM_Preprocess, strlen(name) + 1);
+    const uint num_dirs = pp->num_include_dirs + (quoted ? 1 : 0);
+
+    for (uint i = 0; i<num_dirs; i++) {
+        const char* dir = NULL;
+        size_t dir_len  = 0;
+        if (quoted && i==0) { /* Directory of the including file comes first */
+            const char* slash = from->file_path ? strrchr(from->file_path, '/') : NULL;
+            dir     = from->file_path;
+            dir_len = slash ? (size_t)(slash - dir) : 0;
+        } else {
+            dir     = pp->include_dirs[i - (quoted ? 1 : 0)];
+            dir_len = strlen(dir);
+        }
+
+        path = reallocMemory(MEM_Preprocess, path, dir_len + strlen(name) + 2);
+        if (dir_len) sprintf(path, "%.*s/%s", (int)dir_len, dir, name);
+        else         strcpy(path, name);
+
+        pHeader header = findHeader(pp, path);
+        if (header) {
+            pp->header_hits++;
+            freeMemory(path);
+            return header;
+        }
+        if (access(path, R_OK)==0) {
+            header = loadHeader(pp, path);
+            freeMemory(path);
+            return header;
+        }
+    }
+
+    freeMemory(path);
+    return NULL;
+}
+
+static void preprocessTokens(pPreprocessor pp, TokenList* out, const pToken tokens, pHeader current);
+static void flushToSink(pPreprocessor pp, TokenList* out);
+
+static void includeHeader(pPreprocessor pp, TokenList* out, const pToken directive, const pToken end) {
+    pToken target = directive->next;
+    if (target == end) ERRO(EXIT_FAILURE, "Expected a file name after `#include`");
+
+    char name[256] = {0};
+    bool quoted    = false;
+    if (target->type == TOKEN_stringConst) {
+        quoted = true;
+        snprintf(name, sizeof(name), "%.*s", (int)strlen(target->text)-2, target->text+1);
+    } else if (isText(target, "<")) {
+        for (pToken t = target->next; t != end && !isText(t, ">"); t = t->next)
+            strncat(name, t->text, sizeof(name)-strlen(name)-1);
+    } else ERRO(EXIT_FAILURE, "Bad `#include` target `%s`", target->text);
+
+    pHeader header = resolveInclude(pp, name, quoted, directive->origin);
+    if (header == NULL) {
+        if (quoted) ERRO(EXIT_FAILURE, "Included file (%s) does not exist", name);
+        TRACE(TRACE_Lexer, TRACE_Debug, "Skipping system header <%s>", name);
+        return;
+    }
+
+    if (header->pragma_once && header->last_unit == pp->unit) return;
+    if (header->guard && findMacro(pp, header->guard)) {
+        pp->guard_skips++;
+        return;
+    }
+    header->last_unit = pp->unit;
+
+    if (++(pp->depth) > MAX_INCLUDE_DEPTH) ERRO(EXIT_FAILURE, "`#include` nested too deeply at (%s)", header->path);
+    preprocessTokens(pp, out, header->tokens, header);
+    pp->depth--;
+}
+
+typedef struct {
+    bool active;    /* Lines in the current branch are kept */
+    bool taken;     /* Some branch of this conditional has already been kept */
+    bool seen_else;
+} Conditional;
+
+static void preprocessTokens(pPreprocessor pp, TokenList* out, const pToken tokens, pHeader current) {
+    Conditional conds[MAX_CONDITIONAL_DEPTH];
+    uint depth = 0;
+    #define ACTIVE (depth==0 || conds[depth-1].active)
+
+    pToken line = tokens;
+    while (line) {
+        const pToken end = nextLine(line);
+        if (!isText(line, "#")) {
+            if (ACTIVE) expandTokens(pp, out, line, end, NULL);
+            if (pp->sink && ++(pp->sink_lines) % SINK_BATCH_LINES == 0) flushToSink(pp, out);
+            line = end;
+            continue;
+        }
+
+        const pToken directive = line->next != end ? line->next : NULL;
+        const char*  name      = directive ? directive->text : "";
+        const pToken operand   = directive ? directive->next : NULL;
+
+        if (strcmp(name, "if")==0 || strcmp(name, "ifdef")==0 || strcmp(name, "ifndef")==0) {
+            if (depth >= MAX_CONDITIONAL_DEPTH) ERRO(EXIT_FAILURE, "Conditionals nested too deeply");
+            bool value = false;
+            if (ACTIVE) {
+                if (name[2] == 0) value = evalIfDirective(pp, operand, end);
+                else {
+                    if (operand == end) ERRO(EXIT_FAILURE, "Expected a macro name after `#%s`", name);
+                    value = (findMacro(pp, operand->text) != NULL) == (name[2] == 'd');
+                }
+            }
+            conds[depth] = (Conditional){
+                .active    = ACTIVE && value,
+                .taken     = !ACTIVE || value,
+                .seen_else = false
+            };
+            depth++;
+        }
+        else if (strcmp(name, "elif")==0) {
+            if (depth == 0 || conds[depth-1].seen_else) ERRO(EXIT_FAILURE, "Unexpected `#elif`");
+            Conditional* cond = &conds[depth-1];
+            cond->active = false;
+            if (!cond->taken) cond->active = cond->taken = evalIfDirective(pp, operand, end);
+        }
+        else if (strcmp(name, "else")==0) {
+            if (depth == 0 || conds[depth-1].seen_else) ERRO(EXIT_FAILURE, "Unexpected `#else`");
+            Conditional* cond = &conds[depth-1];
+            cond->active    = !cond->taken;
+            cond->taken     = true;
+            cond->seen_else = true;
+        }
+        else if (strcmp(name, "endif")==0) {
+            if (depth == 0) ERRO(EXIT_FAILURE, "Unexpected `#endif`");
+            depth--;
+        }
+        else if (!ACTIVE) {}
+        else if (strcmp(name, "define" )==0) parseDefine(pp, operand, end);
+        else if (strcmp(name, "undef"  )==0) { if (operand != end) undefMacro(pp, operand->text); }
+        else if (strcmp(name, "include")==0) includeHeader(pp, out, directive, end);
+        else if (strcmp(name, "pragma" )==0) { if (current && isText(operand, "once")) current->pragma_once = true; }
+        else if (strcmp(name, "error"  )==0) { printf("[ERRO] "); dumpFileLine(line->origin); closeTrace(); exit(EXIT_FAILURE); }
+        else if (strcmp(name, "warning")==0) { printf("[WARN] "); dumpFileLine(line->origin); }
+        else if (strcmp(name, "line")!=0 && directive != NULL) {
+            WARN("Unknown preprocessor directive `#%s`", name);
+            dumpFileLine(line->origin);
+        }
+
+        line = end;
+    }
+    if (depth) ERRO(EXIT_FAILURE, "Unterminated conditional in (%s)", tokens->origin->file_path);
+    #undef ACTIVE
+}
+
+/* Translation phase 6: `"a" "b"` becomes `"ab"` */
+static void concatStringLiterals(pToken tokens) {
+    for (pToken t = tokens; t; t = t->next) {
+        while (t->type == TOKEN_stringConst && t->next && t->next->type == TOKEN_stringConst) {
+            pToken next = t->next;
+            const size_t len = strlen(t->text);
+            char* text = allocMemory(MEM_Preprocess, len + strlen(next->text) - 1);
+            memcpy(text, t->text, len-1);
+            strcpy(text + len - 1, next->text + 1);
+            t->text = internString(text);
+            freeMemory(text);
+
+            t->next    = next->next;
+            next->next = NULL;
+            delToken(&next);
+        }
+    }
+}
+
+/* Hands everything but a trailing run of string literals, which the next line may extend, to the sink */
+static void flushToSink(pPreprocessor pp, TokenList* out) {
+    pToken* keep = &(out->head);
+    for (pToken* link = &(out->head); *link; link = &((*link)->next))
+        if ((*link)->type != TOKEN_stringConst) keep = &((*link)->next);
+    if (keep == &(out->head)) return;
+
+    pToken batch = out->head;
+    out->head = *keep;
+    *keep     = NULL;
+    if (out->head == NULL) out->tail = &(out->head);
+
+    concatStringLiterals(batch);
+    pp->sink(pp->sink_context, batch);
+}
+
+static void beginUnit(pPreprocessor pp, TokenList* out) {
+    pp->unit++;
+    clearMacros(pp);
+    defineBuiltinMacro(pp, "__QUEBEC__", "1");
+    defineBuiltinMacro(pp, "__STDC__",   "1");
+
+    if (pp->pch == NULL) return;
+    /* Behaves like `#include`-ing the header the PCH was built from, minus the frontend work */
+    pchDefineMacros(pp->pch, pp);
+    if (pp->pch->header->flags & PCH_PragmaOnce) {
+        const char* path   = pchString(pp->pch, pp->pch->header->source);
+        pHeader     header = findHeader(pp, path);
+        if (header == NULL) {
+            header = allocMemory(MEM_Preprocess, sizeof(*header));
+            *header = (struct header_s){
+                .path        = strdupMemory(MEM_Preprocess, path),
+                .lines       = NULL,
+                .tokens      = NULL,
+                .guard       = NULL,
+                .pragma_once = true,
+                .last_unit   = 0,
+                .next        = pp->headers
+            };
+            pp->headers = header;
+        }
+        header->last_unit = pp->unit;
+    }
+
+    pToken tokens = pchCodeTokens(pp->pch);
+    if (tokens) pushTokenList(out, tokens);
+}
+
+static pToken endUnit(pPreprocessor pp, TokenList* out) {
+    concatStringLiterals(out->head);
+    if (pp->sink && out->head) {
+        pp->sink(pp->sink_context, out->head);
+        *out = (TokenList){ .head=NULL, .tail=&(out->head) };
+    }
+    TRACE(TRACE_Lexer, TRACE_Info, "Preprocessor: %u header read(s), %u cache hit(s), %u guard skip(s)",
+        pp->header_reads, pp->header_hits, pp->guard_skips);
+    return out->head;
+}
+
+pToken preprocessFile(pPreprocessor pp, const pFileLine lines) {
+    EMPTY_TOKEN_LIST(out);
+    beginUnit(pp, &out);
+
+    pToken tokens = lexLines(pp, lines);
+    preprocessTokens(pp, &out, tokens, NULL);
+    delToken(&tokens);
+
+    return endUnit(pp, &out);
+}
+
+pToken preprocessHeader(pPreprocessor pp, const char* path, pHeader* header) {
+    EMPTY_TOKEN_LIST(out);
+    beginUnit(pp, &out);
+
+    *header = findHeader(pp, path);
+    if (*header == NULL) {
+        if (access(path, R_OK) != 0) return NULL;
+        *header = loadHeader(pp, path);
+    }
+    (*header)->last_unit = pp->unit;
+    preprocessTokens(pp, &out, (*header)->tokens, *header);
+
+    return endUnit(pp, &out);
+}
+
+static int compareMacroStats(const void* a, const void* b) {
+    const pMacroStats lhs = *(const pMacroStats*)a, rhs = *(const pMacroStats*)b;
+    if (lhs->tokens_out != rhs->tokens_out) return lhs->tokens_out < rhs->tokens_out ? 1 : -1;
+    return strcmp(lhs->name, rhs->name);
+}
+
+void dumpMacroStats(const pPreprocessor pp) {
+    uint count = 0;
+    for (uint i = 0; i<MACRO_BUCKETS; i++)
+        for (pMacroStats stats = pp->stats[i]; stats; stats = stats->next)
+            if (stats->expansions) count++;
+
+    pMacroStats* sorted = allocMemory(MEM_Preprocess, (count ? count : 1)*sizeof(pMacroStats));
+    count = 0;
+    for (uint i = 0; i<MACRO_BUCKETS; i++)
+        for (pMacroStats stats = pp->stats[i]; stats; stats = stats->next)
+            if (stats->expansions) sorted[count++] = stats;
+    qsort(sorted, count, sizeof(pMacroStats), compareMacroStats);
+
+    printf("==== Macro Expansions ====\n");
+    printf("  %-24s %10s %10s %10s %10s %8s\n", "Macro", "Expansions", "Cache Hits", "Tokens In", "Tokens Out", "Blow-Up");
+    for (uint i = 0; i<count; i++) {
+        const pMacroStats stats = sorted[i];
+        printf("  %-24s %10u %10u %10zu %10zu %7.1fx\n",
+            stats->name, stats->expansions, stats->cache_hits,
+            stats->tokens_in, stats->tokens_out,
+            stats->tokens_in ? (double)stats->tokens_out / stats->tokens_in : 0.0);
+    }
+    freeMemory(sorted);
+}
+
+/* Make treats whitespace, `#` and `$` specially, escaped the way `gcc -MD` does */
+static void fprintfDepPath(FILE* fp, const char* path) {
+    for (const char* c = path; *c; c++) {
+        if (*c == ' ' || *c == '\t' || *c == '#') fputc('\\', fp);
+        if (*c == '$') fputc('$', fp);
+        fputc(*c, fp);
+    }
+}
+
+bool emitDepFile(const pPreprocessor pp, const char* dep_path, const char* target,
+                 const char** sources, const uint num_sources, const char* pch_path) {
+    FILE* fp = fopen(dep_path, "w");
+    if (fp == NULL) {
+        WARN("Could not open (%s) for writing", dep_path);
+        return false;
+    }
+
+    fprintfDepPath(fp, target);
+    fputc(':', fp);
+    #define fprintfDependency(PATH) { fputs(" \\\n  ", fp); fprintfDepPath(fp, PATH); }
+    for (uint i = 0; i<num_sources; i++) fprintfDependency(sources[i]);
+    if (pch_path) fprintfDependency(pch_path);
+
+    /* Newest first in the cache, listed in the order they were first included */
+    uint num_headers = 0;
+    for (pHeader header = pp->headers; header; header = header->next) num_headers++;
+    pHeader* headers = allocMemory(MEM_Preprocess, (num_headers ? num_headers : 1)*sizeof(pHeader));
+    uint i = num_headers;
+    for (pHeader header = pp->headers; header; header = header->next) headers[--i] = header;
+    for (i = 0; i<num_headers; i++) fprintfDependency(headers[i]->path);
+    #undef fprintfDependency
+    freeMemory(headers);
+
+    fputc('\n', fp);
+    const bool ok = (ferror(fp) == 0) & (fclose(fp) == 0);
+    if (!ok) WARN("Could not write (%s)", dep_path);
+    TRACE(TRACE_Driver, TRACE_Info, "Wrote (%s) with %u source(s) and %u header(s)", dep_path, num_sources, num_headers);
+    return ok;
+}
@@ -0,0 +1,109 @@
+#ifndef QUEBEC_PREPROCESS_H
+#define QUEBEC_PREPROCESS_H
+
+#include <stdbool.h>
+
+#include "parse.h"
+
+#define MACRO_BUCKETS         256
+#define MAX_MACRO_PARAMS       64
+#define MAX_CONDITIONAL_DEPTH  64
+#define MAX_INCLUDE_DEPTH     200
+#define MAX_CACHED_EXPANSIONS  64 /* Per macro */
+#define SINK_BATCH_LINES      256 /* Source lines per batch handed to a `TokenSink` */
+
+/* Receives a translation unit's finished tokens in order, a batch at a time */
+typedef void (*TokenSink)(void* context, pToken batch);
+
+/* A memoized invocation: the fully rescanned tokens for one argument spelling */
+typedef struct expansion_s {
+    uint         hash;
+    uint         epoch;   /* Any `#define`/`#undef` since it was recorded invalidates it */
+    uint         key_len;
+    const char** key;     /* Disabled macros, then interned argument spellings, NULL-separated */
+    uint         num_tokens;
+    struct token_s* tokens;
+    struct expansion_s* next;
+} *pExpansion;
+
+/* Outlives the macro itself so counts add up across translation units */
+typedef struct macro_stats_s {
+    const char* name;
+    uint   expansions;
+    uint   cache_hits;
+    size_t tokens_in;
+    size_t tokens_out;
+    struct macro_stats_s* next;
+} *pMacroStats;
+
+typedef struct macro_s {
+    char*  name;
+    bool   function_like;
+    bool   variadic;  /* Last parameter is `__VA_ARGS__` */
+    bool   expanding; /* Set while the macro is being rescanned so it can't recurse */
+    uint   num_params;
+    char** params;
+    pToken body;
+    uint        num_cached;
+    pExpansion  cache;
+    pMacroStats stats;
+    struct macro_s* next;
+} *pMacro;
+
+/* Headers are read and lexed once per invocation, then replayed from memory
+   for every translation unit (and every re-inclusion) that asks for them. */
+typedef struct header_s {
+    char*     path;
+    pFileLine lines;
+    pToken    tokens;
+    char*     guard;       /* `#ifndef GUARD / #define GUARD ... #endif` macro, NULL if unguarded */
+    bool      pragma_once;
+    uint      last_unit;   /* Last translation unit that pulled this header in */
+    struct header_s* next;
+} *pHeader;
+
+typedef struct preprocessor_s {
+    pMacro  macros[MACRO_BUCKETS];
+    pHeader headers;
+    struct pch_s* pch; /* Starts every translation unit when set, see `pch.h` */
+    char**  include_dirs;
+    uint    num_include_dirs;
+    uint    unit;
+    uint    depth;
+    uint    jobs; /* Lexer threads, see `tokenizeLines` */
+    pLexCache lex_cache; /* When set, lines are lexed through it instead, see `tokenizeLinesCached` */
+
+    TokenSink sink; /* When set, `preprocessFile` streams its tokens here and returns `NULL` */
+    void*     sink_context;
+    uint      sink_lines;
+
+    uint    header_reads;
+    uint    header_hits;
+    uint    guard_skips;
+
+    pMacroStats  stats[MACRO_BUCKETS];
+    uint         epoch;
+    pMacro*      disabled;       /* Macros currently being rescanned */
+    uint         num_disabled, disabled_capacity;
+    bool         site_dependent; /* Set by `__LINE__`/`__FILE__`, such expansions can't be reused */
+    const char** key;            /* Scratch space for building expansion keys */
+    uint         key_capacity;
+} *pPreprocessor;
+
+pPreprocessor newPreprocessor(void);
+void          delPreprocessor(pPreprocessor* ppp);
+void          addIncludeDir  (pPreprocessor pp, const char* dir);
+void          forgetHeader   (pPreprocessor pp, const char* path); /* Re-read on its next `#include` */
+
+pMacro        defineMacro    (pPreprocessor pp, const char* name);
+void          dumpMacroStats (const pPreprocessor pp);
+
+/* Make rule for `target` on the sources, the PCH (if any) and every header
+   pulled in so far, so build systems know when to compile again */
+bool          emitDepFile    (const pPreprocessor pp, const char* dep_path, const char* target,
+                              const char** sources, const uint num_sources, const char* pch_path);
+
+pToken preprocessFile  (pPreprocessor pp, const pFileLine lines);
+pToken preprocessHeader(pPreprocessor pp, const char* path, pHeader* header);
+
+#endif /* QUEBEC_PREPROCESS_H */
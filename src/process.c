@@ -0,0 +1,69 @@
+#define _GNU_SOURCE
+#include "process.h"
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static int waitChild(const pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR) return EXIT_FAILURE;
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+static void traceCommand(char* const argv[]) {
+    if (!TRACING(TRACE_Driver, TRACE_Debug)) return;
+    char   line[1024];
+    size_t length = 0;
+    for (uint i = 0; argv[i] && length < sizeof(line); i++)
+        length += snprintf(line+length, sizeof(line)-length, i ? " %s" : "%s", argv[i]);
+    TRACE(TRACE_Driver, TRACE_Debug, "%s", line);
+}
+
+int runTool(char* const argv[]) {
+    traceCommand(argv);
+    pid_t pid;
+    const int err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (err) {
+        WARN("Could not run `%s`: %s", argv[0], strerror(err));
+        return EXIT_FAILURE;
+    }
+    return waitChild(pid);
+}
+
+int openScratchFile(const char* name, char path[SCRATCH_PATH_LENGTH]) {
+    const int fd = memfd_create(name, 0); /* No `MFD_CLOEXEC`, `qbe` and `cc` open it by path */
+    if (fd < 0) {
+        WARN("memfd_create(%s) failed: %s", name, strerror(errno));
+        return -1;
+    }
+    snprintf(path, SCRATCH_PATH_LENGTH, "/proc/self/fd/%d", fd);
+    return fd;
+}
+
+int execFile(const int fd, char* const argv[]) {
+    traceCommand(argv);
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        WARN("fork() failed: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        /* Scratch files and the image itself shouldn't leak into the program,
+           the kernel has the image open before close-on-exec runs */
+        close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+        fexecve(fd, argv, environ);
+        fprintf(stderr, "fexecve(%s) failed: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    return waitChild(pid);
+}
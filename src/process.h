@@ -0,0 +1,20 @@
+#ifndef QUEBEC_PROCESS_H
+#define QUEBEC_PROCESS_H
+
+#include "common.h"
+
+#define SCRATCH_PATH_LENGTH 32
+
+/* Runs `argv[0]` from `PATH` without a shell and waits for it. Returns its
+   exit status, or 128+N if it was killed by signal N. */
+int runTool(char* const argv[]);
+
+/* An anonymous in-memory file that child processes inherit. `path` receives
+   a `/proc/self/fd/N` name other tools can open as if it were on disk. */
+int openScratchFile(const char* name, char path[SCRATCH_PATH_LENGTH]);
+
+/* Forks, replaces the child with the executable behind `fd` and waits for
+   it. Every descriptor past stderr is closed in the child. Same return as `runTool`. */
+int execFile(const int fd, char* const argv[]);
+
+#endif /* QUEBEC_PROCESS_H */
@@ -0,0 +1,74 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "memory.h"
+
+typedef struct {
+    const char* name; /* Interned */
+    uint64_t    count;
+} ProfileEntry;
+
+struct profile_s {
+    ProfileEntry* entries; /* Sorted by name address */
+    uint          num_entries;
+};
+
+static int compareEntries(const void* a, const void* b) {
+    const char* x = ((const ProfileEntry*)a)->name;
+    const char* y = ((const ProfileEntry*)b)->name;
+    return x < y ? -1 : x > y;
+}
+
+pProfile loadProfile(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        WARN("Profile (%s) does not exist", path);
+        return NULL;
+    }
+    pProfile profile = callocMemory(MEM_Driver, 1, sizeof(*profile));
+    uint     capacity = 0, num_lines = 0;
+    char     line[512]; /* Well past the longest symbol */
+    while (fgets(line, sizeof(line), fp)) {
+        char* space = strrchr(line, ' ');
+        if (space == NULL || space == line) continue;
+        num_lines++;
+        if (profile->num_entries == capacity) {
+            capacity = capacity ? 2*capacity : 64;
+            profile->entries = reallocMemory(MEM_Driver, profile->entries, capacity * sizeof(ProfileEntry));
+        }
+        profile->entries[profile->num_entries++] = (ProfileEntry){
+            .name  = internStringN(line, space - line),
+            .count = strtoull(space+1, NULL, 10)
+        };
+    }
+    fclose(fp);
+
+    /* Runs of the same name sum into their first entry */
+    if (profile->num_entries) qsort(profile->entries, profile->num_entries, sizeof(ProfileEntry), compareEntries);
+    uint kept = 0;
+    for (uint i = 0; i<profile->num_entries; i++) {
+        if (kept && profile->entries[kept-1].name == profile->entries[i].name) profile->entries[kept-1].count += profile->entries[i].count;
+        else                                                                   profile->entries[kept++] = profile->entries[i];
+    }
+    profile->num_entries = kept;
+    TRACE(TRACE_Driver, TRACE_Info, "Profile (%s): %u counter(s) over %u line(s)", path, kept, num_lines);
+    return profile;
+}
+
+void delProfile(pProfile* profile) {
+    if (profile == NULL || *profile == NULL) return;
+    freeMemory((*profile)->entries);
+    freeMemory(*profile);
+    *profile = NULL;
+}
+
+uint64_t profileCount(const pProfile profile, const char* name) {
+    if (profile == NULL || profile->num_entries == 0) return 0;
+    const ProfileEntry  key   = { .name = name };
+    const ProfileEntry* found = bsearch(&key, profile->entries, profile->num_entries, sizeof(ProfileEntry), compareEntries);
+    return found ? found->count : 0;
+}
@@ -0,0 +1,20 @@
+#ifndef QUEBEC_PROFILE_H
+#define QUEBEC_PROFILE_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define PROFILE_ENV     "QUEBEC_PROFILE" /* Where an `--instrument`ed program writes its counts */
+#define PROFILE_DEFAULT "quebec.profile" /* ...when that isn't set */
+
+/* Counts an instrumented program wrote at exit, one `<name> <count>` line per
+   counter. A function's counter is its symbol, a block's is `<symbol>@<label>`.
+   Programs append, so the same name on several lines (several runs) adds up. */
+typedef struct profile_s* pProfile;
+
+pProfile loadProfile (const char* path); /* NULL if it can't be read */
+void     delProfile  (pProfile* profile);
+uint64_t profileCount(const pProfile profile, const char* name); /* `name` interned, 0 if it never ran */
+
+#endif /* QUEBEC_PROFILE_H */
@@ -1,23 +1,18 @@
 #include "qbe.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
 
-#include "flags.h"
 #include "token_types.h"
-
-static enum QbeType getQbeType(const enum TokenType type) {
-    switch (type) {
-        // case TOKEN_char  : return QBE_Byte;
-        case TOKEN_char  : return QBE_Word;
-        case TOKEN_int   : return QBE_Word;
-        case TOKEN_long  : return QBE_Long;
-        case TOKEN_float : return QBE_Single;
-        case TOKEN_double: return QBE_Double;
-        default: break;
-    }
-    return QBE_Word;
-}
+#include "ctypes.h"
+#include "intern.h"
+#include "memory.h"
+#include "pool.h"
 
 enum GrammarUnit {
     GU_Invalid=0,
@@ -47,9 +42,20 @@ enum GrammarUnit {
     GU_Expression,
 
     GU_Qbe_Call,
+
+    GU_Switch_Stmt,
+    GU_Case_Label, /* `case` or `default`, and the statement after them */
+    GU_Break_Stmt,
+
+    /* Only seen while predicting, never the outcome of a prediction */
+    GU_Pending_Type,  /* A type, declaration if an identifier follows */
+    GU_Pending_Ident, /* An identifier, call if `(` follows */
+    GU_Pending_Value, /* An `=` in a definition, a value must follow */
+    GU_Missing_Value,
+GU_LENGTH
 };
 
-static const char* strGrammarUnit[] = {
+__attribute_maybe_unused__ static const char* strGrammarUnit[] = {
     "Invalid",
     "AdjChain",
     "DeclChain",
@@ -71,123 +77,2001 @@ static const char* strGrammarUnit[] = {
     "ExprOrCall",
     "FunCall",
     "Expression",
-    "QbeCall"
+    "QbeCall",
+
+    "SwitchStmt",
+    "CaseLabel",
+    "BreakStmt",
+
+    "PendingType",
+    "PendingIdent",
+    "PendingValue",
+    "MissingValue",
 };
 
-static enum GrammarUnit predictGrammar(const enum GrammarUnit gu, const pToken lhs, const pToken rhs) {
-    const enum TokenType lht = lhs->type, rht = rhs ? rhs->type : TOKEN_invalid;
-
-    /* Start building a chain or no chain necessary */
-    if (gu==GU_Invalid) {
-        if (strcmp(lhs->text, "{")==0)       return GU_New_Scope;
-        if (strcmp(lhs->text, "}")==0)       return GU_End_Scope;
-        if (strcmp(lhs->text, "(")==0)       return GU_New_Args;
-        if (strcmp(lhs->text, ")")==0)       return GU_End_Args;
-        if (strcmp(lhs->text, "[")==0)       return GU_New_Index;
-        if (strcmp(lhs->text, "]")==0)       return GU_End_Index;
-        if (strcmp(lhs->text, "__qbe__")==0) return GU_Qbe_Call;
-        if (isConst(lhs->type))              return GU_Expression;
-
-        if (lht == TOKEN_return)             return GU_Ret_Stmt;
-        if (lht == TOKEN_identifier) {
-            if (strcmp(rhs->text, "(")==0)   return GU_Fun_Call;
-            return GU_Expr_Or_Call;
-        }
-        if (isAdjective(lht)) return GU_Adjective_Chain;
-        if (rhs) {
-            if (isAdjective(lht)) {
-                if (isAdjective(rht))  return GU_Adjective_Chain;
-                if (isIdentifier(rht)) return GU_Decl_Chain;
-            }
-            if (isType(lht)) {
-                if (isIdentifier(rht)) return GU_Decl_Chain;
-            }
+/* Prediction only cares about which of these a token is */
+enum TokenClass {
+    TC_Other=0,
+    TC_Type,
+    TC_Adjective,
+    TC_Const,
+    TC_Identifier,
+    TC_Return,
+    TC_Qbe,
+    TC_Switch,
+    TC_Case,
+    TC_Break,
+    TC_New_Scope, TC_End_Scope,
+    TC_New_Args,  TC_End_Args,
+    TC_New_Index, TC_End_Index,
+    TC_Star,
+    TC_Semicolon,
+    TC_Equals,
+    TC_Assign, /* Compound assignments, `+=` etc. */
+TC_LENGTH
+};
+
+static const unsigned char tokenTypeClass[NUM_TOKEN_TYPES] = {
+    [TOKEN_char]     = TC_Type,      [TOKEN_double]   = TC_Type,
+    [TOKEN_float]    = TC_Type,      [TOKEN_int]      = TC_Type,
+    [TOKEN_long]     = TC_Type,      [TOKEN_short]    = TC_Type,
+    [TOKEN_void]     = TC_Type,
+
+    [TOKEN_const]    = TC_Adjective, [TOKEN_enum]     = TC_Adjective,
+    [TOKEN_extern]   = TC_Adjective, [TOKEN_inline]   = TC_Adjective,
+    [TOKEN_register] = TC_Adjective, [TOKEN_signed]   = TC_Adjective,
+    [TOKEN_static]   = TC_Adjective, [TOKEN_struct]   = TC_Adjective,
+    [TOKEN_union]    = TC_Adjective, [TOKEN_unsigned] = TC_Adjective,
+    [TOKEN_volatile] = TC_Adjective,
+
+    [TOKEN_hexConst]    = TC_Const,  [TOKEN_intConst]    = TC_Const,
+    [TOKEN_floatConst]  = TC_Const,  [TOKEN_doubleConst] = TC_Const,
+    [TOKEN_charConst]   = TC_Const,  [TOKEN_stringConst] = TC_Const,
+
+    [TOKEN_identifier] = TC_Identifier,
+    [TOKEN_return]     = TC_Return,
+    [TOKEN_qbe]        = TC_Qbe,
+    [TOKEN_switch]     = TC_Switch,
+    [TOKEN_case]       = TC_Case,    [TOKEN_default]  = TC_Case,
+    [TOKEN_break]      = TC_Break,
+};
+
+static enum TokenClass classifyToken(const pToken token) {
+    if (token->type != TOKEN_operator) return tokenTypeClass[token->type];
+
+    const char* s = token->text;
+    if (s[1] == 0) switch (s[0]) {
+        case '{': return TC_New_Scope;
+        case '}': return TC_End_Scope;
+        case '(': return TC_New_Args;
+        case ')': return TC_End_Args;
+        case '[': return TC_New_Index;
+        case ']': return TC_End_Index;
+        case '*': return TC_Star;
+        case ';': return TC_Semicolon;
+        case '=': return TC_Equals;
+        default:  return TC_Other;
+    }
+    if (s[1] == '=' && s[2] == 0) switch (s[0]) {
+        case '+': case '-': case '*': case '/':
+        case '%': case '|': case '&': case '^': return TC_Assign;
+        default: return TC_Other;
+    }
+    if ((s[0]=='<' || s[0]=='>') && s[1]==s[0] && s[2]=='=' && s[3]==0) return TC_Assign;
+    return TC_Other;
+}
+
+/* The grammar, one token at a time. States without rules keep their unit for
+   the rest of the node. `TC_Any` fills a state's row before the more specific
+   rules for it, `GU_Restart` treats the token as the start of a new chain. */
+#define TC_Any     TC_LENGTH
+#define GU_Restart GU_LENGTH
+static const struct { enum GrammarUnit from; enum TokenClass on; enum GrammarUnit to; } grammarRules[] = {
+    { GU_Invalid,         TC_Any,        GU_Invalid         },
+    { GU_Invalid,         TC_New_Scope,  GU_New_Scope       },
+    { GU_Invalid,         TC_End_Scope,  GU_End_Scope       },
+    { GU_Invalid,         TC_New_Args,   GU_New_Args        },
+    { GU_Invalid,         TC_End_Args,   GU_End_Args        },
+    { GU_Invalid,         TC_New_Index,  GU_New_Index       },
+    { GU_Invalid,         TC_End_Index,  GU_End_Index       },
+    { GU_Invalid,         TC_Qbe,        GU_Qbe_Call        },
+    { GU_Invalid,         TC_Const,      GU_Expression      },
+    { GU_Invalid,         TC_Return,     GU_Ret_Stmt        },
+    { GU_Invalid,         TC_Switch,     GU_Switch_Stmt     },
+    { GU_Invalid,         TC_Case,       GU_Case_Label      },
+    { GU_Invalid,         TC_Break,      GU_Break_Stmt      },
+    { GU_Invalid,         TC_Identifier, GU_Pending_Ident   },
+    { GU_Invalid,         TC_Star,       GU_Expression      }, /* `*p = ...` */
+    { GU_Invalid,         TC_Adjective,  GU_Adjective_Chain },
+    { GU_Invalid,         TC_Type,       GU_Pending_Type    },
+
+    { GU_Pending_Ident,   TC_Any,        GU_Expr_Or_Call    },
+    { GU_Pending_Ident,   TC_New_Args,   GU_Fun_Call        },
+
+    { GU_Pending_Type,    TC_Any,        GU_Restart         },
+    { GU_Pending_Type,    TC_Identifier, GU_Decl_Chain      },
+    { GU_Pending_Type,    TC_Star,       GU_Pending_Type    },
+
+    { GU_Adjective_Chain, TC_Any,        GU_Restart         },
+    { GU_Adjective_Chain, TC_Adjective,  GU_Adjective_Chain },
+    { GU_Adjective_Chain, TC_Type,       GU_Decl_Chain      },
+    { GU_Adjective_Chain, TC_Identifier, GU_Decl_Chain      },
+    { GU_Adjective_Chain, TC_Star,       GU_Adjective_Chain },
+
+    { GU_Decl_Chain,      TC_New_Args,   GU_Fun_Decl        },
+    { GU_Decl_Chain,      TC_Semicolon,  GU_Var_Decl        },
+    { GU_Decl_Chain,      TC_Equals,     GU_Pending_Value   },
+    { GU_Decl_Chain,      TC_Assign,     GU_Var_Defn        },
+
+    { GU_Var_Defn,        TC_Equals,     GU_Pending_Value   },
+    { GU_Pending_Value,   TC_Any,        GU_Var_Defn        },
+    { GU_Pending_Value,   TC_Equals,     GU_Pending_Value   },
+    { GU_Pending_Value,   TC_Semicolon,  GU_Missing_Value   },
+
+    { GU_Expr_Or_Call,    TC_Any,        GU_Expression      },
+    { GU_Expr_Or_Call,    TC_New_Args,   GU_Fun_Call        },
+};
+
+static unsigned char global_GrammarTable[GU_LENGTH][TC_LENGTH];
+static bool          global_GrammarDecided[GU_LENGTH]; /* No token can leave the state */
+
+__attribute__((constructor)) static void buildGrammarTable(void) {
+    for (enum GrammarUnit gu = 0; gu<GU_LENGTH; gu++)
+        for (enum TokenClass tc = 0; tc<TC_LENGTH; tc++)
+            global_GrammarTable[gu][tc] = gu;
+
+    for (size_t r = 0; r<sizeof(grammarRules)/sizeof(grammarRules[0]); r++) {
+        const enum GrammarUnit from = grammarRules[r].from, to = grammarRules[r].to;
+        for (enum TokenClass tc = 0; tc<TC_LENGTH; tc++) {
+            if (grammarRules[r].on != TC_Any && grammarRules[r].on != tc) continue;
+            global_GrammarTable[from][tc] = to == GU_Restart ? global_GrammarTable[GU_Invalid][tc] : to;
         }
+    }
 
-        return GU_Invalid;
+    for (enum GrammarUnit gu = 0; gu<GU_LENGTH; gu++) {
+        global_GrammarDecided[gu] = true;
+        for (enum TokenClass tc = 0; tc<TC_LENGTH; tc++)
+            if (global_GrammarTable[gu][tc] != gu) global_GrammarDecided[gu] = false;
     }
-    if (rhs == NULL) return gu;
+}
+#undef TC_Any
+#undef GU_Restart
+
+static enum GrammarUnit predictGrammarTokens(const pToken tokens) {
+    if (tokens==NULL) return GU_Invalid;
+
+    enum GrammarUnit gu = GU_Invalid;
+    for (pToken token = tokens; token && !global_GrammarDecided[gu]; token = token->next)
+        gu = global_GrammarTable[gu][classifyToken(token)];
 
-    /* Chain must exist to proceed */
     switch (gu) {
         default: break;
+        case GU_Pending_Type:  gu = GU_Invalid;      break;
+        case GU_Pending_Ident: gu = GU_Expr_Or_Call; break;
+        case GU_Pending_Value: gu = GU_Var_Defn;     break;
+        case GU_Missing_Value: ERRO(EXIT_FAILURE, "No value provided for variable declaration!");
+    }
+    TRACE(TRACE_Grammar, TRACE_Dump, "%s:%u:%u: %s",
+        tokens->origin->file_path, tokens->origin->line_num, tokens->offset, strGrammarUnit[gu]);
+    return gu;
+}
 
-        case GU_Adjective_Chain:
-            if (isAdjective(rht))          return GU_Adjective_Chain;
-            if (isType(rht))               return GU_Decl_Chain;
-            if (isIdentifier(rht))         return GU_Decl_Chain;
-            if (strcmp(rhs->text, "*")==0) return GU_Adjective_Chain;
-            return GU_Invalid;
-
-        case GU_Decl_Chain:
-            if (strcmp(rhs->text, "*")==0) return GU_Decl_Chain;
-            if (strcmp(rhs->text, "(")==0) return GU_Fun_Decl;
-            if (strcmp(rhs->text, "[")==0) return GU_Decl_Chain;
-            if (strcmp(rhs->text, ";")==0) return GU_Var_Decl;
-            if (isAssignmentOperator(rhs->text)) return GU_Var_Defn;
-            return GU_Decl_Chain;
+typedef struct {
+    char*  text;
+    size_t length, capacity;
+} Buffer, *pBuffer;
 
-        case GU_Var_Defn:
-            if (strcmp(lhs->text, "=")==0 && strcmp(rhs->text, ";")==0)
-                ERRO(EXIT_FAILURE, "No value provided for variable declaration!");
-            return GU_Var_Defn;
+__attribute__((format(printf, 2, 3)))
+static void appendBuffer(pBuffer buffer, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const int length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
 
-        case GU_Expr_Or_Call:
-            if (isAssignmentOperator(rhs->text)) return GU_Expression;
-            if (strcmp(rhs->text, "(")==0)       return GU_Fun_Call;
-            return GU_Expression;
+    if (buffer->length + length + 1 > buffer->capacity) {
+        buffer->capacity = 2*(buffer->length + length + 1);
+        if (buffer->capacity < 512) buffer->capacity = 512;
+        buffer->text = reallocMemory(MEM_Codegen, buffer->text, buffer->capacity);
     }
+    va_start(args, fmt);
+    vsnprintf(buffer->text + buffer->length, length + 1, fmt, args);
+    va_end(args);
+    buffer->length += length;
+}
 
-    return gu;
+/* `text` spliced in at `at`, what was there moves along */
+static void insertBuffer(pBuffer buffer, const size_t at, const char* text) {
+    const size_t length = strlen(text), moved = buffer->length - at;
+    appendBuffer(buffer, "%s", text); /* Only for the room */
+    memmove(buffer->text + at + length, buffer->text + at, moved);
+    memcpy(buffer->text + at, text, length);
 }
 
-static enum GrammarUnit predictGrammarTokens(FILE* fp, const pToken tokens) {
-    pToken lhs = tokens;
-    if (lhs==NULL) return GU_Invalid;
-    if (global_VERBOSE) dumpFileLine(lhs->origin);
+typedef struct variable_s {
+    const char* name;   /* Interned */
+    CType       type;
+    const char* symbol; /* Lives in data at `$<symbol>` if set, otherwise `%<name>` holds its value (or address for arrays) */
+} Variable;
+
+typedef struct function_s {
+    const char* name;   /* Interned */
+    CType       ret;
+    Variable*   params; /* Unnamed ones have a NULL name */
+    uint        num_params;
+    bool        variadic;
+} Function;
+
+struct code_file_s {
+    FILE*  fp;
+    char*  path;
+    uint   num_jobs;
+    Buffer data;           /* Every unit's data so far, written when the file is closed */
+    uint   unit;           /* Translation unit of a `--unity` module, 0 otherwise */
+    const char** statics;  /* Its file-`static` functions and variables, interned and sorted by address */
+    uint   num_statics, statics_capacity;
+    Variable* globals;     /* Its file-scope variables, sorted the same way */
+    uint   num_globals, globals_capacity;
+    Function* functions;   /* Its function prototypes and definitions, sorted the same way */
+    uint   num_functions, functions_capacity;
+    pAggregate aggregates; /* Its `struct`s and `union`s, latest first */
+    CodeOptions options;
+    Buffer counters;       /* `l $<record>, ` for each counter of every unit */
+    struct held_job_s* held; /* Output kept back to be sorted by `profile` */
+    uint   num_held, held_capacity;
+};
 
-    pToken rhs = tokens->next;
-    enum GrammarUnit possible_grammar = GU_Invalid;
-    while (rhs) {
-        possible_grammar = predictGrammar(possible_grammar, lhs, rhs);
-        
-        if (global_VERBOSE) printf("[DEBG] Prediction: %s [%s] vs [%s]\n", strGrammarUnit[possible_grammar], lhs->text, rhs->text);
+static int compareNames(const void* a, const void* b) {
+    const uintptr_t lhs = (uintptr_t)*(const char* const*)a, rhs = (uintptr_t)*(const char* const*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
 
-        lhs = rhs;
-        rhs = rhs->next;
+/* Into an array kept sorted by each element's leading name, false if the name is in there already */
+static bool insertName(void* array, uint* num, uint* capacity, const size_t size, const void* element) {
+    char** elements = array;
+    if (*num && bsearch(element, *elements, *num, size, compareNames)) return false;
+    if (*num == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 16;
+        *elements = reallocMemory(MEM_Codegen, *elements, *capacity * size);
     }
-    possible_grammar = predictGrammar(possible_grammar, lhs, NULL);
-    if (global_VERBOSE) printf("[DEBG] Final Prediction: %s [%s]\n\n", strGrammarUnit[possible_grammar], lhs->text);
-    return possible_grammar;
+    uint at = (*num)++;
+    while (at && compareNames(*elements + (at-1)*size, element) > 0) {
+        memcpy(*elements + at*size, *elements + (at-1)*size, size);
+        at--;
+    }
+    memcpy(*elements + at*size, element, size);
+    return true;
 }
 
-#define DATA_BLOCK_LENGTH 512
-typedef char Block[DATA_BLOCK_LENGTH];
+/* File-`static` functions and variables of different units can share a name
+   once they're in one module, so each unit's get a `.<unit>` suffix. Symbols
+   never clash with C names, QBE and the assembler both allow the `.` */
+static const char* symbolName(const struct code_file_s* file, const char* name, char buffer[SYMBOL_LENGTH]) {
+    if (file->num_statics == 0 || !bsearch(&name, file->statics, file->num_statics, sizeof(char*), compareNames))
+        return name;
+    snprintf(buffer, SYMBOL_LENGTH, "%s.%u", name, file->unit);
+    return buffer;
+}
 
-static uint global_ConstCounter = 0;
-static void compileInlineQbe(FILE* fp, const pToken tokens, const enum GrammarUnit grammar, Block data_seg) {
-    /* First pass to pull out data segment constants */
+/* One top-level function (or declaration) and everything it writes, so
+   jobs share no state and can be compiled on any thread in any order */
+typedef struct codegen_s {
+    const struct code_file_s* file;
+    uint      job;            /* Namespaces the job's data symbols */
+    NodeId    first, end;     /* Nodes `first` up to, but not including, `end` */
+    Buffer    text;
+    Buffer    data;           /* Data definitions, written after every function */
+    pFileLine last_line;      /* Lines can repeat or go backwards through `#include`s */
+    uint      const_counter;
+    CType     ret_type;
+    pToken    resume;         /* Nodes starting before it belong to a statement already compiled */
+    bool      at_top_level;
+    Variable* locals;         /* Of the function so far */
+    uint      num_locals, locals_capacity;
+    uint      num_temps;
+    Function  function;       /* Being compiled */
+    Buffer    allocs;         /* Its stack slots, kept for its start block */
+    size_t    body_offset;    /* Where in `text` its start block ends */
+    bool      tail_loop;      /* It jumps back to `@body` */
+    bool      tail_call;      /* The next call is in tail position */
+    pToken    tokens_end;     /* Of the tree, so statements can look past their end */
+    uint      num_counters;
+    Buffer    counters;       /* See `code_file_s` */
+    const char* debug_file;   /* Of the function being compiled with `debug_lines`, only its own lines get a `dbgloc` */
+    uint      depth;          /* Of the `{}`s open in the function */
+    bool      terminated;     /* By a `ret` or `jmp`, so the next instruction needs a label first */
+    uint      num_blocks;     /* Labels made up for the function so far */
+    struct switch_s* switches; /* Open ones, innermost last */
+    uint      num_switches, switches_capacity;
+} *pCodegen;
 
-    pToken temp = tokens->next; /* Skip the `__qbe__` keyword */
-    pToken builtin = tokens->next;
-    uint   fmt_id  = 0;
-    while (temp) {
-        if (temp->type == TOKEN_stringConst) {
-            if (!fmt_id) fmt_id = global_ConstCounter; /* Only the first one could be a `printf` format string */
-            char buf[64] = {0};
-            sprintf(buf, "data $s_const_%u = { b %s, b 0 }\n", global_ConstCounter++, temp->text);
-            strncat(data_seg, buf, 64);
+static void addLocal(pCodegen cg, const char* name, const CType type, const char* symbol) {
+    if (cg->num_locals == cg->locals_capacity) {
+        cg->locals_capacity = cg->locals_capacity ? 2*cg->locals_capacity : 16;
+        cg->locals = reallocMemory(MEM_Codegen, cg->locals, cg->locals_capacity * sizeof(Variable));
+    }
+    cg->locals[cg->num_locals++] = (Variable){ .name = name, .type = type, .symbol = symbol };
+}
+
+/* Innermost first: locals, then the file's globals */
+static const Variable* findVariable(const pCodegen cg, const pToken identifier) {
+    for (uint i = cg->num_locals; i>0; i--)
+        if (cg->locals[i-1].name == identifier->text) return &(cg->locals[i-1]);
+    const Variable* global = cg->file->num_globals == 0 ? NULL :
+        bsearch(&(identifier->text), cg->file->globals, cg->file->num_globals, sizeof(Variable), compareNames);
+    if (global) return global;
+    ERRO(EXIT_FAILURE, "%s:%u: `%s` is not declared",
+        identifier->origin->file_path, identifier->origin->line_num, identifier->text);
+}
+
+static const Function* findFunction(const struct code_file_s* file, const char* name) {
+    return file->num_functions == 0 ? NULL : bsearch(&name, file->functions, file->num_functions, sizeof(Function), compareNames);
+}
+
+/* `$<symbol>` for variables in data, `%<name>` for the rest */
+static const char* variableValue(const pCodegen cg, const Variable* variable, char value[SYMBOL_LENGTH]) {
+    char symbol[SYMBOL_LENGTH];
+    if (variable->symbol) snprintf(value, SYMBOL_LENGTH, "$%s", symbolName(cg->file, variable->symbol, symbol));
+    else                  snprintf(value, SYMBOL_LENGTH, "%%%s", variable->name);
+    return value;
+}
+
+/* `.` can't appear in C names, so these never clash with a local */
+static const char* newTemp(pCodegen cg, char temp[SYMBOL_LENGTH]) {
+    snprintf(temp, SYMBOL_LENGTH, "%%.%u", ++cg->num_temps);
+    return temp;
+}
+
+/* Integers, or `s_`/`d_` floating point */
+static bool isConstValue(const char* value) {
+    return value[0] == '-' || (value[0] >= '0' && value[0] <= '9') || ((value[0] == 's' || value[0] == 'd') && value[1] == '_');
+}
+
+/* `value` as a `to`. Into `dest` when given, otherwise into a new temporary
+   if that takes an instruction at all. */
+static const char* convertValue(pCodegen cg, const char* value, CType from, const CType to, const char* dest, char out[SYMBOL_LENGTH]) {
+    if (isConstValue(value)) {
+        const bool floating = value[1] == '_';
+        if (isIntegerCType(to)) {
+            const int64_t constant = floating ? (int64_t)strtod(value+2, NULL) : strtoll(value, NULL, 10);
+            snprintf(out, SYMBOL_LENGTH, "%ld", (long)foldCType(to, constant));
+        } else {
+            const double constant = floating ? strtod(value+2, NULL) : (double)strtoll(value, NULL, 10);
+            const enum QbeType base = qbeBaseType(to);
+            snprintf(out, SYMBOL_LENGTH, "%s_%.*g", qbeType2str[base], base == QBE_Single ? 9 : 17, constant);
+        }
+        value = out;
+    }
+    const char* instr = isConstValue(value) ? NULL : convertInstr(to, from);
+
+    /* Floating point goes to a full integer first, narrowing is a second step */
+    if (instr && !isIntegerCType(from) && isIntegerCType(to) && sizeofCType(to) < 4) {
+        const CType mid = { .kind = CT_Int, .is_unsigned = to.is_unsigned };
+        appendBuffer(&cg->text, "\t%s =w %s %s\n", newTemp(cg, out), instr, value);
+        value = out;
+        from  = mid;
+        instr = convertInstr(to, from);
+    }
+
+    if (dest) {
+        appendBuffer(&cg->text, "\t%s =%s %s %s\n", dest, qbeType2str[qbeBaseType(to)], instr ? instr : "copy", value);
+        return dest;
+    }
+    if (instr == NULL) return value;
+    char temp[SYMBOL_LENGTH];
+    appendBuffer(&cg->text, "\t%s =%s %s %s\n", newTemp(cg, temp), qbeType2str[qbeBaseType(to)], instr, value);
+    return strcpy(out, temp);
+}
+
+/* `base` plus a constant, the `add` is only emitted when it isn't 0 */
+static const char* offsetAddress(pCodegen cg, const char* base, const int64_t offset, char out[SYMBOL_LENGTH]) {
+    if (offset == 0) return strcpy(out, base);
+    char temp[SYMBOL_LENGTH];
+    appendBuffer(&cg->text, "\t%s =l add %s, %ld\n", newTemp(cg, temp), base, (long)offset);
+    return strcpy(out, temp);
+}
+
+/* The widest integer that fits between `offset` and `end` without breaking `align` */
+static CType pieceCType(const uint offset, const uint end, const uint align) {
+    uint size = 8;
+    while (size > 1 && (size > align || offset % size || offset + size > end)) size /= 2;
+    return CTYPE(size == 8 ? CT_Long : size == 4 ? CT_Int : size == 2 ? CT_Short : CT_Char);
+}
+
+/* `size` bytes from `source` to `dest`, which don't overlap */
+static void copyMemory(pCodegen cg, const char* dest, const char* source, const uint size, const uint align) {
+    for (uint offset = 0; offset<size; ) {
+        const CType piece = pieceCType(offset, size, align);
+        char from[SYMBOL_LENGTH], to[SYMBOL_LENGTH], temp[SYMBOL_LENGTH];
+        offsetAddress(cg, source, offset, from);
+        appendBuffer(&cg->text, "\t%s =%s %s %s\n", newTemp(cg, temp), qbeType2str[qbeBaseType(piece)], loadInstr(piece), from);
+        appendBuffer(&cg->text, "\tstore%s %s, %s\n", qbeType2str[qbeMemoryType(piece)], temp, offsetAddress(cg, dest, offset, to));
+        offset += sizeofCType(piece);
+    }
+}
+
+/* Bytes `from` up to `to` past `dest` set to `byte`, either a constant or a
+   `l` holding the byte in each of its 8 */
+static void fillMemory(pCodegen cg, const char* dest, const uint from, const uint to, const uint align, const char* byte) {
+    const bool constant = isConstValue(byte);
+    const uint64_t pattern = (uint8_t)strtol(byte, NULL, 10) * UINT64_C(0x0101010101010101);
+    for (uint offset = from; offset<to; ) {
+        const CType piece = pieceCType(offset, to, align);
+        const uint  size  = sizeofCType(piece);
+        char fill[SYMBOL_LENGTH], address[SYMBOL_LENGTH];
+        if (constant) snprintf(fill, SYMBOL_LENGTH, "%ld", (long)foldCType(piece, (int64_t)pattern));
+        else          strcpy(fill, byte);
+        appendBuffer(&cg->text, "\tstore%s %s, %s\n", qbeType2str[qbeMemoryType(piece)], fill, offsetAddress(cg, dest, offset, address));
+        offset += size;
+    }
+}
+
+/* Bytes `from` up to `to` past `dest`, longer runs are left to `memset` */
+static void zeroMemory(pCodegen cg, const char* dest, const uint from, const uint to, const uint align) {
+    char address[SYMBOL_LENGTH];
+    if (to - from > 128) {
+        appendBuffer(&cg->text, "\tcall $memset(l %s, w 0, l %u)\n", offsetAddress(cg, dest, from, address), to - from);
+        return;
+    }
+    fillMemory(cg, dest, from, to, align, "0");
+}
+
+static long charConstValue(const char* text) {
+    if (text[1] != '\\') return (unsigned char)text[1];
+    switch (text[2]) {
+        case 'n' : return '\n';
+        case 't' : return '\t';
+        case 'r' : return '\r';
+        case '0' : return '\0';
+        default  : return (unsigned char)text[2];
+    }
+}
+
+/* Bytes a string literal stands for, its quotes and terminator aside */
+static uint stringLength(const char* text) {
+    uint length = 0;
+    for (const char* c = text+1; *c && *c != '"'; c++, length++) {
+        if (*c != '\\') continue;
+        c++;
+        if (*c == 'x') while (strchr("0123456789abcdefABCDEF", c[1]) && c[1]) c++;
+        else if (*c >= '0' && *c <= '7') for (uint i = 0; i<2 && c[1] >= '0' && c[1] <= '7'; i++) c++;
+    }
+    return length;
+}
+
+static bool isToken(const pToken token, const pToken end, const char* text) {
+    return token < end && token->type == TOKEN_operator && strcmp(token->text, text)==0;
+}
+
+/* The `)`, `]` or `}` closing the bracket at `open` */
+static pToken matchingBracket(const pToken open, const pToken end) {
+    uint depth = 0;
+    for (pToken at = open; at<end; at++) {
+        if (at->type != TOKEN_operator || at->text[1] != 0) continue;
+        if (strchr("([{", at->text[0])) depth++;
+        if (strchr(")]}", at->text[0]) && --depth == 0) return at;
+    }
+    ERRO(EXIT_FAILURE, "%s:%u: Unbalanced `%s`", open->origin->file_path, open->origin->line_num, open->text);
+}
+
+/* The `,` after the argument at `arg`, or `close` for the last one */
+static pToken argumentEnd(pToken arg, const pToken close) {
+    while (arg < close && !isToken(arg, close, ",")) {
+        if (isToken(arg, close, "(") || isToken(arg, close, "[")) arg = matchingBracket(arg, close);
+        arg++;
+    }
+    return arg;
+}
+
+static int binaryPrecedence(const char* op) {
+    static const struct { const char* op; int precedence; } operators[] = {
+        { "*",  10 }, { "/",  10 }, { "%", 10 },
+        { "+",   9 }, { "-",   9 },
+        { "<<",  8 }, { ">>",  8 },
+        { "<",   7 }, { "<=",  7 }, { ">", 7 }, { ">=", 7 },
+        { "==",  6 }, { "!=",  6 },
+        { "&",   5 }, { "^",   4 }, { "|", 3 },
+        { "&&",  2 }, { "||",  1 },
+    };
+    for (size_t i = 0; i<sizeof(operators)/sizeof(operators[0]); i++)
+        if (strcmp(op, operators[i].op)==0) return operators[i].precedence;
+    return 0;
+}
+
+static bool foldConstant(const struct code_file_s* file, pToken* at, const pToken end, int64_t* value, const int min_precedence);
+
+static bool foldPrimary(const struct code_file_s* file, pToken* at, const pToken end, int64_t* value) {
+    const pToken token = *at;
+    if (token >= end) return false;
+    *at = token+1;
+    switch (token->type) {
+        default: return false;
+        case TOKEN_intConst : *value = strtoll(token->text, NULL, 10); return true;
+        case TOKEN_hexConst : *value = strtoll(token->text, NULL, 16); return true;
+        case TOKEN_charConst: *value = charConstValue(token->text);   return true;
+        case TOKEN_sizeof: {
+            if (!isToken(*at, end, "(") || token+2 >= end || !(isType(token[2].type) || isAdjective(token[2].type))) return false;
+            const pToken close = matchingBracket(*at, end);
+            *value = sizeofCType(parseCType(token+2, NULL, file->aggregates));
+            *at    = close+1;
+            return true;
+        }
+        case TOKEN_operator: break;
+    }
+    if (strcmp(token->text, "(")==0) {
+        if (!foldConstant(file, at, end, value, 1) || !isToken(*at, end, ")")) return false;
+        (*at)++;
+        return true;
+    }
+    if (!foldPrimary(file, at, end, value)) return false;
+    switch (token->text[1] ? 0 : token->text[0]) {
+        case '-': *value = -*value; return true;
+        case '+':                   return true;
+        case '~': *value = ~*value; return true;
+        case '!': *value = !*value; return true;
+        default: break;
+    }
+    return false;
+}
+
+/* Integer constant expressions, like array lengths and what `data` starts
+   out as. Leaves `*at` after it, false if any of it isn't constant. */
+static bool foldConstant(const struct code_file_s* file, pToken* at, const pToken end, int64_t* value, const int min_precedence) {
+    if (!foldPrimary(file, at, end, value)) return false;
+    for (;;) {
+        /* The lexer keeps the `-1` of `x -1` as one constant, which adds just the same */
+        const bool glued = *at < end && (*at)->type == TOKEN_intConst && (*at)->text[0] == '-';
+        const int  precedence = glued ? binaryPrecedence("+") : *at < end && (*at)->type == TOKEN_operator ? binaryPrecedence((*at)->text) : 0;
+        if (precedence == 0 || precedence < min_precedence) break;
+        const char* op = glued ? "+" : (*at)->text;
+        int64_t rhs;
+        if (!glued) (*at)++;
+        if (!foldConstant(file, at, end, &rhs, precedence+1)) return false;
+        switch (op[0]) {
+            case '*': *value *= rhs; break;
+            case '/': if (rhs == 0) return false; *value /= rhs; break;
+            case '%': if (rhs == 0) return false; *value %= rhs; break;
+            case '+': *value += rhs; break;
+            case '-': *value -= rhs; break;
+            case '^': *value ^= rhs; break;
+            case '=': *value = *value == rhs; break;
+            case '!': *value = *value != rhs; break;
+            case '&': *value = op[1] ? (*value && rhs) : (*value & rhs); break;
+            case '|': *value = op[1] ? (*value || rhs) : (*value | rhs); break;
+            case '<': *value = op[1] == '<' ? (int64_t)((uint64_t)*value << rhs) : op[1] ? *value <= rhs : *value < rhs; break;
+            case '>': *value = op[1] == '>' ? *value >> rhs : op[1] ? *value >= rhs : *value > rhs; break;
+        }
+    }
+    return true;
+}
+
+static const char* compileOperand(pCodegen cg, pToken* at, const pToken end, CType* type, char value[SYMBOL_LENGTH]);
+
+/* Everything in [at, end) as one value, folded when it's constant */
+static const char* compileValue(pCodegen cg, pToken at, const pToken end, CType* type, char value[SYMBOL_LENGTH]) {
+    pToken  folded = at;
+    int64_t constant;
+    if (foldConstant(cg->file, &folded, end, &constant, 1) && folded == end) {
+        *type = CTYPE(constant == (int32_t)constant ? CT_Int : CT_Long);
+        snprintf(value, SYMBOL_LENGTH, "%ld", (long)constant);
+        return value;
+    }
+    compileOperand(cg, &at, end, type, value);
+    if (at != end) ERRO(EXIT_FAILURE, "%s:%u: Only single values and constants are supported so far", at->origin->file_path, at->origin->line_num);
+    return value;
+}
+
+/* Where an lvalue lives: in a temporary, `base` itself, or in memory at
+   `base` plus an `offset` that's only added once something reads or writes
+   it, so `a[2].y` is a single `add` */
+typedef struct {
+    char    base[SYMBOL_LENGTH];
+    int64_t offset;
+    CType   type;
+    bool    in_memory;
+} Place;
+
+static const char* placeAddress(pCodegen cg, const Place* place, const pFileLine line, char out[SYMBOL_LENGTH]) {
+    if (!place->in_memory) ERRO(EXIT_FAILURE, "%s:%u: Locals kept in temporaries have no address", line->file_path, line->line_num);
+    return offsetAddress(cg, place->base, place->offset, out);
+}
+
+/* What reading the place yields, arrays and aggregates are their address */
+static const char* placeValue(pCodegen cg, const Place* place, const pFileLine line, char out[SYMBOL_LENGTH]) {
+    if (!place->in_memory) return strcpy(out, place->base);
+    char address[SYMBOL_LENGTH];
+    placeAddress(cg, place, line, address);
+    if (place->type.length || isAggregateCType(place->type)) return strcpy(out, address);
+    appendBuffer(&cg->text, "\t%s =%s %s %s\n", newTemp(cg, out), qbeType2str[qbeBaseType(place->type)], loadInstr(place->type), address);
+    return out;
+}
+
+/* The place becomes what its pointer value points at */
+static void derefPlace(pCodegen cg, Place* place, const pFileLine line) {
+    char pointer[SYMBOL_LENGTH];
+    placeValue(cg, place, line, pointer);
+    *place = (Place){ .type = place->type, .in_memory = true };
+    strcpy(place->base, pointer);
+}
+
+static void indexPlace(pCodegen cg, Place* place, const char* index, const CType index_type, const pFileLine line) {
+    if (place->type.length == 0) {
+        if (place->type.pointers == 0) ERRO(EXIT_FAILURE, "%s:%u: Only arrays and pointers can be indexed", line->file_path, line->line_num);
+        derefPlace(cg, place, line);
+    }
+    const CType element = elementCType(place->type);
+    const uint  size    = sizeofCType(element);
+    place->type = element;
+    if (isConstValue(index)) {
+        place->offset += strtoll(index, NULL, 10) * (int64_t)size;
+        return;
+    }
+    char wide[SYMBOL_LENGTH], scaled[SYMBOL_LENGTH];
+    index = convertValue(cg, index, index_type, CTYPE(CT_Long), NULL, wide);
+    if (size != 1) {
+        appendBuffer(&cg->text, "\t%s =l mul %s, %u\n", newTemp(cg, scaled), index, size);
+        index = scaled;
+    }
+    char base[SYMBOL_LENGTH];
+    appendBuffer(&cg->text, "\t%s =l add %s, %s\n", newTemp(cg, base), place->base, index);
+    strcpy(place->base, base);
+}
+
+/* `.name`, or `->name` when `through_pointer` */
+static void fieldPlace(pCodegen cg, Place* place, const pToken name, const bool through_pointer) {
+    const pFileLine line = name->origin;
+    if (through_pointer) {
+        if (place->type.pointers != 1 || place->type.length) ERRO(EXIT_FAILURE, "%s:%u: `->` needs a pointer to a struct or union", line->file_path, line->line_num);
+        derefPlace(cg, place, line);
+        place->type = elementCType(place->type);
+    }
+    const Aggregate* aggregate = place->type.aggregate;
+    if (!isAggregateCType(place->type)) ERRO(EXIT_FAILURE, "%s:%u: Only structs and unions have fields", line->file_path, line->line_num);
+    if (!aggregate || !aggregate->complete) ERRO(EXIT_FAILURE, "%s:%u: Struct or union isn't defined yet", line->file_path, line->line_num);
+    const Field* field = findField(aggregate, name->text);
+    if (field == NULL) ERRO(EXIT_FAILURE, "%s:%u: `%s` has no field `%s`", line->file_path, line->line_num, aggregate->tag, name->text);
+    place->offset += field->offset;
+    place->type    = field->type;
+}
+
+/* A variable, `*p` or `(...)` around a place, then any `[i]`, `.f` or `->f`. Leaves `*at` after it. */
+static void compilePlace(pCodegen cg, pToken* at, const pToken end, Place* place) {
+    const pToken token = *at;
+    if (token >= end) ERRO(EXIT_FAILURE, "Expected a value");
+    const pFileLine line = token->origin;
+    *at = token+1;
+
+    if (isToken(token, end, "*")) {
+        CType type;
+        char  pointer[SYMBOL_LENGTH];
+        compileOperand(cg, at, end, &type, pointer);
+        if (type.pointers == 0 && type.length == 0) ERRO(EXIT_FAILURE, "%s:%u: Only pointers can be dereferenced", line->file_path, line->line_num);
+        *place = (Place){ .type = elementCType(type), .in_memory = true };
+        strcpy(place->base, pointer);
+        return;
+    }
+    if (isToken(token, end, "(")) {
+        const pToken close = matchingBracket(token, end);
+        pToken inner = token+1;
+        compilePlace(cg, &inner, close, place);
+        if (inner != close) ERRO(EXIT_FAILURE, "%s:%u: Only single values and constants are supported so far", line->file_path, line->line_num);
+        *at = close+1;
+    } else if (token->type == TOKEN_identifier) {
+        const Variable* variable = findVariable(cg, token);
+        *place = (Place){ .type = variable->type, .in_memory = variable->symbol || variable->type.length || isAggregateCType(variable->type) };
+        variableValue(cg, variable, place->base);
+    } else {
+        ERRO(EXIT_FAILURE, "%s:%u: Unsupported value `%s`", line->file_path, line->line_num, token->text);
+    }
+
+    for (;;) {
+        if (isToken(*at, end, "[")) {
+            CType index_type;
+            char  index[SYMBOL_LENGTH];
+            const pToken close = matchingBracket(*at, end);
+            compileValue(cg, *at+1, close, &index_type, index);
+            indexPlace(cg, place, index, index_type, line);
+            *at = close+1;
+        } else if ((isToken(*at, end, ".") || isToken(*at, end, "->")) && *at+1 < end && (*at)[1].type == TOKEN_identifier) {
+            fieldPlace(cg, place, *at+1, (*at)->text[0] == '-');
+            *at += 2;
+        } else {
+            return;
+        }
+    }
+}
+
+/* What a value without a parameter to go to is passed as */
+static CType promotedCType(const CType type) {
+    if (type.pointers || type.length || isAggregateCType(type)) return type;
+    if (type.kind == CT_Float) return CTYPE(CT_Double);
+    if (isIntegerCType(type) && sizeofCType(type) < 4) return CTYPE(CT_Int);
+    return type;
+}
+
+/* How a value crosses a call, aggregates by their `:type` */
+static const char* abiType(const CType type, const pFileLine line, char buffer[SYMBOL_LENGTH]) {
+    if (!isAggregateCType(type)) return qbeType2str[qbeBaseType(type)];
+    if (!type.aggregate || !type.aggregate->complete) ERRO(EXIT_FAILURE, "%s:%u: Struct or union isn't defined yet", line->file_path, line->line_num);
+    snprintf(buffer, SYMBOL_LENGTH, ":%s", type.aggregate->symbol);
+    return buffer;
+}
+
+#define INLINE_MEMORY_LIMIT 64 /* Bytes up to which a constant size `memcpy` or `memset` is expanded */
+
+/* `op` on two values of QBE type `base` into a new temporary */
+static const char* emitBinary(pCodegen cg, const char* op, const enum QbeType base, const char* a, const char* b, char out[SYMBOL_LENGTH]) {
+    char temp[SYMBOL_LENGTH];
+    appendBuffer(&cg->text, "\t%s =%s %s %s, %s\n", newTemp(cg, temp), qbeType2str[base], op, a, b);
+    return strcpy(out, temp);
+}
+
+/* Set bits of `x`, an unsigned `w` or `l`. QBE has no instruction for it, so
+   it's the usual SWAR sum: pairs, nibbles, then bytes added up by a multiply. */
+static const char* emitPopcount(pCodegen cg, const char* x, const enum QbeType base, char out[SYMBOL_LENGTH]) {
+    const bool wide = base == QBE_Long;
+    const uint64_t m1 = UINT64_C(0x5555555555555555), m2 = UINT64_C(0x3333333333333333), m4 = UINT64_C(0x0f0f0f0f0f0f0f0f), h = UINT64_C(0x0101010101010101);
+    char a[SYMBOL_LENGTH], b[SYMBOL_LENGTH], mask[SYMBOL_LENGTH];
+#define MASK(M) (snprintf(mask, SYMBOL_LENGTH, "%ld", wide ? (long)(M) : (long)(uint32_t)(M)), mask)
+    emitBinary(cg, "and", base, emitBinary(cg, "shr", base, x, "1", a), MASK(m1), a);
+    emitBinary(cg, "sub", base, x, a, out);
+    emitBinary(cg, "and", base, out, MASK(m2), a);
+    emitBinary(cg, "and", base, emitBinary(cg, "shr", base, out, "2", b), MASK(m2), b);
+    emitBinary(cg, "add", base, a, b, out);
+    emitBinary(cg, "add", base, out, emitBinary(cg, "shr", base, out, "4", a), out);
+    emitBinary(cg, "and", base, out, MASK(m4), out);
+    emitBinary(cg, "mul", base, out, MASK(h), out);
+#undef MASK
+    return emitBinary(cg, "shr", base, out, wide ? "56" : "24", out);
+}
+
+/* Calls codegen knows the meaning of, expanded in place of a `call`: small
+   constant size `memcpy`/`memset` into wide loads and stores, `strlen` of a
+   literal into its length, and GCC's bit builtins. False, with nothing
+   emitted, to leave it as a real call. */
+static bool compileBuiltin(pCodegen cg, const pToken name, const pToken open, const pToken close, CType* type, char value[SYMBOL_LENGTH]) {
+    pToken args[4], ends[4];
+    uint   count = 0;
+    for (pToken arg = open+1; arg<close && count<4; count++) {
+        args[count] = arg;
+        ends[count] = argumentEnd(arg, close);
+        arg = ends[count] < close ? ends[count]+1 : close;
+    }
+    const char*     text = name->text;
+    const CType     ulong = { .kind = CT_Long, .is_unsigned = true }, unsigned_int = { .kind = CT_Int, .is_unsigned = true };
+    const CType     pointer = { .kind = CT_Void, .pointers = 1 };
+    CType arg_type;
+    char  arg_value[SYMBOL_LENGTH], converted[SYMBOL_LENGTH], scratch[SYMBOL_LENGTH];
+    if (!value) value = scratch;
+
+    if ((strcmp(text, "memcpy")==0 || strcmp(text, "memset")==0) && count == 3) {
+        pToken  folded = args[2];
+        int64_t size;
+        if (!foldConstant(cg->file, &folded, ends[2], &size, 1) || folded != ends[2] || size < 0 || size > INLINE_MEMORY_LIMIT) return false;
+
+        /* Every target QBE has handles unaligned integer loads and stores, so the pieces are as wide as the size allows */
+        char dest_value[SYMBOL_LENGTH], dest_converted[SYMBOL_LENGTH];
+        compileValue(cg, args[0], ends[0], &arg_type, dest_value);
+        const char* dest = convertValue(cg, dest_value, arg_type, pointer, NULL, dest_converted);
+        compileValue(cg, args[1], ends[1], &arg_type, arg_value);
+        if (text[3] == 'c') {
+            copyMemory(cg, dest, convertValue(cg, arg_value, arg_type, pointer, NULL, converted), (uint)size, 8);
+        } else if (isConstValue(arg_value) || size == 0) {
+            fillMemory(cg, dest, 0, (uint)size, 8, convertValue(cg, arg_value, arg_type, CTYPE(CT_Int), NULL, converted));
+        } else {
+            char byte[SYMBOL_LENGTH];
+            appendBuffer(&cg->text, "\t%s =l extub %s\n", newTemp(cg, byte), convertValue(cg, arg_value, arg_type, CTYPE(CT_Int), NULL, converted));
+            fillMemory(cg, dest, 0, (uint)size, 8, emitBinary(cg, "mul", QBE_Long, byte, "72340172838076673", byte));
+        }
+        TRACE(TRACE_Codegen, TRACE_Debug, "%s:%u: `%s` of %ld bytes expanded inline", name->origin->file_path, name->origin->line_num, text, (long)size);
+        if (type) *type = pointer;
+        strcpy(value, dest);
+        return true;
+    }
+    if (strcmp(text, "strlen")==0 && count == 1) {
+        if (ends[0] != args[0]+1 || args[0]->type != TOKEN_stringConst) return false;
+        if (type) *type = ulong;
+        snprintf(value, SYMBOL_LENGTH, "%u", stringLength(args[0]->text));
+        return true;
+    }
+    if (strcmp(text, "__builtin_expect")==0 && count == 2) {
+        /* QBE has no branch weights to pass the hint on to */
+        compileValue(cg, args[0], ends[0], &arg_type, arg_value);
+        if (type) *type = CTYPE(CT_Long);
+        strcpy(value, convertValue(cg, arg_value, arg_type, CTYPE(CT_Long), NULL, converted));
+        return true;
+    }
+
+    static const char* bit_builtins[] = { "__builtin_popcount", "__builtin_clz", "__builtin_ctz" };
+    for (uint i = 0; i<sizeof(bit_builtins)/sizeof(bit_builtins[0]); i++) {
+        const size_t length = strlen(bit_builtins[i]);
+        if (strncmp(text, bit_builtins[i], length) != 0 || count != 1) continue;
+        const char* suffix = text + length;
+        if (*suffix && strcmp(suffix, "l") != 0 && strcmp(suffix, "ll") != 0) return false;
+
+        const CType          operand = *suffix ? ulong : unsigned_int;
+        const enum QbeType   base    = qbeBaseType(operand);
+        const uint           bits    = 8 * sizeofCType(operand);
+        const char*          x       = convertValue(cg, compileValue(cg, args[0], ends[0], &arg_type, arg_value), arg_type, operand, NULL, converted);
+        if (type) *type = CTYPE(CT_Int);
+
+        if (isConstValue(x)) {
+            const uint64_t constant = (uint64_t)strtoll(x, NULL, 10) & (bits == 64 ? UINT64_MAX : UINT32_MAX);
+            const int result = i == 0 ? __builtin_popcountll(constant)
+                             : constant == 0 ? (int)bits /* Undefined, anything will do */
+                             : i == 1 ? __builtin_clzll(constant) - (64 - (int)bits) : __builtin_ctzll(constant);
+            snprintf(value, SYMBOL_LENGTH, "%d", result);
+            return true;
+        }
+        char t[SYMBOL_LENGTH], u[SYMBOL_LENGTH], count_value[SYMBOL_LENGTH];
+        if (i == 0) {
+            emitPopcount(cg, x, base, count_value);
+        } else if (i == 1) {
+            /* Bits below the highest one all set, then counted */
+            strcpy(t, x);
+            for (uint shift = 1; shift<bits; shift *= 2) {
+                char amount[16];
+                snprintf(amount, sizeof(amount), "%u", shift);
+                emitBinary(cg, "or", base, t, emitBinary(cg, "shr", base, t, amount, u), t);
+            }
+            char width[16];
+            snprintf(width, sizeof(width), "%u", bits);
+            emitBinary(cg, "sub", base, width, emitPopcount(cg, t, base, u), count_value);
+        } else {
+            /* The zeros below the lowest set bit turned into the only ones */
+            emitBinary(cg, "sub", base, x, "1", t);
+            emitBinary(cg, "and", base, emitBinary(cg, "xor", base, x, "-1", u), t, t);
+            emitPopcount(cg, t, base, count_value);
+        }
+        strcpy(value, count_value);
+        return true;
+    }
+    return false;
+}
+
+/* `name(...)` with `*at` on its `(`, leaves `*at` after the `)`. The result
+   goes in `value` unless that's NULL. Functions without a prototype return
+   an `int` and take their arguments as they come. */
+static const char* compileCall(pCodegen cg, const pToken name, pToken* at, const pToken end, CType* type, char value[SYMBOL_LENGTH]) {
+    const pFileLine line   = name->origin;
+    const Function* callee = findFunction(cg->file, name->text);
+    const pToken    close  = matchingBracket(*at, end);
+    const bool      tail   = cg->tail_call; /* Not any call among the arguments */
+    cg->tail_call = false;
+    if (compileBuiltin(cg, name, *at, close, type, value)) {
+        *at = close+1;
+        return value;
+    }
+
+    Buffer args  = {0};
+    uint   count = 0;
+    for (pToken arg = *at+1; arg<close; count++) {
+        const pToken comma = argumentEnd(arg, close);
+        CType arg_type;
+        char  arg_value[SYMBOL_LENGTH], converted[SYMBOL_LENGTH], abi[SYMBOL_LENGTH];
+        compileValue(cg, arg, comma, &arg_type, arg_value);
+        const CType param_type = callee && count < callee->num_params ? callee->params[count].type : promotedCType(arg_type);
+        const char* passed     = convertValue(cg, arg_value, arg_type, param_type, NULL, converted);
+        if (callee && callee->variadic && count == callee->num_params) appendBuffer(&args, "%s...", args.length ? ", " : "");
+        appendBuffer(&args, "%s%s %s", args.length ? ", " : "", abiType(param_type, line, abi), passed);
+        arg = comma < close ? comma+1 : close;
+    }
+    if (callee && (count < callee->num_params || (count > callee->num_params && !callee->variadic)))
+        ERRO(EXIT_FAILURE, "%s:%u: `%s` takes %u argument(s), not %u", line->file_path, line->line_num, name->text, callee->num_params, count);
+    if (callee && callee->variadic && count == callee->num_params) appendBuffer(&args, "%s...", args.length ? ", " : "");
+    *at = close+1;
+
+    /* QBE has no tail calls of its own, the mark is for whoever reads or lowers the IL */
+    const CType ret  = callee ? callee->ret : CTYPE(CT_Int);
+    const char* mark = tail ? " # tail call" : "";
+    char symbol[SYMBOL_LENGTH], abi[SYMBOL_LENGTH];
+    if (value && (ret.kind != CT_Void || ret.pointers)) {
+        appendBuffer(&cg->text, "\t%s =%s call $%s(%s)%s\n", newTemp(cg, value), abiType(ret, line, abi),
+            symbolName(cg->file, name->text, symbol), args.text ? args.text : "", mark);
+    } else {
+        appendBuffer(&cg->text, "\tcall $%s(%s)%s\n", symbolName(cg->file, name->text, symbol), args.text ? args.text : "", mark);
+        if (value) strcpy(value, "0");
+    }
+    if (type) *type = ret;
+    freeMemory(args.text);
+    return value;
+}
+
+/* A single value: a constant, a string, a call, `&` of a place or what a place holds. Leaves `*at` after it. */
+static const char* compileOperand(pCodegen cg, pToken* at, const pToken end, CType* type, char value[SYMBOL_LENGTH]) {
+    pToken token = *at;
+    if (token >= end) ERRO(EXIT_FAILURE, "Expected a value");
+    const pFileLine line = token->origin;
+    *at = token+1;
+
+    bool negate = false;
+    if (isToken(token, end, "-") && token+1 < end && isConst(token[1].type)) {
+        negate = true;
+        token  = *at;
+        *at    = token+1;
+    }
+    switch (token->type) {
+        default: break;
+
+        case TOKEN_intConst :
+        case TOKEN_hexConst :
+        case TOKEN_charConst: {
+            long constant = token->type == TOKEN_charConst ? charConstValue(token->text)
+                          : strtol(token->text, NULL, token->type == TOKEN_hexConst ? 16 : 10);
+            if (negate) constant = -constant;
+            *type = CTYPE(constant == (int32_t)constant ? CT_Int : CT_Long);
+            snprintf(value, SYMBOL_LENGTH, "%ld", constant);
+            return value;
+        }
+        case TOKEN_floatConst:
+            *type = CTYPE(CT_Float);
+            snprintf(value, SYMBOL_LENGTH, "s_%.9g", negate ? -strtof(token->text, NULL) : strtof(token->text, NULL));
+            return value;
+        case TOKEN_doubleConst:
+            *type = CTYPE(CT_Double);
+            snprintf(value, SYMBOL_LENGTH, "d_%.17g", negate ? -strtod(token->text, NULL) : strtod(token->text, NULL));
+            return value;
+        case TOKEN_stringConst:
+            *type = (CType){ .kind = CT_Char, .pointers = 1 };
+            snprintf(value, SYMBOL_LENGTH, "$s_const_%u_%u", cg->job, cg->const_counter);
+            appendBuffer(&cg->data, "data $s_const_%u_%u = { b %s, b 0 }\n", cg->job, cg->const_counter++, token->text);
+            return value;
+
+        case TOKEN_identifier:
+            if (isToken(*at, end, "(")) return compileCall(cg, token, at, end, type, value);
+            break;
+        case TOKEN_operator:
+            if (strcmp(token->text, "&")==0) {
+                Place place;
+                compilePlace(cg, at, end, &place);
+                *type = place.type.length ? elementCType(place.type) : place.type;
+                type->pointers++;
+                return placeAddress(cg, &place, line, value);
+            }
             break;
+    }
+    if (negate) ERRO(EXIT_FAILURE, "%s:%u: Unsupported value `%s`", line->file_path, line->line_num, token->text);
+
+    Place place;
+    *at = token;
+    compilePlace(cg, at, end, &place);
+    *type = place.type;
+    return placeValue(cg, &place, line, value);
+}
+
+/* What a store of `type` writes, `storeb`/`storeh` drop the top bits themselves */
+static CType storedCType(const CType type) {
+    return isIntegerCType(type) && sizeofCType(type) < 4 ? (CType){ .kind = CT_Int, .is_unsigned = type.is_unsigned } : type;
+}
+
+/* Struct and union values are the address of one, they're copied rather than stored */
+static void storeValue(pCodegen cg, const char* value, const CType value_type, const CType type, const char* address, const pFileLine line) {
+    if (isAggregateCType(type)) {
+        if (!isAggregateCType(value_type) || value_type.aggregate != type.aggregate)
+            ERRO(EXIT_FAILURE, "%s:%u: Structs and unions only take values of their own type", line->file_path, line->line_num);
+        copyMemory(cg, address, value, sizeofCType(type), alignofCType(type));
+        return;
+    }
+    char converted[SYMBOL_LENGTH];
+    const char* stored = convertValue(cg, value, value_type, storedCType(type), NULL, converted);
+    appendBuffer(&cg->text, "\tstore%s %s, %s\n", qbeType2str[qbeMemoryType(type)], stored, address);
+}
+
+/* `place = value`, false if the statement isn't an assignment at all */
+static bool compileAssignment(pCodegen cg, const pToken tokens, const pToken end) {
+    pToken equals = tokens;
+    for (uint depth = 0; equals < end; equals++) {
+        if (isToken(equals, end, "[") || isToken(equals, end, "(")) depth++;
+        if (isToken(equals, end, "]") || isToken(equals, end, ")")) depth--;
+        if (depth == 0 && isToken(equals, end, "=")) break;
+    }
+    if (equals == end) return false;
+    const pFileLine line = tokens->origin;
+
+    Place  target;
+    pToken at = tokens;
+    compilePlace(cg, &at, equals, &target);
+    if (at != equals) ERRO(EXIT_FAILURE, "%s:%u: Can't assign to that", line->file_path, line->line_num);
+    if (target.type.length) ERRO(EXIT_FAILURE, "%s:%u: Arrays can't be assigned to", line->file_path, line->line_num);
+
+    CType value_type;
+    char  value[SYMBOL_LENGTH], converted[SYMBOL_LENGTH];
+    compileValue(cg, equals+1, end, &value_type, value);
+
+    if (target.in_memory) {
+        char address[SYMBOL_LENGTH];
+        storeValue(cg, value, value_type, target.type, placeAddress(cg, &target, line, address), line);
+    } else {
+        convertValue(cg, value, value_type, target.type, target.base, converted);
+    }
+    return true;
+}
+
+/* The declared type, `[]` arrays take their length from the initializer.
+   `initializer` is set to what follows the `=`, NULL without one. */
+static CType declaredCType(const struct code_file_s* file, const pToken tokens, const pToken end, const char** identifier, pToken* initializer) {
+    const pFileLine line = tokens->origin;
+    CType  type = parseCType(tokens, identifier, file->aggregates);
+    pToken at   = tokens;
+    while (at < end && !isToken(at, end, "[") && !isToken(at, end, "=")) at++;
+
+    bool unsized = false;
+    if (isToken(at, end, "[")) {
+        const pToken close = matchingBracket(at, end);
+        int64_t length = 0;
+        pToken  folded = at+1;
+        unsized = folded == close;
+        if (!unsized && (!foldConstant(file, &folded, close, &length, 1) || folded != close || length <= 0))
+            ERRO(EXIT_FAILURE, "%s:%u: Array lengths must be positive constants", line->file_path, line->line_num);
+        type.length = length;
+        at = close+1;
+    }
+    *initializer = isToken(at, end, "=") ? at+1 : NULL;
+
+    if (unsized) {
+        const pToken value = *initializer;
+        if (value && value < end && value->type == TOKEN_stringConst) {
+            type.length = stringLength(value->text) + 1;
+        } else if (isToken(value, end, "{")) {
+            const pToken close = matchingBracket(value, end);
+            bool at_element = true; /* So a `,` right before the `}` doesn't count */
+            for (pToken t = value+1; t<close; t++) {
+                if (isToken(t, close, "{") || isToken(t, close, "(")) t = matchingBracket(t, close);
+                if (at_element && !isToken(t, close, ",")) type.length++;
+                at_element = isToken(t, close, ",");
+            }
+        }
+        if (type.length == 0) ERRO(EXIT_FAILURE, "%s:%u: Arrays need a length or an initializer", line->file_path, line->line_num);
+    }
+    return type;
+}
+
+/* Initialized `data` built up an item at a time, zeros are held back so a run of them is one `z` */
+typedef struct {
+    Buffer text;
+    uint   zeros;
+} DataItems;
+
+static void flushZeros(DataItems* items) {
+    if (items->zeros == 0) return;
+    appendBuffer(&items->text, "%sz %u", items->text.length ? ", " : "", items->zeros);
+    items->zeros = 0;
+}
+
+__attribute__((format(printf, 2, 3)))
+static void appendDataItem(DataItems* items, const char* fmt, ...) {
+    char item[SYMBOL_LENGTH + 8];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(item, sizeof(item), fmt, args);
+    va_end(args);
+
+    flushZeros(items);
+    appendBuffer(&items->text, "%s%s", items->text.length ? ", " : "", item);
+}
+
+/* What `*at` sets a `type` to, all zero if `at` is NULL. Leaves `*at` after it. */
+static void compileInitializer(pCodegen cg, DataItems* items, const CType type, pToken* at, const pToken end) {
+    if (at == NULL) {
+        items->zeros += sizeofCType(type);
+        return;
+    }
+    const pToken token = *at;
+    if (token >= end) ERRO(EXIT_FAILURE, "Expected an initializer");
+    const pFileLine line = token->origin;
+
+    if (type.length) {
+        const CType element = elementCType(type);
+        if (token->type == TOKEN_stringConst && element.kind == CT_Char && element.pointers == 0) {
+            const uint length = stringLength(token->text);
+            if (length > type.length) ERRO(EXIT_FAILURE, "%s:%u: String is longer than its array", line->file_path, line->line_num);
+            if (length) appendDataItem(items, "b %s", token->text);
+            items->zeros += type.length - length;
+            *at = token+1;
+            return;
+        }
+        if (!isToken(token, end, "{")) ERRO(EXIT_FAILURE, "%s:%u: Arrays are initialized with `{...}`", line->file_path, line->line_num);
+        const pToken close = matchingBracket(token, end);
+        uint count = 0;
+        for (*at = token+1; *at < close; count++) {
+            if (count == type.length) ERRO(EXIT_FAILURE, "%s:%u: Too many initializers for its array", line->file_path, line->line_num);
+            compileInitializer(cg, items, element, at, close);
+            if (isToken(*at, close, ",")) (*at)++;
+            else if (*at != close) ERRO(EXIT_FAILURE, "%s:%u: Expected `,` or `}`", line->file_path, line->line_num);
+        }
+        items->zeros += (type.length - count) * sizeofCType(element);
+        *at = close+1;
+        return;
+    }
+
+    /* Fields in order with the padding between them, unions take their first */
+    if (isAggregateCType(type)) {
+        const Aggregate* aggregate = type.aggregate;
+        if (!aggregate || !aggregate->complete) ERRO(EXIT_FAILURE, "%s:%u: Struct or union isn't defined yet", line->file_path, line->line_num);
+        if (!isToken(token, end, "{")) ERRO(EXIT_FAILURE, "%s:%u: Structs and unions in data are initialized with `{...}`", line->file_path, line->line_num);
+        const pToken close = matchingBracket(token, end);
+        uint filled = 0, count = 0;
+        for (*at = token+1; *at < close; count++) {
+            if (count == (aggregate->is_union ? 1 : aggregate->num_fields)) ERRO(EXIT_FAILURE, "%s:%u: Too many initializers for `%s`", line->file_path, line->line_num, aggregate->tag);
+            const Field* field = &(aggregate->fields[count]);
+            items->zeros += field->offset - filled;
+            compileInitializer(cg, items, field->type, at, close);
+            filled = field->offset + sizeofCType(field->type);
+            if (isToken(*at, close, ",")) (*at)++;
+            else if (*at != close) ERRO(EXIT_FAILURE, "%s:%u: Expected `,` or `}`", line->file_path, line->line_num);
+        }
+        items->zeros += aggregate->size - filled;
+        *at = close+1;
+        return;
+    }
+
+    /* Scalars can be braced too, `int x = { 1 };` */
+    if (isToken(token, end, "{")) {
+        const pToken close = matchingBracket(token, end);
+        *at = token+1;
+        compileInitializer(cg, items, type, at, close);
+        *at = close+1;
+        return;
+    }
+    pToken stop = token;
+    while (stop < end && !isToken(stop, end, ",")) {
+        if (isToken(stop, end, "(") || isToken(stop, end, "{")) stop = matchingBracket(stop, end);
+        stop++;
+    }
+    *at = stop;
+
+    const char* memory_type = qbeType2str[qbeMemoryType(type)];
+    pToken  folded = token;
+    int64_t constant;
+    if (foldConstant(cg->file, &folded, stop, &constant, 1) && folded == stop) {
+        if (!isIntegerCType(type)) {
+            if (constant == 0) items->zeros += sizeofCType(type);
+            else appendDataItem(items, "%s %s_%.*g", memory_type, memory_type, type.kind == CT_Float ? 9 : 17, (double)constant);
+        } else if ((constant = foldCType(type, constant)) == 0) {
+            items->zeros += sizeofCType(type);
+        } else {
+            appendDataItem(items, "%s %ld", memory_type, (long)constant);
         }
-        temp = temp->next;
+        return;
+    }
+
+    const bool negate = isToken(token, stop, "-");
+    const pToken value = token + negate;
+    if (value+1 == stop && (value->type == TOKEN_floatConst || value->type == TOKEN_doubleConst)) {
+        const double constant = negate ? -strtod(value->text, NULL) : strtod(value->text, NULL);
+        if (isIntegerCType(type))   appendDataItem(items, "%s %ld", memory_type, (long)foldCType(type, (int64_t)constant));
+        else if (constant == 0.0 && !negate) items->zeros += sizeofCType(type);
+        else                        appendDataItem(items, "%s %s_%.*g", memory_type, memory_type, type.kind == CT_Float ? 9 : 17, constant);
+        return;
+    }
+    if (!negate && value+1 == stop && value->type == TOKEN_stringConst && type.pointers) {
+        appendBuffer(&cg->data, "data $s_const_%u_%u = { b %s, b 0 }\n", cg->job, cg->const_counter, value->text);
+        appendDataItem(items, "l $s_const_%u_%u", cg->job, cg->const_counter++);
+        return;
     }
 
-    if (strcmp(builtin->text, "printf")==0) {
-        fprintf(fp, "\tcall $printf(l $s_const_%u, ...)\n", global_ConstCounter); 
+    /* Addresses: `&global` or an array decaying to its first element */
+    const bool address_of = isToken(token, stop, "&");
+    const pToken name = token + address_of;
+    if (type.pointers && name+1 == stop && name->type == TOKEN_identifier) {
+        const Variable* variable = findVariable(cg, name);
+        if (variable->symbol && (address_of || variable->type.length)) {
+            char symbol[SYMBOL_LENGTH];
+            appendDataItem(items, "l $%s", symbolName(cg->file, variable->symbol, symbol));
+            return;
+        }
     }
+    ERRO(EXIT_FAILURE, "%s:%u: Initializer isn't a constant", line->file_path, line->line_num);
+}
+
+static void compileData(pCodegen cg, const char* symbol, const CType type, pToken initializer, const pToken end, const bool exported) {
+    DataItems items = {0};
+    compileInitializer(cg, &items, type, initializer ? &initializer : NULL, end);
+    if (initializer && initializer != end) ERRO(EXIT_FAILURE, "%s:%u: Only one initializer per declaration is supported so far",
+        initializer->origin->file_path, initializer->origin->line_num);
+    if (items.text.length == 0 && items.zeros == 0) items.zeros = 1; /* Zero-sized, still needs an address */
+    flushZeros(&items);
+
+    appendBuffer(&cg->data, "%sdata $%s = align %u { %s }\n", exported ? "export " : "", symbol, alignofCType(type), items.text.text);
+    freeMemory(items.text.text);
 }
 
-static void compileGrammar(FILE* fp, const pToken tokens, const enum GrammarUnit grammar, Block data_seg) {
+/* A local array or aggregate being initialized, bytes before `filled` are
+   set and the gaps left by zeros are cleared in as few stores as possible */
+typedef struct {
+    const char* address;
+    uint        align, filled;
+} LocalStores;
+
+static void storeZeros(pCodegen cg, LocalStores* stores, const uint to) {
+    if (to <= stores->filled) return;
+    zeroMemory(cg, stores->address, stores->filled, to, stores->align);
+    stores->filled = to;
+}
+
+/* The stack counterpart of `compileInitializer`, for what `*at` sets `offset` into the local to */
+static void compileLocalInitializer(pCodegen cg, LocalStores* stores, const uint offset, const CType type, pToken* at, const pToken end) {
+    const pToken token = *at;
+    if (token >= end) ERRO(EXIT_FAILURE, "Expected an initializer");
+    const pFileLine line = token->origin;
+    char address[SYMBOL_LENGTH];
+
+    if (type.length) {
+        const CType element = elementCType(type);
+        if (token->type == TOKEN_stringConst && element.kind == CT_Char && element.pointers == 0) {
+            const uint length = stringLength(token->text);
+            if (length > type.length) ERRO(EXIT_FAILURE, "%s:%u: String is longer than its array", line->file_path, line->line_num);
+            char source[SYMBOL_LENGTH];
+            snprintf(source, SYMBOL_LENGTH, "$s_const_%u_%u", cg->job, cg->const_counter);
+            appendBuffer(&cg->data, "data %s = { b %s, b 0 }\n", source, token->text);
+            cg->const_counter++;
+            storeZeros(cg, stores, offset);
+            copyMemory(cg, offsetAddress(cg, stores->address, offset, address), source, length < type.length ? length+1 : length, 1);
+            stores->filled = offset + (length < type.length ? length+1 : length);
+            *at = token+1;
+            return;
+        }
+        if (!isToken(token, end, "{")) ERRO(EXIT_FAILURE, "%s:%u: Arrays are initialized with `{...}`", line->file_path, line->line_num);
+        const pToken close = matchingBracket(token, end);
+        uint count = 0;
+        for (*at = token+1; *at < close; count++) {
+            if (count == type.length) ERRO(EXIT_FAILURE, "%s:%u: Too many initializers for its array", line->file_path, line->line_num);
+            compileLocalInitializer(cg, stores, offset + count*sizeofCType(element), element, at, close);
+            if (isToken(*at, close, ",")) (*at)++;
+            else if (*at != close) ERRO(EXIT_FAILURE, "%s:%u: Expected `,` or `}`", line->file_path, line->line_num);
+        }
+        *at = close+1;
+        return;
+    }
+    if (isAggregateCType(type) && isToken(token, end, "{")) {
+        const Aggregate* aggregate = type.aggregate;
+        const pToken close = matchingBracket(token, end);
+        uint count = 0;
+        for (*at = token+1; *at < close; count++) {
+            if (count == (aggregate->is_union ? 1 : aggregate->num_fields)) ERRO(EXIT_FAILURE, "%s:%u: Too many initializers for `%s`", line->file_path, line->line_num, aggregate->tag);
+            compileLocalInitializer(cg, stores, offset + aggregate->fields[count].offset, aggregate->fields[count].type, at, close);
+            if (isToken(*at, close, ",")) (*at)++;
+            else if (*at != close) ERRO(EXIT_FAILURE, "%s:%u: Expected `,` or `}`", line->file_path, line->line_num);
+        }
+        *at = close+1;
+        return;
+    }
+    if (isToken(token, end, "{")) {
+        const pToken close = matchingBracket(token, end);
+        *at = token+1;
+        compileLocalInitializer(cg, stores, offset, type, at, close);
+        *at = close+1;
+        return;
+    }
+
+    pToken stop = token;
+    while (stop < end && !isToken(stop, end, ",")) {
+        if (isToken(stop, end, "(") || isToken(stop, end, "[") || isToken(stop, end, "{")) stop = matchingBracket(stop, end);
+        stop++;
+    }
+    *at = stop;
+
+    CType value_type;
+    char  value[SYMBOL_LENGTH];
+    compileValue(cg, token, stop, &value_type, value);
+    if (strcmp(value, "0")==0 && !isAggregateCType(type)) return; /* The gap gets cleared with its neighbours */
+    storeZeros(cg, stores, offset);
+    storeValue(cg, value, value_type, type, offsetAddress(cg, stores->address, offset, address), line);
+    stores->filled = offset + sizeofCType(type);
+}
+
+/* File-scope and `static` variables are `data`, other locals live in
+   temporaries, or on the stack for arrays and aggregates. Stack slots are
+   all made in the start block, QBE only sizes the frame for those there. */
+static void compileDeclaration(pCodegen cg, const pToken tokens, const pToken end) {
+    const char* identifier;
+    pToken      initializer;
+    const CType type = declaredCType(cg->file, tokens, end, &identifier, &initializer);
+    if (identifier == NULL) return;
+    const pFileLine line = tokens->origin;
+
+    bool is_static = false, is_extern = false;
+    for (pToken token = tokens; token; token = token->next) {
+        if (token->type == TOKEN_static) is_static = true;
+        if (token->type == TOKEN_extern) is_extern = true;
+    }
+
+    if (cg->at_top_level || is_static || is_extern) {
+        char buffer[SYMBOL_LENGTH];
+        const char* symbol = identifier;
+        if (cg->at_top_level) {
+            /* Already known to every job, see `collectSymbols` */
+            symbol = symbolName(cg->file, identifier, buffer);
+        } else if (is_static) {
+            snprintf(buffer, SYMBOL_LENGTH, "%s.%u.%u", identifier, cg->job, cg->const_counter++);
+            addLocal(cg, identifier, type, symbol = internString(buffer));
+        } else {
+            addLocal(cg, identifier, type, identifier);
+        }
+        if (!is_extern) compileData(cg, symbol, type, initializer, end, cg->at_top_level && !is_static);
+        return;
+    }
+
+    if (type.length || isAggregateCType(type)) {
+        const CType element = type.length ? elementCType(type) : type;
+        if (isAggregateCType(element) && !(element.aggregate && element.aggregate->complete))
+            ERRO(EXIT_FAILURE, "%s:%u: Struct or union isn't defined yet", line->file_path, line->line_num);
+        const uint align = alignofCType(type) > 8 ? 16 : alignofCType(type) > 4 ? 8 : 4;
+        appendBuffer(&cg->allocs, "\t%%%s =l alloc%u %u\n", identifier, align, sizeofCType(type));
+        addLocal(cg, identifier, type, NULL);
+        if (initializer) {
+            char address[SYMBOL_LENGTH];
+            snprintf(address, SYMBOL_LENGTH, "%%%s", identifier);
+            LocalStores stores = { .address = address, .align = align }; /* What the slot has, not just the type */
+            compileLocalInitializer(cg, &stores, 0, type, &initializer, end);
+            if (initializer != end) ERRO(EXIT_FAILURE, "%s:%u: Only one initializer per declaration is supported so far", line->file_path, line->line_num);
+            storeZeros(cg, &stores, sizeofCType(type));
+        }
+        return;
+    }
+
+    char  dest[SYMBOL_LENGTH], converted[SYMBOL_LENGTH];
+    snprintf(dest, SYMBOL_LENGTH, "%%%s", identifier);
+    if (initializer == NULL) {
+        appendBuffer(&cg->text, "\t%s =%s copy 0\n", dest, qbeType2str[qbeBaseType(type)]);
+    } else {
+        CType value_type;
+        char  value[SYMBOL_LENGTH];
+        compileValue(cg, initializer, end, &value_type, value);
+        if (value_type.kind == CT_Double && value_type.pointers == 0 && type.kind == CT_Float && type.pointers == 0)
+            ERRO(EXIT_FAILURE, "Replace `float` with `double` to store this amount of precision");
+        convertValue(cg, value, value_type, type, dest, converted);
+    }
+    addLocal(cg, identifier, type, NULL);
+}
+
+/* The return type, name and parameters of a prototype or definition, returns the `)` after them */
+static pToken parseFunction(const struct code_file_s* file, const pToken tokens, const pToken end, Function* function) {
+    *function = (Function){ .params = NULL };
+    function->ret = parseCType(tokens, &(function->name), file->aggregates);
+    pToken open = tokens;
+    while (open < end && !isToken(open, end, "(")) open++;
+    const pToken close = matchingBracket(open, end);
+
+    uint capacity = 0;
+    for (pToken param = open+1; param<close; ) {
+        pToken comma = param;
+        while (comma < close && !isToken(comma, close, ",")) {
+            if (isToken(comma, close, "(") || isToken(comma, close, "[")) comma = matchingBracket(comma, close);
+            comma++;
+        }
+        Variable variable = { .symbol = NULL };
+        variable.type = parseCType(param, &(variable.name), file->aggregates);
+        for (pToken t = param; t<comma; t++) if (isToken(t, comma, "[")) variable.type.pointers++; /* Array parameters are pointers */
+
+        if (isToken(param, comma, ".")) {
+            function->variadic = true;
+        } else if (!(variable.type.kind == CT_Void && variable.type.pointers == 0 && variable.name == NULL)) { /* `(void)` */
+            if (function->num_params == capacity) {
+                capacity = capacity ? 2*capacity : 4;
+                function->params = reallocMemory(MEM_Codegen, function->params, capacity * sizeof(Variable));
+            }
+            function->params[function->num_params++] = variable;
+        }
+        param = comma+1;
+    }
+    return close;
+}
+
+/* `struct tag {` or `union tag {` */
+static bool isAggregateDefinition(const pToken tokens) {
+    pToken keyword = tokens;
+    while (keyword && keyword->type != TOKEN_struct && keyword->type != TOKEN_union) keyword = keyword->next;
+    if (keyword == NULL || keyword->next == NULL) return false;
+    const pToken open = keyword->next->type == TOKEN_identifier ? keyword->next->next : keyword->next;
+    return open && open->type == TOKEN_operator && strcmp(open->text, "{")==0;
+}
+
+/* QBE lays out `type`s with C's alignment rules too, so only the fields' own
+   types are spelled out. Emitted where the definition is, so before any use. */
+static void compileAggregateType(pCodegen cg, const pToken tokens) {
+    pToken keyword = tokens;
+    while (keyword->type != TOKEN_struct && keyword->type != TOKEN_union) keyword = keyword->next;
+    const Aggregate* aggregate = cg->file->aggregates;
+    while (aggregate->tag != keyword[1].text) aggregate = aggregate->next;
+
+    Buffer fields = {0};
+    for (uint i = 0; i<aggregate->num_fields; i++) {
+        const CType type    = aggregate->fields[i].type;
+        const CType element = type.length ? elementCType(type) : type;
+        char count[16] = "";
+        if (type.length > 1) snprintf(count, sizeof(count), " %u", type.length);
+        const char* open  = aggregate->is_union ? (i ? " { " : "{ ") : i ? ", " : "";
+        const char* close = aggregate->is_union ? " }" : "";
+        if (isAggregateCType(element)) appendBuffer(&fields, "%s:%s%s%s", open, element.aggregate->symbol, count, close);
+        else appendBuffer(&fields, "%s%s%s%s", open, qbeType2str[qbeMemoryType(element)], count, close);
+    }
+    if (fields.length) appendBuffer(&cg->text, "type :%s = align %u { %s }\n", aggregate->symbol, aggregate->align, fields.text);
+    else               appendBuffer(&cg->text, "type :%s = align %u { %u }\n", aggregate->symbol, aggregate->align, aggregate->size);
+    freeMemory(fields.text);
+}
+
+/* Lays out a file-scope `struct` or `union`, `end` is the `;` after its `}` */
+static void defineAggregate(pCodeFile file, const pToken tokens, const pToken end) {
+    pToken keyword = tokens;
+    while (keyword->type != TOKEN_struct && keyword->type != TOKEN_union) keyword = keyword->next;
+    const pFileLine line = keyword->origin;
+    if (keyword[1].type != TOKEN_identifier) ERRO(EXIT_FAILURE, "%s:%u: Structs and unions need a tag", line->file_path, line->line_num);
+    const pToken open  = keyword+2;
+    const pToken close = matchingBracket(open, end);
+    if (close+1 != end) ERRO(EXIT_FAILURE, "%s:%u: Declare variables apart from the struct or union they're of", line->file_path, line->line_num);
+
+    const char* tag = keyword[1].text;
+    for (const Aggregate* defined = file->aggregates; defined; defined = defined->next)
+        if (defined->tag == tag) ERRO(EXIT_FAILURE, "%s:%u: `%s` is defined already", line->file_path, line->line_num, tag);
+
+    char symbol[SYMBOL_LENGTH];
+    if (file->unit) snprintf(symbol, SYMBOL_LENGTH, "%s.%u", tag, file->unit);
+    else            snprintf(symbol, SYMBOL_LENGTH, "%s", tag);
+    pAggregate aggregate = callocMemory(MEM_Codegen, 1, sizeof(Aggregate));
+    aggregate->tag      = tag;
+    aggregate->symbol   = internString(symbol);
+    aggregate->is_union = keyword->type == TOKEN_union;
+    aggregate->next     = file->aggregates;
+    file->aggregates    = aggregate; /* Before its fields, which can point back at it */
+
+    uint capacity = 0;
+    for (pToken field = open+1; field<close; ) {
+        pToken semicolon = field;
+        while (semicolon < close && !isToken(semicolon, close, ";")) {
+            if (isToken(semicolon, close, "(") || isToken(semicolon, close, "[") || isToken(semicolon, close, "{")) semicolon = matchingBracket(semicolon, close);
+            semicolon++;
+        }
+        const pFileLine field_line = field->origin;
+        if (semicolon == close) ERRO(EXIT_FAILURE, "%s:%u: Expected `;` after the field", field_line->file_path, field_line->line_num);
+
+        Field  member;
+        pToken initializer;
+        member.type = declaredCType(file, field, semicolon, &(member.name), &initializer);
+        const CType element = member.type.length ? elementCType(member.type) : member.type;
+        if (member.name == NULL || initializer) ERRO(EXIT_FAILURE, "%s:%u: Fields need a name and no initializer", field_line->file_path, field_line->line_num);
+        if (isAggregateCType(element) && !(element.aggregate && element.aggregate->complete))
+            ERRO(EXIT_FAILURE, "%s:%u: Struct or union isn't defined yet", field_line->file_path, field_line->line_num);
+        if (findField(aggregate, member.name)) ERRO(EXIT_FAILURE, "%s:%u: `%s` has a `%s` already", field_line->file_path, field_line->line_num, tag, member.name);
+
+        if (aggregate->num_fields == capacity) {
+            capacity = capacity ? 2*capacity : 8;
+            aggregate->fields = reallocMemory(MEM_Codegen, aggregate->fields, capacity * sizeof(Field));
+        }
+        aggregate->fields[aggregate->num_fields++] = member;
+        field = semicolon+1;
+    }
+    layoutAggregate(aggregate);
+    TRACE(TRACE_Codegen, TRACE_Debug, "%s:%u: %s `%s` is %u byte(s), aligned to %u",
+        line->file_path, line->line_num, aggregate->is_union ? "union" : "struct", tag, aggregate->size, aggregate->align);
+}
+
+/* A name the text of a `__qbe__` block uses, and the temporary (or label) it stands for */
+typedef struct {
+    pToken token;
+    char   bound[SYMBOL_LENGTH]; /* `%.N`, `@.N` when it's a label */
+    bool   is_output;
+} QbeOperand;
+
+static QbeOperand* findQbeOperand(QbeOperand* operands, const uint num_operands, const char* name, const size_t length) {
+    for (uint i = 0; i<num_operands; i++)
+        if (strncmp(operands[i].token->text, name, length)==0 && operands[i].token->text[length] == 0) return &(operands[i]);
+    return NULL;
+}
+
+static void flushQbeLine(pCodegen cg, pBuffer line) {
+    const char* text = line->text;
+    while (text && (*text == ' ' || *text == '\t')) text++;
+    if (text && *text) appendBuffer(&cg->text, "%s%s\n", *text == '@' ? "" : "\t", text);
+    line->length = 0;
+    if (line->text) line->text[0] = 0;
+}
+
+/* One string of a block, an instruction per line or `;`, operands swapped for what they're bound to */
+static void emitQbeText(pCodegen cg, const char* literal, QbeOperand* operands, const uint num_operands) {
+    Buffer line = {0};
+    for (const char* c = literal+1; *c && !(c[0] == '"' && c[1] == 0); c++) {
+        if (*c == '\\') {
+            c++;
+            switch (*c) {
+                case 'n' : flushQbeLine(cg, &line); break;
+                case 't' : appendBuffer(&line, "\t"); break;
+                case '"' : appendBuffer(&line, "\""); break;
+                case '\\': appendBuffer(&line, "\\"); break;
+                default  : appendBuffer(&line, "\\%c", *c); break;
+            }
+            continue;
+        }
+        if (*c == ';') {
+            flushQbeLine(cg, &line);
+            continue;
+        }
+        size_t length = 0;
+        if (*c == '%' || *c == '@') while (c[1+length] == '_' || isalnum((unsigned char)c[1+length])) length++;
+        const QbeOperand* operand = length ? findQbeOperand(operands, num_operands, c+1, length) : NULL;
+        if (operand) {
+            appendBuffer(&line, "%c%s", *c, operand->bound+1);
+            c += length;
+        } else {
+            appendBuffer(&line, "%c", *c);
+        }
+    }
+    flushQbeLine(cg, &line);
+    freeMemory(line.text);
+}
+
+/* `__qbe__ (outputs : inputs : clobbers) { "..." }`, in the spirit of GCC's
+   extended asm. The text goes through as it is, and each operand's `%name`
+   is a temporary of its own: inputs are copied into theirs before the block,
+   outputs written back from theirs after it. Clobbers name the block's own
+   temporaries and `@labels`, renamed so it can appear any number of times. */
+static void compileQbeBlock(pCodegen cg, const pToken tokens, const pToken end) {
+    const pFileLine line = tokens->origin;
+    pToken open = tokens+1;
+
+    QbeOperand* operands     = NULL;
+    uint        num_operands = 0;
+    if (isToken(open, end, "(")) {
+        const pToken close = matchingBracket(open, end);
+        operands = callocMemory(MEM_Codegen, close - open, sizeof(QbeOperand));
+        uint group = 0;
+        for (pToken token = open+1; token<close; token++) {
+            if (isToken(token, close, ":")) group++;
+            if (isToken(token, close, ":") || isToken(token, close, ",")) continue;
+            if (token->type != TOKEN_identifier || group > 2)
+                ERRO(EXIT_FAILURE, "%s:%u: Operands are `outputs : inputs : clobbers`, each a list of names", line->file_path, line->line_num);
+
+            QbeOperand* operand = findQbeOperand(operands, num_operands, token->text, strlen(token->text));
+            if (operand == NULL) {
+                operand = &(operands[num_operands++]);
+                operand->token = token;
+                newTemp(cg, operand->bound);
+            }
+            if (group == 0) operand->is_output = true;
+            if (group == 1) {
+                CType type;
+                char  value[SYMBOL_LENGTH];
+                compileValue(cg, token, token+1, &type, value);
+                appendBuffer(&cg->text, "\t%s =%s copy %s\n", operand->bound, qbeType2str[qbeBaseType(type)], value);
+            }
+        }
+        open = close+1;
+    }
+    if (!isToken(open, end, "{")) ERRO(EXIT_FAILURE, "%s:%u: Expected the `{` of a `__qbe__` block", line->file_path, line->line_num);
+    const pToken close = matchingBracket(open, end);
+    for (pToken text = open+1; text<close; text++) {
+        if (text->type != TOKEN_stringConst) ERRO(EXIT_FAILURE, "%s:%u: `__qbe__` blocks only hold strings of QBE", text->origin->file_path, text->origin->line_num);
+        emitQbeText(cg, text->text, operands, num_operands);
+    }
+
+    for (uint i = 0; i<num_operands; i++) {
+        if (!operands[i].is_output) continue;
+        Place  place;
+        pToken at = operands[i].token;
+        char   address[SYMBOL_LENGTH];
+        compilePlace(cg, &at, at+1, &place);
+        if (place.in_memory) storeValue(cg, operands[i].bound, place.type, place.type, placeAddress(cg, &place, line, address), line);
+        else appendBuffer(&cg->text, "\t%s =%s copy %s\n", place.base, qbeType2str[qbeBaseType(place.type)], operands[i].bound);
+    }
+    cg->resume = close+1;
+    freeMemory(operands);
+}
+
+/* `__qbe__ printf("...")`, or a block of QBE */
+static void compileInlineQbe(pCodegen cg, const pToken tokens, const pToken end) {
+    if (isToken(tokens+1, end, "(") || isToken(tokens+1, end, "{")) {
+        compileQbeBlock(cg, tokens, end);
+        return;
+    }
+    const pToken builtin = tokens+1;
+    cg->resume = end;
+    if (builtin >= end || strcmp(builtin->text, "printf")!=0) {
+        ERRO(EXIT_FAILURE, "%s:%u: Only `__qbe__ printf(...)` and `__qbe__ { ... }` blocks are supported", tokens->origin->file_path, tokens->origin->line_num);
+    }
+
+    /* Only the first string could be the format */
+    pToken format = builtin;
+    while (format < end && format->type != TOKEN_stringConst) format++;
+    if (format == end) ERRO(EXIT_FAILURE, "%s:%u: `printf` needs a format string", tokens->origin->file_path, tokens->origin->line_num);
+    const uint fmt_id = cg->const_counter++;
+    appendBuffer(&cg->data, "data $s_const_%u_%u = { b %s, b 0 }\n", cg->job, fmt_id, format->text);
+    appendBuffer(&cg->text, "\tcall $printf(l $s_const_%u_%u, ...)\n", cg->job, fmt_id);
+}
+
+/* `f(...)` making up all of [call, end) in tail position. When `f` is the
+   function itself the parameters are rebound and it jumps back to its body,
+   which QBE's SSA construction turns into phis, so the recursion runs in
+   constant stack. Other calls are only marked, false for those and anything
+   that isn't a call. */
+static bool compileTailCall(pCodegen cg, const pToken call, const pToken end) {
+    if (call+1 >= end || call->type != TOKEN_identifier || !isToken(call+1, end, "(")) return false;
+    const pToken close = matchingBracket(call+1, end);
+    if (close+1 != end) return false;
+
+    const Function* self    = &(cg->function);
+    const Function* callee  = findFunction(cg->file, call->text);
+    bool            rebinds = call->text == self->name && !self->variadic;
+    for (uint i = 0; rebinds && i<self->num_params; i++)
+        rebinds = self->params[i].name && !isAggregateCType(self->params[i].type); /* Those point into the frame being reused */
+    if (!rebinds) {
+        cg->tail_call = callee && qbeBaseType(callee->ret) == qbeBaseType(self->ret) && isAggregateCType(callee->ret) == isAggregateCType(self->ret);
+        return false;
+    }
+
+    /* Every argument is worked out before any parameter changes, `f(b, a)` swaps them */
+    const pFileLine line = call->origin;
+    char (*values)[SYMBOL_LENGTH] = allocMemory(MEM_Codegen, (self->num_params ? self->num_params : 1) * SYMBOL_LENGTH);
+    uint count = 0;
+    for (pToken arg = call+2; arg<close; count++) {
+        const pToken comma = argumentEnd(arg, close);
+        if (count == self->num_params) ERRO(EXIT_FAILURE, "%s:%u: `%s` takes %u argument(s)", line->file_path, line->line_num, self->name, self->num_params);
+        const CType type = self->params[count].type;
+        CType arg_type;
+        char  value[SYMBOL_LENGTH], converted[SYMBOL_LENGTH];
+        compileValue(cg, arg, comma, &arg_type, value);
+        const char* passed = convertValue(cg, value, arg_type, type, NULL, converted);
+        if (passed[0] == '%' && strcmp(passed+1, self->params[count].name)==0) values[count][0] = 0; /* Passed on as it is */
+        else if (passed[0] == '%' && passed[1] != '.') appendBuffer(&cg->text, "\t%s =%s copy %s\n", newTemp(cg, values[count]), qbeType2str[qbeBaseType(type)], passed);
+        else strcpy(values[count], passed);
+        arg = comma < close ? comma+1 : close;
+    }
+    if (count != self->num_params) ERRO(EXIT_FAILURE, "%s:%u: `%s` takes %u argument(s)", line->file_path, line->line_num, self->name, self->num_params);
+
+    for (uint i = 0; i<count; i++) if (values[i][0])
+        appendBuffer(&cg->text, "\t%%%s =%s copy %s\n", self->params[i].name, qbeType2str[qbeBaseType(self->params[i].type)], values[i]);
+    appendBuffer(&cg->text, "\tjmp @body\n");
+    cg->terminated = true;
+    TRACE(TRACE_Codegen, TRACE_Debug, "%s:%u: `%s` calls itself in tail position, looping instead", line->file_path, line->line_num, self->name);
+    freeMemory(values);
+    cg->tail_loop = true;
+    return true;
+}
+
+/* A statement's tokens run on through the nodes of its `(`s and `[`s, all
+   next to each other in the tree's token array. It ends at its `;`, or at
+   the bracket closing whatever it started in. */
+static pToken findStatementEnd(const pToken tokens, const pToken last) {
+    uint depth = 0;
+    pToken at;
+    for (at = tokens; at<last; at++) {
+        if (at->type != TOKEN_operator || at->text[1] != 0) continue;
+        switch (at->text[0]) {
+            case '(': case '[': case '{': depth++; break;
+            case ')': case ']': case '}': if (depth-- == 0) return at; break;
+            case ';': if (depth == 0) return at; break;
+            default: break;
+        }
+    }
+    return at;
+}
+
+#define SWITCH_CHAIN_LIMIT   3    /* Case ranges up to which a switch tests them one by one rather than searching */
+#define SWITCH_TABLE_DENSITY 40   /* Percent of its span a switch's cases must cover to become a lookup table */
+#define SWITCH_TABLE_LIMIT   4096 /* Entries in one */
+
+typedef struct {
+    pToken  token;    /* Its `case` or `default` */
+    pToken  colon;
+    int64_t constant; /* Of a `case`, as the switched value's type */
+    uint    target;   /* First label of the run it falls through with, they share one block */
+} CaseLabel;
+
+/* Consecutive `case` values going to the same label */
+typedef struct {
+    int64_t lo, hi;
+    uint    target;
+} CaseRange;
+
+typedef struct switch_s {
+    uint       id;        /* Its labels are `@sw.<id>.*` */
+    pToken     close;     /* `}` of its body */
+    CaseLabel* labels;
+    uint       num_labels;
+    uint       num_tests; /* Blocks of the dispatch */
+} Switch;
+
+static bool caseBefore(const int64_t a, const int64_t b, const bool is_unsigned) {
+    return is_unsigned ? (uint64_t)a < (uint64_t)b : a < b;
+}
+
+/* Jumps to `ranges[from..to)`'s labels, `otherwise` when none holds `x`.
+   Short runs are tested in turn, longer ones split in half on the middle
+   range's low end so a switch of n ranges takes O(log n) compares. */
+static void emitCaseTests(pCodegen cg, Switch* sw, const char* x, const CType type, const CaseRange* ranges, const uint from, const uint to, const char* otherwise) {
+    const char k = type.kind == CT_Long ? 'l' : 'w';
+    char op[8], test[SYMBOL_LENGTH], bound[32];
+    if (to - from <= SWITCH_CHAIN_LIMIT) {
+        for (uint i = from; i<to; i++) {
+            const CaseRange* range = &ranges[i];
+            if (range->lo == range->hi) {
+                snprintf(op, sizeof(op), "ceq%c", k);
+                snprintf(bound, sizeof(bound), "%ld", (long)range->lo);
+                emitBinary(cg, op, QBE_Word, x, bound, test);
+            } else {
+                char offset[SYMBOL_LENGTH];
+                snprintf(bound, sizeof(bound), "%ld", (long)range->lo);
+                emitBinary(cg, "sub", qbeBaseType(type), x, bound, offset);
+                snprintf(op, sizeof(op), "cule%c", k);
+                snprintf(bound, sizeof(bound), "%ld", (long)foldCType(type, (int64_t)((uint64_t)range->hi - (uint64_t)range->lo)));
+                emitBinary(cg, op, QBE_Word, offset, bound, test);
+            }
+            if (i+1 < to) {
+                appendBuffer(&cg->text, "\tjnz %s, @sw.%u.%u, @sw.%u.t%u\n", test, sw->id, range->target, sw->id, sw->num_tests);
+                appendBuffer(&cg->text, "@sw.%u.t%u\n", sw->id, sw->num_tests++);
+            } else {
+                appendBuffer(&cg->text, "\tjnz %s, @sw.%u.%u, %s\n", test, sw->id, range->target, otherwise);
+            }
+        }
+        if (from == to) appendBuffer(&cg->text, "\tjmp %s\n", otherwise);
+        return;
+    }
+    const uint mid = from + (to - from)/2, left = sw->num_tests++, right = sw->num_tests++;
+    snprintf(op, sizeof(op), "c%clt%c", type.is_unsigned ? 'u' : 's', k);
+    snprintf(bound, sizeof(bound), "%ld", (long)ranges[mid].lo);
+    emitBinary(cg, op, QBE_Word, x, bound, test);
+    appendBuffer(&cg->text, "\tjnz %s, @sw.%u.t%u, @sw.%u.t%u\n", test, sw->id, left, sw->id, right);
+    appendBuffer(&cg->text, "@sw.%u.t%u\n", sw->id, left);
+    emitCaseTests(cg, sw, x, type, ranges, from, mid, otherwise);
+    appendBuffer(&cg->text, "@sw.%u.t%u\n", sw->id, right);
+    emitCaseTests(cg, sw, x, type, ranges, mid, to, otherwise);
+}
+
+/* What a table switch can hold: every run of labels just `return`s a
+   constant, or just sets the same variable to one and `break`s */
+typedef struct {
+    pToken  variable; /* NULL for a `return` */
+    int64_t value;
+} CaseResult;
+
+static bool matchCaseResult(const pCodegen cg, pToken at, const pToken end, const bool last, CaseResult* result) {
+    result->variable = NULL;
+    if (at < end && at->type == TOKEN_return) {
+        at++;
+    } else if (at+1 < end && at->type == TOKEN_identifier && isToken(at+1, end, "=")) {
+        result->variable = at;
+        at += 2;
+    } else {
+        return false;
+    }
+    if (!foldConstant(cg->file, &at, end, &(result->value), 1) || !isToken(at, end, ";")) return false;
+    at++;
+    if (result->variable && at+1 < end && at->type == TOKEN_break && isToken(at+1, end, ";")) at += 2;
+    else if (result->variable && !last) return false; /* Falls into the next case */
+    return at == end;
+}
+
+static void emitCaseResult(pCodegen cg, const Switch* sw, const CaseResult* result, const CType type, const char* value) {
+    if (result->variable == NULL) {
+        appendBuffer(&cg->text, "\tret %s\n", value);
+        return;
+    }
+    const pFileLine line = result->variable->origin;
+    Place  place;
+    pToken at = result->variable;
+    char   address[SYMBOL_LENGTH];
+    compilePlace(cg, &at, at+1, &place);
+    if (place.in_memory) storeValue(cg, value, type, place.type, placeAddress(cg, &place, line, address), line);
+    else appendBuffer(&cg->text, "\t%s =%s copy %s\n", place.base, qbeType2str[qbeBaseType(place.type)], value);
+    appendBuffer(&cg->text, "\tjmp @sw.%u.end\n", sw->id);
+}
+
+/* A dense switch whose cases only pick a constant becomes a bounds check and
+   a load from a table in data, whatever its size. QBE has no indirect jumps,
+   so this is as close to a jump table as its IL gets. False, with nothing
+   emitted, when the switch doesn't fit. */
+static bool compileTableSwitch(pCodegen cg, Switch* sw, const char* x, const CType type, const CaseLabel* labels, const uint num_cases, const int64_t min, const int64_t max) {
+    if (num_cases <= SWITCH_CHAIN_LIMIT) return false;
+    const uint64_t span = (uint64_t)max - (uint64_t)min + 1;
+    if (span == 0 || span > SWITCH_TABLE_LIMIT || num_cases * 100 < span * SWITCH_TABLE_DENSITY) return false;
+
+    /* Each run of labels ends where the next begins */
+    CaseResult* results = allocMemory(MEM_Codegen, sw->num_labels * sizeof(CaseResult));
+    const CaseLabel* fallback = NULL;
+    pToken variable = NULL;
+    bool   fits     = true;
+    for (uint i = 0; i<sw->num_labels && fits; i++) {
+        const CaseLabel* label = &(sw->labels[i]);
+        if (label->token->type == TOKEN_default) fallback = label;
+        if (i+1 < sw->num_labels && sw->labels[i+1].target == label->target) continue;
+        const pToken end = i+1 < sw->num_labels ? sw->labels[i+1].token : sw->close;
+        fits = matchCaseResult(cg, label->colon+1, end, end == sw->close, &results[label->target]) &&
+               (label->target == 0 || (results[label->target].variable ? results[label->target].variable->text : NULL) == (variable ? variable->text : NULL));
+        if (label->target == 0) variable = results[0].variable;
+    }
+    if (fits && span > num_cases && fallback == NULL) fits = false; /* Gaps need something to hold */
+
+    CType result_type = cg->ret_type;
+    if (fits && variable) {
+        const Variable* found = findVariable(cg, variable);
+        fits = found != NULL;
+        if (found) result_type = found->type;
+    }
+    if (!fits || !isIntegerCType(result_type) || result_type.pointers || result_type.length) {
+        freeMemory(results);
+        return false;
+    }
+
+    /* Every entry starts out as the default's, cases overwrite theirs */
+    int64_t* entries = allocMemory(MEM_Codegen, span * sizeof(int64_t));
+    for (uint64_t i = 0; i<span; i++) entries[i] = fallback ? results[fallback->target].value : 0;
+    for (uint i = 0; i<num_cases; i++) entries[(uint64_t)labels[i].constant - (uint64_t)min] = results[labels[i].target].value;
+
+    const uint     table = cg->const_counter++;
+    const uint     size  = sizeofCType(result_type);
+    const char     k     = type.kind == CT_Long ? 'l' : 'w';
+    const enum QbeType base = qbeBaseType(type);
+    appendBuffer(&cg->data, "data $sw_table_%u_%u = align %u { %s", cg->job, table, size, qbeType2str[qbeMemoryType(result_type)]);
+    for (uint64_t i = 0; i<span; i++) appendBuffer(&cg->data, " %ld", (long)foldCType(result_type, entries[i]));
+    appendBuffer(&cg->data, " }\n");
+
+    char index[SYMBOL_LENGTH], test[SYMBOL_LENGTH], offset[SYMBOL_LENGTH], bound[32], op[8];
+    snprintf(bound, sizeof(bound), "%ld", (long)min);
+    if (min) emitBinary(cg, "sub", base, x, bound, index);
+    else     strcpy(index, x);
+    snprintf(op, sizeof(op), "cult%c", k);
+    snprintf(bound, sizeof(bound), "%lu", (unsigned long)span);
+    emitBinary(cg, op, QBE_Word, index, bound, test);
+    appendBuffer(&cg->text, "\tjnz %s, @sw.%u.table, @sw.%u.%s\n", test, sw->id, sw->id, fallback ? "default" : "end");
+    appendBuffer(&cg->text, "@sw.%u.table\n", sw->id);
+    if (base == QBE_Word) appendBuffer(&cg->text, "\t%s =l extuw %s\n", newTemp(cg, offset), index);
+    else                  strcpy(offset, index);
+    snprintf(bound, sizeof(bound), "%u", size);
+    emitBinary(cg, "mul", QBE_Long, offset, bound, offset);
+    snprintf(bound, sizeof(bound), "$sw_table_%u_%u", cg->job, table);
+    emitBinary(cg, "add", QBE_Long, bound, offset, offset);
+
+    char value[SYMBOL_LENGTH];
+    appendBuffer(&cg->text, "\t%s =%s %s %s\n", newTemp(cg, value), qbeType2str[qbeBaseType(result_type)], loadInstr(result_type), offset);
+    emitCaseResult(cg, sw, &results[0], result_type, value);
+    if (fallback) {
+        appendBuffer(&cg->text, "@sw.%u.default\n", sw->id);
+        snprintf(value, SYMBOL_LENGTH, "%ld", (long)foldCType(result_type, results[fallback->target].value));
+        emitCaseResult(cg, sw, &results[fallback->target], result_type, value);
+    }
+    appendBuffer(&cg->text, "@sw.%u.end\n", sw->id);
+    TRACE(TRACE_Codegen, TRACE_Debug, "%s:%u: switch of %u case(s) over %lu value(s) is a lookup table",
+        sw->labels[0].token->origin->file_path, sw->labels[0].token->origin->line_num, num_cases, (unsigned long)span);
+    freeMemory(entries);
+    freeMemory(results);
+    return true;
+}
+
+/* Dispatches on the value and opens the switch, its body's statements are
+   compiled as the tree is walked and its `case`s become labels there */
+static void compileSwitch(pCodegen cg, const pToken tokens) {
+    const pFileLine line = tokens->origin;
+    const pToken    open = tokens+1;
+    if (!isToken(open, cg->tokens_end, "(")) ERRO(EXIT_FAILURE, "%s:%u: Expected `(` after `switch`", line->file_path, line->line_num);
+    const pToken close = matchingBracket(open, cg->tokens_end);
+    if (!isToken(close+1, cg->tokens_end, "{")) ERRO(EXIT_FAILURE, "%s:%u: Only switches with a `{}` body are supported", line->file_path, line->line_num);
+
+    CType value_type;
+    char  value[SYMBOL_LENGTH], converted[SYMBOL_LENGTH];
+    compileValue(cg, open+1, close, &value_type, value);
+    if (!isIntegerCType(value_type) || value_type.pointers || value_type.length)
+        ERRO(EXIT_FAILURE, "%s:%u: Can only switch on an integer", line->file_path, line->line_num);
+    const CType type = sizeofCType(value_type) < 4 ? CTYPE(CT_Int) : (CType){ .kind = value_type.kind, .is_unsigned = value_type.is_unsigned };
+    const char* x    = convertValue(cg, value, value_type, type, NULL, converted);
+
+    Switch sw = { .id = cg->num_blocks++, .close = matchingBracket(close+1, cg->tokens_end) };
+    uint   capacity = 0;
+    for (pToken at = close+2; at<sw.close; at++) {
+        if (at->type == TOKEN_switch && isToken(at+1, sw.close, "(")) {
+            const pToken inner = matchingBracket(at+1, sw.close); /* Its labels are its own */
+            at = isToken(inner+1, sw.close, "{") ? matchingBracket(inner+1, sw.close) : inner;
+            continue;
+        }
+        if (at->type != TOKEN_case && at->type != TOKEN_default) continue;
+
+        CaseLabel label = { .token = at, .colon = at+1, .target = sw.num_labels };
+        while (label.colon < sw.close && !isToken(label.colon, sw.close, ":")) label.colon++;
+        if (at->type == TOKEN_case) {
+            pToken folded = at+1;
+            if (!foldConstant(cg->file, &folded, label.colon, &label.constant, 1) || folded != label.colon)
+                ERRO(EXIT_FAILURE, "%s:%u: `case` needs an integer constant", at->origin->file_path, at->origin->line_num);
+            label.constant = foldCType(type, label.constant);
+        } else if (label.colon != at+1) {
+            ERRO(EXIT_FAILURE, "%s:%u: Expected `:` after `default`", at->origin->file_path, at->origin->line_num);
+        }
+        if (sw.num_labels && sw.labels[sw.num_labels-1].colon+1 == at) label.target = sw.labels[sw.num_labels-1].target;
+        if (sw.num_labels == capacity) {
+            capacity  = capacity ? 2*capacity : 16;
+            sw.labels = reallocMemory(MEM_Codegen, sw.labels, capacity * sizeof(CaseLabel));
+        }
+        sw.labels[sw.num_labels++] = label;
+        at = label.colon;
+    }
+
+    /* `case`s sorted by value, then runs of them merged into ranges */
+    uint       num_cases = 0, num_ranges = 0, fallback = 0;
+    bool       has_default = false;
+    CaseLabel* cases  = allocMemory(MEM_Codegen, (sw.num_labels ? sw.num_labels : 1) * sizeof(CaseLabel));
+    CaseRange* ranges = allocMemory(MEM_Codegen, (sw.num_labels ? sw.num_labels : 1) * sizeof(CaseRange));
+    for (uint i = 0; i<sw.num_labels; i++) {
+        if (sw.labels[i].token->type == TOKEN_default) {
+            if (has_default) ERRO(EXIT_FAILURE, "%s:%u: More than one `default`", sw.labels[i].token->origin->file_path, sw.labels[i].token->origin->line_num);
+            has_default = true;
+            fallback    = sw.labels[i].target;
+            continue;
+        }
+        uint at = num_cases++;
+        while (at && caseBefore(sw.labels[i].constant, cases[at-1].constant, type.is_unsigned)) {
+            cases[at] = cases[at-1];
+            at--;
+        }
+        cases[at] = sw.labels[i];
+    }
+    for (uint i = 0; i<num_cases; i++) {
+        if (i && cases[i].constant == cases[i-1].constant)
+            ERRO(EXIT_FAILURE, "%s:%u: Duplicate `case %ld`", cases[i].token->origin->file_path, cases[i].token->origin->line_num, (long)cases[i].constant);
+        if (num_ranges && ranges[num_ranges-1].target == cases[i].target && (uint64_t)ranges[num_ranges-1].hi + 1 == (uint64_t)cases[i].constant)
+            ranges[num_ranges-1].hi = cases[i].constant;
+        else
+            ranges[num_ranges++] = (CaseRange){ .lo = cases[i].constant, .hi = cases[i].constant, .target = cases[i].target };
+    }
+
+    if (num_cases && compileTableSwitch(cg, &sw, x, type, cases, num_cases, cases[0].constant, cases[num_cases-1].constant)) {
+        cg->resume = sw.close+1; /* Nothing in the body is left to compile */
+        freeMemory(sw.labels);
+    } else {
+        char otherwise[SYMBOL_LENGTH];
+        if (has_default) snprintf(otherwise, SYMBOL_LENGTH, "@sw.%u.%u", sw.id, fallback);
+        else             snprintf(otherwise, SYMBOL_LENGTH, "@sw.%u.end", sw.id);
+        emitCaseTests(cg, &sw, x, type, ranges, 0, num_ranges, otherwise);
+        TRACE(TRACE_Codegen, TRACE_Debug, "%s:%u: switch of %u case(s) in %u range(s) is a %s",
+            line->file_path, line->line_num, num_cases, num_ranges, num_ranges <= SWITCH_CHAIN_LIMIT ? "compare chain" : "binary search");
+        cg->terminated = true;
+        cg->resume     = close+1;
+        if (cg->num_switches == cg->switches_capacity) {
+            cg->switches_capacity = cg->switches_capacity ? 2*cg->switches_capacity : 4;
+            cg->switches = reallocMemory(MEM_Codegen, cg->switches, cg->switches_capacity * sizeof(Switch));
+        }
+        cg->switches[cg->num_switches++] = sw;
+    }
+    freeMemory(cases);
+    freeMemory(ranges);
+}
+
+/* The labels at the start of a `case` statement, returns what follows them */
+static pToken compileCaseLabels(pCodegen cg, const pToken tokens) {
+    if (cg->num_switches == 0) ERRO(EXIT_FAILURE, "%s:%u: `%s` outside of a `switch`", tokens->origin->file_path, tokens->origin->line_num, tokens->text);
+    const Switch* sw = &(cg->switches[cg->num_switches-1]);
+    pToken at = tokens;
+    while (at < cg->tokens_end && (at->type == TOKEN_case || at->type == TOKEN_default)) {
+        uint i = 0;
+        while (i<sw->num_labels && sw->labels[i].token != at) i++;
+        if (i == sw->num_labels) ERRO(EXIT_FAILURE, "%s:%u: Misplaced `%s`", at->origin->file_path, at->origin->line_num, at->text);
+        appendBuffer(&cg->text, "@sw.%u.%u\n", sw->id, i);
+        at = sw->labels[i].colon+1;
+    }
+    cg->terminated = false;
+    if (cg->debug_file && strcmp(tokens->origin->file_path, cg->debug_file)==0) appendBuffer(&cg->text, "\tdbgloc %u\n", tokens->origin->line_num);
+    return at;
+}
+
+static void closeSwitch(pCodegen cg) {
+    Switch* sw = &(cg->switches[--cg->num_switches]);
+    appendBuffer(&cg->text, "@sw.%u.end\n", sw->id);
+    cg->terminated = false;
+    freeMemory(sw->labels);
+}
+
+/* A counter for the function being compiled, or one of its blocks, bumped
+   by code added to `into`. Each is a `{ count, name }` record so the dump at
+   exit only needs the module's table of them, see `closeCodeFile`. */
+static void countBlock(pCodegen cg, const char* label, pBuffer into) {
+    char buffer[SYMBOL_LENGTH], record[SYMBOL_LENGTH], count[SYMBOL_LENGTH], bumped[SYMBOL_LENGTH];
+    const char* symbol = symbolName(cg->file, cg->function.name, buffer);
+    snprintf(record, SYMBOL_LENGTH, "$__quebec_prof_%u_%u", cg->job, cg->num_counters++);
+    appendBuffer(&cg->data, "data %s = align 8 { l 0, l %s_name }\n", record, record);
+    appendBuffer(&cg->data, "data %s_name = { b \"%s%s\", b 0 }\n", record, symbol, label);
+    appendBuffer(&cg->counters, "l %s, ", record);
+    appendBuffer(into, "\t%s =l loadl %s\n", newTemp(cg, count), record);
+    appendBuffer(into, "\t%s =l add %s, 1\n", newTemp(cg, bumped), count);
+    appendBuffer(into, "\tstorel %s, %s\n", bumped, record);
+}
+
+/* `end` is where the statement `tokens` starts ends, it can run on into later nodes */
+static void compileGrammar(pCodegen cg, const pToken tokens, const pToken end, const enum GrammarUnit grammar) {
     /* Example:
         function w $add(w %a, w %b) {              # Define a function add
         @start
@@ -202,95 +2086,103 @@ static void compileGrammar(FILE* fp, const pToken tokens, const enum GrammarUnit
         }
         data $fmt = { b "One and one make %d!\n", b 0 }
     */
-    static bool needs_auto_ret = true;   // FIXME: Doesn't seem to work
-    static pToken ret_type_token = NULL; // FIXME: Doesn't seem to work
     pToken temp = tokens;
-    char assignment[64] = {0};
     switch (grammar) {
         default: break;
 
         case GU_Fun_Decl: {
-            enum TokenType ret_type = TOKEN_invalid;
-            const char* identifier = "";
-            const char* args       = "";
+            freeMemory(cg->function.params);
+            Function* function = &(cg->function);
+            cg->resume     = parseFunction(cg->file, tokens, end, function) + 1; /* Parameters aren't locals to declare */
+            cg->ret_type   = function->ret;
+            cg->num_locals = 0;
+            cg->num_temps  = 0;
+            cg->num_blocks = 0;
+            cg->depth      = 0;
+            cg->terminated = false;
 
-            while (temp) {
-                if (isType(temp->type)) {
-                    ret_type_token = temp;
-                    ret_type   = temp->type;
-                }
-                if (isIdentifier(temp->type)) identifier = temp->text;
-                temp = temp->next;
+            /* Aggregates arrive as the address of a copy, narrow integers are
+               widened again since not every caller does it */
+            Buffer params = {0}, widen = {0};
+            char   abi[SYMBOL_LENGTH], name[SYMBOL_LENGTH];
+            for (uint i = 0; i<function->num_params; i++) {
+                const Variable* param = &(function->params[i]);
+                if (param->name) snprintf(name, SYMBOL_LENGTH, "%%%s", param->name);
+                else             newTemp(cg, name);
+                appendBuffer(&params, "%s%s %s", i ? ", " : "", abiType(param->type, tokens->origin, abi), name);
+                const char* instr = isIntegerCType(param->type) ? convertInstr(param->type, promotedCType(param->type)) : NULL;
+                if (instr) appendBuffer(&widen, "\t%s =w %s %s\n", name, instr, name);
+                if (param->name) addLocal(cg, param->name, param->type, NULL);
             }
+            if (function->variadic) appendBuffer(&params, "%s...", params.length ? ", " : "");
 
-            if (ret_type != TOKEN_void) {
-                needs_auto_ret = false; // FIXME: Fails if you declare functions in a scope? Is this even common?
+            /* QBE only takes a `dbgfile` between functions, so each one names its own */
+            if (cg->file->options.debug_lines) {
+                cg->debug_file = tokens->origin->file_path;
+                appendBuffer(&cg->text, "dbgfile \"");
+                for (const char* c = cg->debug_file; *c; c++) appendBuffer(&cg->text, "%s%c", *c == '"' || *c == '\\' ? "\\" : "", *c);
+                appendBuffer(&cg->text, "\"\n");
             }
-
-            if (strcmp(identifier, "main")==0) fprintf(fp, "export ");
-            fprintf(fp, "function %s $%s(%s) {\n",
-                qbeType2str[getQbeType(ret_type)],
-                identifier,
-                args
+            /* Other units link against every function that isn't `static`, like globals */
+            bool is_static = false;
+            for (pToken token = tokens; token<end && !isToken(token, end, "("); token++)
+                if (token->type == TOKEN_static) is_static = true;
+            char symbol[SYMBOL_LENGTH];
+            if (!is_static) appendBuffer(&cg->text, "export ");
+            appendBuffer(&cg->text, "function %s $%s(%s) {\n",
+                abiType(cg->ret_type, tokens->origin, abi),
+                symbolName(cg->file, function->name, symbol),
+                params.text ? params.text : ""
             );
-            fprintf(fp, "@start\n");
+            appendBuffer(&cg->text, "@start\n");
+            if (cg->debug_file) appendBuffer(&cg->text, "\tdbgloc %u\n", tokens->origin->line_num);
+            appendBuffer(&cg->text, "%s", widen.text ? widen.text : "");
+            cg->body_offset = cg->text.length;
+            freeMemory(params.text);
+            freeMemory(widen.text);
             break;
         }
 
         case GU_Fun_Call: {
-            const char* identifier = temp->text;
-            const char* args = "";
-            fprintf(fp, "\tcall $%s(%s)\n", identifier, args);
+            pToken at = tokens+1;
+            cg->resume = end;
+            /* Right before the `}` of a `void` function */
+            if (cg->ret_type.kind == CT_Void && cg->ret_type.pointers == 0 && cg->depth == 1 && isToken(end+1, cg->tokens_end, "}") && compileTailCall(cg, tokens, end))
+                break;
+            compileCall(cg, tokens, &at, end, NULL, NULL);
+            if (at != end) ERRO(EXIT_FAILURE, "%s:%u: Only single values and constants are supported so far", at->origin->file_path, at->origin->line_num);
             break;
         }
 
+        case GU_Decl_Chain: /* Ends at its `[`, or its `{` when it defines a struct or union */
+            if (isAggregateDefinition(tokens)) {
+                if (!cg->at_top_level) ERRO(EXIT_FAILURE, "%s:%u: Only file-scope structs and unions are supported so far",
+                    tokens->origin->file_path, tokens->origin->line_num);
+                cg->resume = end; /* Laid out by `collectSymbols` already */
+                compileAggregateType(cg, tokens);
+                break;
+            }
+            /* fall through */
         case GU_Var_Defn:
         case GU_Var_Decl: {
-            enum TokenType var_type = TOKEN_invalid;
-            const char* identifier = "";
-            bool using_data_seg = false;
-            sprintf(assignment, (grammar == GU_Var_Decl) ? "0" : "");
-
-            while (temp) {
-                if (isType(temp->type))       var_type   = temp->type;
-                if (isIdentifier(temp->type)) identifier = temp->text;
-                if (isConst(temp->type))      {
-                    switch (temp->type) {
-                        default: break;
-                        case TOKEN_intConst   : sprintf(assignment, "%ld", strtol(temp->text, NULL, 10)); break;
-                        case TOKEN_hexConst   : sprintf(assignment, "%ld", strtol(temp->text, NULL, 16)); break;
-                        case TOKEN_floatConst : sprintf(assignment,  "s_%f", strtof(temp->text, NULL    )); break;
-                        case TOKEN_doubleConst: {
-                            if (var_type == TOKEN_float) ERRO(EXIT_FAILURE, "Replace `float` with `double` to store this amount of precision"); 
-                            sprintf(assignment,  "d_%f", strtod(temp->text, NULL    ));
-                            break;
-                        }
-                        case TOKEN_charConst  : sprintf(assignment,  "%d", temp->text[1]); break;
-                        case TOKEN_stringConst: {
-                            using_data_seg = true;
-                            char buf[64] = {0};
-                            sprintf(buf, "data $s_const_%u = { b %s, b 0 }\n", global_ConstCounter++, temp->text);
-                            strncat(data_seg, buf, 64);
-                            break;
-                        }
-                    }
-                }
-                temp = temp->next;
-            }
-
-            if (!using_data_seg)
-                fprintf(fp, "\t%%%s =%s sub 0, %s\n", identifier, qbeType2str[getQbeType(var_type)], assignment);
+            cg->resume = end;
+            compileDeclaration(cg, tokens, end);
             break;
         }
 
+        case GU_Expr_Or_Call: /* `a[i] = ...` ends its first node at the `[` */
         case GU_Expression: {
+            if ((tokens->type == TOKEN_identifier || isToken(tokens, end, "*")) && compileAssignment(cg, tokens, end)) {
+                cg->resume = end;
+                break;
+            }
+            if (grammar == GU_Expr_Or_Call) break;
+
             /* First pass to pull out data segment constants */
 
             while (temp) {
                 if (temp->type == TOKEN_stringConst) {
-                    char buf[64] = {0};
-                    sprintf(buf, "data $s_const_%u = { b %s, b 0 }\n", global_ConstCounter++, temp->text);
-                    strncat(data_seg, buf, 64);
+                    appendBuffer(&cg->data, "data $s_const_%u_%u = { b %s, b 0 }\n", cg->job, cg->const_counter++, temp->text);
                     break;
                 }
                 temp = temp->next;
@@ -298,71 +2190,587 @@ static void compileGrammar(FILE* fp, const pToken tokens, const enum GrammarUnit
             break;
         }
 
+        case GU_New_Args: /* `(*p).x = ...` */
+            if (!cg->at_top_level && compileAssignment(cg, tokens, end)) cg->resume = end;
+            break;
+
         case GU_Qbe_Call: {
-            compileInlineQbe(fp, tokens, grammar, data_seg);
+            compileInlineQbe(cg, tokens, end);
             break;
         }
 
         case GU_Ret_Stmt: {
-            needs_auto_ret = false;
-            ret_type_token = NULL; // FIXME: Dirty hack
+            cg->resume = end;
+
+            if (compileTailCall(cg, tokens+1, end)) break;
 
             const char* ret_val = "0";
-            fprintf(fp, "\tret %s\n", ret_val);
-            // FIXME: Type match checking with return value in function header!
+            char value[SYMBOL_LENGTH], converted[SYMBOL_LENGTH];
+            if (tokens+1 < end) {
+                CType value_type;
+                compileValue(cg, tokens+1, end, &value_type, value);
+                if (cg->ret_type.kind != CT_Void || cg->ret_type.pointers)
+                    ret_val = convertValue(cg, value, value_type, cg->ret_type, NULL, converted);
+            }
+            appendBuffer(&cg->text, "\tret %s\n", ret_val);
+            cg->terminated = true;
+            break;
+        }
+
+        case GU_Switch_Stmt: {
+            compileSwitch(cg, tokens);
+            break;
+        }
+
+        case GU_Case_Label: {
+            const pToken rest = compileCaseLabels(cg, tokens);
+            if (rest < cg->tokens_end && !isToken(rest, cg->tokens_end, ";"))
+                compileGrammar(cg, rest, findStatementEnd(rest, cg->tokens_end), predictGrammarTokens(rest));
+            break;
+        }
+
+        case GU_Break_Stmt: {
+            if (cg->num_switches == 0) ERRO(EXIT_FAILURE, "%s:%u: `break` outside of a `switch`, loops aren't supported yet",
+                tokens->origin->file_path, tokens->origin->line_num);
+            if (!cg->terminated) appendBuffer(&cg->text, "\tjmp @sw.%u.end\n", cg->switches[cg->num_switches-1].id);
+            cg->terminated = true;
+            cg->resume     = end;
+            break;
+        }
+
+        case GU_New_Scope: {
+            cg->depth++;
             break;
         }
 
         case GU_End_Scope: {
-            if (needs_auto_ret || ret_type_token) { // FIXME: Will crap out for nested scopes like if/while/for/etc.
-                // if (ret_type_token) {
-                //     WARN("Missing return statement around function end:");
-                //     dumpFileLine(tokens->origin);
-                //     printf("\n");
-                // }
-
-                fprintf(fp, "\tret 0\n");
-                needs_auto_ret = true;
-                ret_type_token = NULL;
+            if (cg->depth) cg->depth--;
+            if (cg->num_switches && tokens == cg->switches[cg->num_switches-1].close) {
+                closeSwitch(cg);
+                break;
             }
-            fprintf(fp, "}\n\n");
+            if (cg->depth) break; /* A block inside the function */
+
+            /* Falling off the end, only well-defined for `void` but harmless for the rest */
+            if (!cg->terminated) {
+                if (cg->debug_file && strcmp(tokens->origin->file_path, cg->debug_file)==0)
+                    appendBuffer(&cg->text, "\tdbgloc %u\n", tokens->origin->line_num);
+                appendBuffer(&cg->text, "\tret 0\n");
+            }
+            if (cg->tail_loop) {
+                Buffer body = {0};
+                appendBuffer(&body, "@body\n");
+                if (cg->file->options.instrument) countBlock(cg, "@body", &body);
+                insertBuffer(&cg->text, cg->body_offset, body.text);
+                freeMemory(body.text);
+            }
+            if (cg->file->options.instrument && cg->function.name) countBlock(cg, "", &cg->allocs); /* Once per call, ahead of `@body` */
+            if (cg->allocs.length) insertBuffer(&cg->text, cg->body_offset, cg->allocs.text);
+            cg->allocs.length = 0;
+            cg->tail_loop     = false;
+            cg->debug_file    = NULL;
+            cg->terminated    = false;
+            appendBuffer(&cg->text, "}\n\n");
             break;
         }
     }
 }
 
-void compileSyntaxNode(FILE* fp, const pSyntaxNode snode, Block data_seg) {
-    if (snode->tokens == NULL) return; /* Master node for file has no tokens  */
-    if (strcmp(snode->tokens->text, ";")==0) return; /* Extraneous semicolons */
+static pToken statementEnd(const pSyntaxTree tree, const pToken tokens) {
+    return findStatementEnd(tokens, tree->tokens + tree->num_tokens);
+}
+
+static void compileSyntaxNode(pCodegen cg, const pSyntaxTree tree, const pSyntaxNode snode) {
+    const pToken tokens = nodeTokens(tree, snode);
+    if (tokens == NULL) return; /* Master node for file has no tokens  */
+    if (strcmp(tokens->text, ";")==0) return; /* Extraneous semicolons */
+    if (tokens < cg->resume) return;
+    cg->at_top_level = snode->parent == NO_NODE;
+
+    const pFileLine curr_line = tokens->origin;
+    bool line_changed = false;
+    if (curr_line != cg->last_line) {
+        appendBuffer(&cg->text, "# %s:%u: %s\n", curr_line->file_path, curr_line->line_num, curr_line->text);
+        cg->last_line = curr_line;
+        line_changed  = true;
+    }
+
+    const enum GrammarUnit grammar = predictGrammarTokens(tokens);
+    if (grammar == GU_Invalid) ERRO(EXIT_FAILURE, "Syntax Error");
+    /* Code after a `return` or `break` still needs a block to live in, QBE wants one after every jump */
+    if (cg->terminated && cg->depth && grammar != GU_Case_Label && grammar != GU_New_Scope && grammar != GU_End_Scope) {
+        appendBuffer(&cg->text, "@dead.%u\n", cg->num_blocks++);
+        cg->terminated = false;
+    }
+    /* A function's closing line only has code when it returns implicitly, see `GU_End_Scope`,
+       a `case`'s after its labels */
+    if (line_changed && grammar != GU_End_Scope && grammar != GU_Case_Label && cg->debug_file && strcmp(curr_line->file_path, cg->debug_file)==0)
+        appendBuffer(&cg->text, "\tdbgloc %u\n", curr_line->line_num);
+
+    /* Prototypes (e.g. pulled in from headers) only declare, the `;` follows the argument list */
+    const pToken after = snode->next != NO_NODE ? nodeTokens(tree, treeNode(tree, snode->next)) : NULL;
+    if (grammar == GU_Fun_Decl && after && strcmp(after->text, ";")==0) {
+        cg->resume = statementEnd(tree, tokens); /* Nor are its parameters */
+        return;
+    }
+    TRACE(TRACE_Codegen, TRACE_Debug, "%s:%u: %s", curr_line->file_path, curr_line->line_num, strGrammarUnit[grammar]);
+    compileGrammar(cg, tokens, statementEnd(tree, tokens), grammar);
+}
+
+typedef struct {
+    pSyntaxTree tree;
+    pCodegen    jobs;
+    uint*       pending; /* Jobs the code cache missed, all of them without one */
+} CompileContext;
+
+/* Nodes are pooled in pre-order, so a linear sweep visits a job's subtrees depth-first */
+static void compileJob(void* context, const uint job) {
+    const CompileContext* ctx = context;
+    pCodegen cg = &ctx->jobs[ctx->pending ? ctx->pending[job] : job];
+    cg->tokens_end = ctx->tree->tokens + ctx->tree->num_tokens;
+    for (NodeId id = cg->first; id<cg->end; id++)
+        compileSyntaxNode(cg, ctx->tree, treeNode(ctx->tree, id));
+}
+
+/* A job starts at every top-level node that follows a finished function or declaration, see `endsUnit` */
+static uint splitJobs(const pSyntaxTree tree, pCodegen* jobs) {
+    uint num_jobs = 0;
+    bool ended    = true;
+    for (NodeId id = treeNode(tree, NO_NODE)->children; id != NO_NODE; id = treeNode(tree, id)->next) {
+        num_jobs += ended;
+        ended     = endsUnit(tree, treeNode(tree, id));
+    }
+
+    *jobs = callocMemory(MEM_Codegen, num_jobs ? num_jobs : 1, sizeof(struct codegen_s));
+    uint job = 0;
+    ended    = true;
+    for (NodeId id = treeNode(tree, NO_NODE)->children; id != NO_NODE; id = treeNode(tree, id)->next) {
+        const bool starts = ended;
+        ended = endsUnit(tree, treeNode(tree, id));
+        if (starts) {
+            if (job) (*jobs)[job-1].end = id;
+            (*jobs)[job] = (struct codegen_s){
+                .job            = job,
+                .first          = id,
+                .end            = tree->num_nodes,
+            };
+            job++;
+        }
+    }
+    return num_jobs;
+}
+
+typedef struct code_entry_s {
+    uint64_t hash;
+    uint     job;  /* Data symbols stay put while the entry lives */
+    bool     used;
+    Buffer   text;
+    Buffer   data;
+    Buffer   counters;
+    const char* function; /* Defined by the job, if any */
+    struct code_entry_s* next;
+} *pCodeEntry;
+
+struct code_cache_s {
+    pCodeEntry buckets[CODE_CACHE_BUCKETS];
+};
+
+static uint global_CachedJobs = 0; /* Ids across every cache, units sharing a `--unity` module never collide */
+
+pCodeCache newCodeCache(void) {
+    return callocMemory(MEM_Codegen, 1, sizeof(struct code_cache_s));
+}
 
-    static uint line_to_print = 1;
-    if (snode->tokens) {
-        const pFileLine curr_line = snode->tokens->origin;
-        if (curr_line->line_num >= line_to_print) {
-            fprintf(fp, "# "); fprintfFileLine(fp, snode->tokens->origin);
-            line_to_print = curr_line->line_num+1;
+static void delCodeEntry(pCodeEntry entry) {
+    freeMemory(entry->text.text);
+    freeMemory(entry->data.text);
+    freeMemory(entry->counters.text);
+    freeMemory(entry);
+}
+
+void delCodeCache(pCodeCache* cache) {
+    if (cache == NULL || *cache == NULL) return;
+    for (uint i = 0; i<CODE_CACHE_BUCKETS; i++) {
+        pCodeEntry entry = (*cache)->buckets[i];
+        while (entry) {
+            pCodeEntry next = entry->next;
+            delCodeEntry(entry);
+            entry = next;
         }
     }
+    freeMemory(*cache);
+    *cache = NULL;
+}
 
-    const enum GrammarUnit grammar = predictGrammarTokens(fp, snode->tokens);
-    if (grammar == GU_Invalid) ERRO(EXIT_FAILURE, "Syntax Error");
-    compileGrammar(fp, snode->tokens, grammar, data_seg);
+static uint64_t hashBytes(uint64_t hash, const void* bytes, const size_t length) {
+    for (size_t i = 0; i<length; i++) {
+        hash ^= ((const unsigned char*)bytes)[i];
+        hash *= 1099511628211ull; /* FNV-1a */
+    }
+    return hash;
+}
+
+/* Aggregates by their tag, the same definition is at a new address every build */
+static uint64_t hashCType(uint64_t hash, const CType type) {
+    hash = hashBytes(hash, &(type.kind), sizeof(type.kind));
+    hash = hashBytes(hash, &(type.is_unsigned), sizeof(type.is_unsigned));
+    hash = hashBytes(hash, &(type.pointers), sizeof(type.pointers));
+    hash = hashBytes(hash, &(type.length), sizeof(type.length));
+    const char* tag = type.aggregate ? type.aggregate->tag : NULL;
+    return hashBytes(hash, &tag, sizeof(tag));
 }
 
-void compileTree(FILE* fp, const pSyntaxNode head, Block data_seg) {
-    if (head == NULL) return;
-    compileSyntaxNode(fp, head, data_seg);
-    compileTree(fp, head->children, data_seg);
-    compileTree(fp, head->next, data_seg);
+/* Everything the job's output depends on, down to the source lines echoed as comments */
+static uint64_t hashJob(const pSyntaxTree tree, const pCodegen cg) {
+    uint64_t  hash = 14695981039346656037ull;
+    pFileLine line = NULL;
+    hash = hashBytes(hash, &(cg->file->unit), sizeof(cg->file->unit));
+    hash = hashBytes(hash, &(cg->file->options.instrument), sizeof(cg->file->options.instrument));
+    hash = hashBytes(hash, &(cg->file->options.debug_lines), sizeof(cg->file->options.debug_lines));
+    hash = hashBytes(hash, cg->file->statics, cg->file->num_statics * sizeof(char*));
+    for (uint i = 0; i<cg->file->num_globals; i++) {
+        hash = hashBytes(hash, &(cg->file->globals[i].name), sizeof(char*));
+        hash = hashCType(hash, cg->file->globals[i].type);
+    }
+    for (uint i = 0; i<cg->file->num_functions; i++) {
+        const Function* function = &(cg->file->functions[i]);
+        hash = hashBytes(hash, &(function->name), sizeof(function->name));
+        hash = hashBytes(hash, &(function->variadic), sizeof(function->variadic));
+        hash = hashCType(hash, function->ret);
+        for (uint p = 0; p<function->num_params; p++) hash = hashCType(hash, function->params[p].type);
+    }
+    for (const Aggregate* aggregate = cg->file->aggregates; aggregate; aggregate = aggregate->next) {
+        hash = hashBytes(hash, &(aggregate->symbol), sizeof(aggregate->symbol));
+        for (uint f = 0; f<aggregate->num_fields; f++) {
+            hash = hashBytes(hash, &(aggregate->fields[f].name), sizeof(char*));
+            hash = hashBytes(hash, &(aggregate->fields[f].offset), sizeof(uint));
+            hash = hashCType(hash, aggregate->fields[f].type);
+        }
+    }
+    for (NodeId id = cg->first; id<cg->end; id++) {
+        const pSyntaxNode snode = treeNode(tree, id);
+        hash = hashBytes(hash, &(snode->num_tokens), sizeof(snode->num_tokens));
+        for (pToken token = nodeTokens(tree, snode); token; token = token->next) {
+            hash = hashBytes(hash, &(token->type), sizeof(token->type));
+            hash = hashBytes(hash, token->text, strlen(token->text)+1);
+            if (token->origin == line) continue;
+            line = token->origin;
+            hash = hashBytes(hash, &(line->line_num), sizeof(line->line_num));
+            hash = hashBytes(hash, line->file_path, strlen(line->file_path)+1);
+            hash = hashBytes(hash, line->text, strlen(line->text)+1);
+        }
+    }
+    return hash;
+}
+
+/* Hands cached output to the jobs it still fits, returns how many are left to compile */
+static uint lookupJobs(pCodeCache cache, CompileContext* ctx, const uint num_jobs, uint64_t* hashes) {
+    uint num_pending = 0;
+    for (uint job = 0; job<num_jobs; job++) {
+        hashes[job] = hashJob(ctx->tree, &ctx->jobs[job]);
+        pCodeEntry entry = cache->buckets[hashes[job] % CODE_CACHE_BUCKETS];
+        while (entry && (entry->hash != hashes[job] || entry->used)) entry = entry->next;
+
+        if (entry) {
+            entry->used = true;
+            ctx->jobs[job].job  = entry->job;
+            ctx->jobs[job].text = entry->text;
+            ctx->jobs[job].data = entry->data;
+            ctx->jobs[job].counters      = entry->counters;
+            ctx->jobs[job].function.name = entry->function;
+        } else {
+            ctx->jobs[job].job = global_CachedJobs++;
+            ctx->pending[num_pending++] = job;
+        }
+    }
+    return num_pending;
+}
+
+/* Keeps what was just compiled and drops what no longer appears */
+static void storeJobs(pCodeCache cache, const CompileContext* ctx, const uint num_pending, const uint64_t* hashes) {
+    for (uint i = 0; i<num_pending; i++) {
+        const pCodegen cg    = &ctx->jobs[ctx->pending[i]];
+        pCodeEntry     entry = allocMemory(MEM_Codegen, sizeof(*entry));
+        pCodeEntry*    bucket = &(cache->buckets[hashes[ctx->pending[i]] % CODE_CACHE_BUCKETS]);
+        *entry = (struct code_entry_s){
+            .hash = hashes[ctx->pending[i]],
+            .job  = cg->job,
+            .used = true,
+            .text = cg->text,
+            .data = cg->data,
+            .counters = cg->counters,
+            .function = cg->function.name,
+            .next = *bucket
+        };
+        *bucket = entry;
+    }
+
+    for (uint i = 0; i<CODE_CACHE_BUCKETS; i++) {
+        pCodeEntry* link = &(cache->buckets[i]);
+        while (*link) {
+            pCodeEntry entry = *link;
+            if (entry->used) {
+                entry->used = false;
+                link = &(entry->next);
+            } else {
+                *link = entry->next;
+                delCodeEntry(entry);
+            }
+        }
+    }
+}
+
+pCodeFile openCodeFile(const char* output_path, const CodeOptions* options) {
+    FILE* fp = fopen(output_path, "w");
+    if (fp == NULL) ERRO(EXIT_FAILURE, "Could not open (%s) for writing", output_path);
+
+    pCodeFile file = allocMemory(MEM_Codegen, sizeof(*file));
+    *file = (struct code_file_s){ .fp = fp, .path = strdupMemory(MEM_Codegen, output_path), .options = *options };
+    return file;
+}
+
+typedef struct held_job_s {
+    char*    text;
+    size_t   length;
+    uint64_t count;       /* Calls of its function in the profile */
+    bool     is_function;
+    uint     order;       /* In the module, ties keep it */
+} HeldJob;
+
+/* What a job wrote, in the order jobs are stitched. With a profile its text
+   waits for `closeCodeFile` to sort it. */
+static void emitJob(pCodeFile file, const pCodegen cg) {
+    if (cg->data.length)     appendBuffer(&file->data, "%s", cg->data.text);
+    if (cg->counters.length) appendBuffer(&file->counters, "%s", cg->counters.text);
+    if (cg->text.length == 0) return;
+    if (file->options.profile == NULL) {
+        fwrite(cg->text.text, 1, cg->text.length, file->fp);
+        return;
+    }
+
+    char symbol[SYMBOL_LENGTH];
+    const HeldJob held = {
+        .text        = strdupMemory(MEM_Codegen, cg->text.text),
+        .length      = cg->text.length,
+        .count       = cg->function.name ? profileCount(file->options.profile, internString(symbolName(file, cg->function.name, symbol))) : 0,
+        .is_function = cg->function.name != NULL,
+        .order       = file->num_held
+    };
+    if (file->num_held == file->held_capacity) {
+        file->held_capacity = file->held_capacity ? 2*file->held_capacity : 64;
+        file->held = reallocMemory(MEM_Codegen, file->held, file->held_capacity * sizeof(HeldJob));
+    }
+    file->held[file->num_held++] = held;
+}
+
+static void clearFunctions(pCodeFile file) {
+    for (uint i = 0; i<file->num_functions; i++) freeMemory(file->functions[i].params);
+    file->num_functions = 0;
+}
+
+static void clearAggregates(pCodeFile file) {
+    while (file->aggregates) {
+        pAggregate next = file->aggregates->next;
+        freeMemory(file->aggregates->fields);
+        freeMemory(file->aggregates);
+        file->aggregates = next;
+    }
+}
+
+void startCodeUnit(pCodeFile file) {
+    file->unit++;
+    file->num_statics = 0;
+    file->num_globals = 0;
+    clearFunctions(file);
+    clearAggregates(file);
+}
+
+/* Declarations come before use, so a unit's file-scope names are known by
+   the time any job refers to them, whichever thread it runs on */
+static void collectSymbols(pCodeFile file, const pSyntaxTree tree) {
+    bool ended = true;
+    for (NodeId id = treeNode(tree, NO_NODE)->children; id != NO_NODE; id = treeNode(tree, id)->next) {
+        const pToken tokens = nodeTokens(tree, treeNode(tree, id));
+        const bool   starts = ended;
+        ended = endsUnit(tree, treeNode(tree, id));
+        if (!starts) continue;
+        const enum GrammarUnit grammar = predictGrammarTokens(tokens);
+
+        bool        is_static  = false;
+        const char* identifier = NULL;
+        for (pToken temp = tokens; temp; temp = temp->next) {
+            if (temp->type == TOKEN_static)  is_static  = true;
+            if (isIdentifier(temp->type))    identifier = temp->text;
+        }
+        if (grammar == GU_Decl_Chain && isAggregateDefinition(tokens)) {
+            defineAggregate(file, tokens, statementEnd(tree, tokens));
+            continue;
+        }
+        if (grammar == GU_Var_Decl || grammar == GU_Var_Defn || grammar == GU_Decl_Chain) {
+            pToken   initializer;
+            Variable global = { .symbol = NULL };
+            global.type   = declaredCType(file, tokens, statementEnd(tree, tokens), &(global.name), &initializer);
+            global.symbol = identifier = global.name;
+            if (global.name) insertName(&(file->globals), &(file->num_globals), &(file->globals_capacity), sizeof(Variable), &global);
+        } else if (grammar == GU_Fun_Decl) {
+            Function function;
+            parseFunction(file, tokens, statementEnd(tree, tokens), &function);
+            if (!insertName(&(file->functions), &(file->num_functions), &(file->functions_capacity), sizeof(Function), &function))
+                freeMemory(function.params); /* Declared already */
+        } else {
+            continue;
+        }
+        if (is_static && identifier && file->unit != 0)
+            insertName(&(file->statics), &(file->num_statics), &(file->statics_capacity), sizeof(char*), &identifier);
+    }
 }
 
-void compileFile(const char* output_path, pSyntaxNode master) {
-    Block data_seg = {0};
-    
-    FILE* fp = fopen("temp.ssa", "w");
-    compileTree(fp, master, data_seg);
+void compileTree(pCodeFile file, const pSyntaxTree tree, const uint workers, pCodeCache cache) {
+    collectSymbols(file, tree);
+
+    CompileContext ctx = { .tree = tree };
+    const uint num_jobs = splitJobs(tree, &ctx.jobs);
+    for (uint job = 0; job<num_jobs; job++) {
+        ctx.jobs[job].file = file;
+        ctx.jobs[job].job += file->num_jobs;
+    }
+    file->num_jobs += num_jobs;
+
+    uint64_t*  hashes   = NULL;
+    uint num_pending    = num_jobs;
+    if (cache) {
+        hashes      = allocMemory(MEM_Codegen, (num_jobs ? num_jobs : 1) * sizeof(uint64_t));
+        ctx.pending = allocMemory(MEM_Codegen, (num_jobs ? num_jobs : 1) * sizeof(uint));
+        num_pending = lookupJobs(cache, &ctx, num_jobs, hashes);
+    }
+    TRACE(TRACE_Codegen, TRACE_Info, "Emitting (%s) from %u node(s) in %u job(s), %u cached",
+        file->path, tree->num_nodes, num_jobs, num_jobs - num_pending);
+    runPool(workers, num_pending, compileJob, &ctx);
+
+    /* Stitch in source order, data segment at very bottom */
+    for (uint job = 0; job<num_jobs; job++) emitJob(file, &ctx.jobs[job]);
 
-    /* Dump out data segment at very bottom */
-    if (data_seg[0] != 0) fprintf(fp, "\n# Data Segment\n%s\n", data_seg); /* O(1) vs O(n) `strlen` */
-    if (fp) fclose(fp);
-}
\ No newline at end of file
+    if (cache) {
+        storeJobs(cache, &ctx, num_pending, hashes); /* Buffers now belong to the cache */
+        freeMemory(ctx.pending);
+        freeMemory(hashes);
+    } else {
+        for (uint job = 0; job<num_jobs; job++) {
+            freeMemory(ctx.jobs[job].text.text);
+            freeMemory(ctx.jobs[job].data.text);
+            freeMemory(ctx.jobs[job].counters.text);
+        }
+    }
+    for (uint job = 0; job<num_jobs; job++) {
+        freeMemory(ctx.jobs[job].locals);
+        freeMemory(ctx.jobs[job].function.params);
+        freeMemory(ctx.jobs[job].allocs.text);
+        freeMemory(ctx.jobs[job].switches);
+    }
+    freeMemory(ctx.jobs);
+}
+
+void compileUnit(pCodeFile file, const pSyntaxTree tree) {
+    CompileContext ctx = { .tree = tree };
+    collectSymbols(file, tree);
+    struct codegen_s cg = {
+        .file           = file,
+        .job            = file->num_jobs++,
+        .first          = 0,
+        .end            = tree->num_nodes,
+    };
+    ctx.jobs = &cg;
+    compileJob(&ctx, 0);
+
+    emitJob(file, &cg);
+    freeMemory(cg.text.text);
+    freeMemory(cg.data.text);
+    freeMemory(cg.counters.text);
+    freeMemory(cg.locals);
+    freeMemory(cg.function.params);
+    freeMemory(cg.allocs.text);
+    freeMemory(cg.switches);
+}
+
+/* Declarations and types stay ahead of every function, which QBE needs of
+   types, then functions from most to least called */
+static int compareHeldJobs(const void* a, const void* b) {
+    const HeldJob* x = a;
+    const HeldJob* y = b;
+    if (x->is_function != y->is_function) return x->is_function - y->is_function;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void writeHeldJobs(pCodeFile file) {
+    if (file->num_held) qsort(file->held, file->num_held, sizeof(HeldJob), compareHeldJobs);
+    for (uint i = 0; i<file->num_held; i++) {
+        fwrite(file->held[i].text, 1, file->held[i].length, file->fp);
+        freeMemory(file->held[i].text);
+    }
+    TRACE(TRACE_Codegen, TRACE_Info, "Laid out (%s) hot-first over %u job(s)", file->path, file->num_held);
+    freeMemory(file->held);
+}
+
+/* Walks the table of counter records at exit and appends `<name> <count>`
+   lines to the profile. Local to the module, each one registers its own. */
+static void writeProfileDump(pCodeFile file) {
+    fputs("# Profile counters, appended to $" PROFILE_ENV " (or " PROFILE_DEFAULT ") at exit\n"
+          "function $__quebec_prof_dump() {\n"
+          "@start\n"
+          "\t%path =l call $getenv(l $__quebec_prof_env)\n"
+          "\t%set =w cnel %path, 0\n"
+          "\tjnz %set, @open, @default\n"
+          "@default\n"
+          "\t%path =l copy $__quebec_prof_default\n"
+          "@open\n"
+          "\t%fp =l call $fopen(l %path, l $__quebec_prof_mode)\n"
+          "\t%at =l copy $__quebec_prof_table\n"
+          "\t%set =w cnel %fp, 0\n"
+          "\tjnz %set, @next, @done\n"
+          "@next\n"
+          "\t%record =l loadl %at\n"
+          "\t%set =w cnel %record, 0\n"
+          "\tjnz %set, @write, @close\n"
+          "@write\n"
+          "\t%count =l loadl %record\n"
+          "\t%name =l add %record, 8\n"
+          "\t%name =l loadl %name\n"
+          "\tcall $fprintf(l %fp, l $__quebec_prof_format, ..., l %name, l %count)\n"
+          "\t%at =l add %at, 8\n"
+          "\tjmp @next\n"
+          "@close\n"
+          "\tcall $fclose(l %fp)\n"
+          "@done\n"
+          "\tret\n"
+          "}\n\n"
+          "function $__quebec_prof_init() {\n"
+          "@start\n"
+          "\tcall $atexit(l $__quebec_prof_dump)\n"
+          "\tret\n"
+          "}\n\n", file->fp);
+    appendBuffer(&file->data, "data $__quebec_prof_table = align 8 { %sl 0 }\n", file->counters.text);
+    appendBuffer(&file->data, "data $__quebec_prof_env = { b \"%s\", b 0 }\n", PROFILE_ENV);
+    appendBuffer(&file->data, "data $__quebec_prof_default = { b \"%s\", b 0 }\n", PROFILE_DEFAULT);
+    appendBuffer(&file->data, "data $__quebec_prof_mode = { b \"a\", b 0 }\n");
+    appendBuffer(&file->data, "data $__quebec_prof_format = { b \"%%s %%lu\\n\", b 0 }\n");
+    appendBuffer(&file->data, "section \".init_array\" data $__quebec_prof_ctor = align 8 { l $__quebec_prof_init }\n");
+}
+
+void closeCodeFile(pCodeFile* file) {
+    if (file == NULL || *file == NULL) return;
+    if ((*file)->options.profile) writeHeldJobs(*file);
+    if ((*file)->counters.length) writeProfileDump(*file);
+    if ((*file)->data.length) fprintf((*file)->fp, "\n# Data Segment\n%s\n", (*file)->data.text);
+    fclose((*file)->fp);
+    freeMemory((*file)->path);
+    freeMemory((*file)->statics);
+    freeMemory((*file)->globals);
+    clearFunctions(*file);
+    freeMemory((*file)->functions);
+    clearAggregates(*file);
+    freeMemory((*file)->data.text);
+    freeMemory((*file)->counters.text);
+    freeMemory(*file);
+    *file = NULL;
+}
@@ -1,7 +1,10 @@
 #ifndef QUEBEC_QBE_H
 #define QUEBEC_QBE_H
 
+#include <stdbool.h>
+
 #include "lexer.h"
+#include "profile.h"
 
 /* https://c9x.me/compile/doc/il.html#Simple-Types
    BASETY := 'w' | 'l' | 's' | 'd' # Base types
@@ -24,6 +27,40 @@ __attribute_maybe_unused__ static const char* qbeType2str[QBE_TYPE_LENGTH] = {
     "h"
 };
 
-void compileFile(const char* output_path, pSyntaxNode master);
+#define CODE_CACHE_BUCKETS 1024
+#define SYMBOL_LENGTH       288 /* Longest identifier the lexer keeps, plus a unit suffix */
+
+/* Output of every top-level function from the previous build of one file,
+   so a rebuild only re-emits functions whose tokens or lines changed */
+typedef struct code_cache_s* pCodeCache;
+
+pCodeCache newCodeCache(void);
+void       delCodeCache(pCodeCache* cache);
+
+/* A QBE module being written: functions as they're compiled, then every
+   unit's data once closed. Several translation units can share one, see
+   `startCodeUnit`. */
+typedef struct code_file_s* pCodeFile;
+
+/* How modules are written, the same for every one in a build */
+typedef struct {
+    bool     instrument;  /* Count calls of every function and runs of its blocks, written out at exit (see `profile.h`) */
+    bool     debug_lines; /* `dbgfile`/`dbgloc` from each token's origin, so the assembler emits line tables */
+    pProfile profile;     /* Write functions hottest first when the module is closed, may be NULL */
+} CodeOptions;
+
+pCodeFile openCodeFile (const char* output_path, const CodeOptions* options);
+void      closeCodeFile(pCodeFile* file);
+
+/* Starts the next translation unit of a `--unity` module, its file-`static`
+   functions get their own `.<unit>` suffix so units can't clash */
+void      startCodeUnit(pCodeFile file);
+
+/* A whole translation unit, top-level functions spread over `workers` threads */
+void      compileTree  (pCodeFile file, const pSyntaxTree tree, const uint workers, pCodeCache cache); /* `cache` may be NULL */
+
+/* Streaming counterpart of `compileTree`, for trees cut into top-level units
+   by a `TreeBuilder`. Output matches compiling the whole tree at once. */
+void      compileUnit  (pCodeFile file, const pSyntaxTree tree);
 
 #endif /* QUEBEC_QBE_H */
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include "ring.h"
+
+#include <sched.h>
+
+#include "memory.h"
+
+#define RING_SPINS 64 /* Before giving the core away, the other side is usually close */
+
+pRing newRing(const uint capacity) {
+    uint size = 2;
+    while (size < capacity) size *= 2;
+
+    pRing ring = allocMemory(MEM_Driver, sizeof(*ring));
+    ring->slots = allocMemory(MEM_Driver, size*sizeof(void*));
+    ring->mask  = size-1;
+    ring->head  = 0;
+    ring->tail  = 0;
+    return ring;
+}
+
+void delRing(pRing* ring) {
+    if (ring == NULL || *ring == NULL) return;
+    freeMemory((*ring)->slots);
+    freeMemory(*ring);
+    *ring = NULL;
+}
+
+static void backOff(uint* spins) {
+    if (++(*spins) >= RING_SPINS) { sched_yield(); return; }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void pushRing(pRing ring, void* item) {
+    const size_t tail  = ring->tail; /* Ours, no ordering needed */
+    uint         spins = 0;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask) backOff(&spins);
+
+    ring->slots[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail+1, __ATOMIC_RELEASE);
+}
+
+void* popRing(pRing ring) {
+    const size_t head  = ring->head; /* Ours, no ordering needed */
+    uint         spins = 0;
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) backOff(&spins);
+
+    void* item = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+    return item;
+}
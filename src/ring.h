@@ -0,0 +1,27 @@
+#ifndef QUEBEC_RING_H
+#define QUEBEC_RING_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Lock-free single-producer/single-consumer queue of pointers. Exactly one
+   thread may push and exactly one other may pop; both block (spinning, then
+   yielding) while the ring is full or empty. `NULL` is a valid item, by
+   convention it marks the end of a stream. */
+
+typedef struct ring_s {
+    void** slots;
+    size_t mask;      /* Capacity is a power of two */
+    char   pad0[64];  /* Keeps each side's index on its own cache line */
+    size_t head;      /* Next slot to pop, only the consumer writes it */
+    char   pad1[64];
+    size_t tail;      /* Next slot to push, only the producer writes it */
+} *pRing;
+
+pRing newRing (const uint capacity);
+void  delRing (pRing* ring);
+void  pushRing(pRing ring, void* item);
+void* popRing (pRing ring);
+
+#endif /* QUEBEC_RING_H */
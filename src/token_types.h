@@ -22,6 +22,7 @@
     TYPE == TOKEN_signed ||\
     TYPE == TOKEN_static ||\
     TYPE == TOKEN_struct ||\
+    TYPE == TOKEN_union ||\
     TYPE == TOKEN_unsigned ||\
     TYPE == TOKEN_volatile\
 )
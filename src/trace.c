@@ -0,0 +1,123 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define TRACE_BUFFER_SIZE  (64*1024)
+#define TRACE_MESSAGE_SIZE 1024
+
+uint8_t global_TraceLevel[TRACE_CATEGORY_LENGTH] = {0};
+
+static FILE*    global_TraceFile   = NULL;
+static bool     global_TraceBinary = false;
+static char*    global_TraceBuffer = NULL;
+static uint64_t global_TraceStart  = 0;
+
+static uint64_t nowNanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+bool openTrace(const char* path, const bool binary) {
+    closeTrace();
+    global_TraceStart  = nowNanoseconds();
+    global_TraceBinary = binary && path;
+    if (path == NULL) {
+        global_TraceFile = stdout; /* Shares `stdout`'s buffer so it stays in order with `INFO` */
+        return true;
+    }
+
+    global_TraceFile = fopen(path, global_TraceBinary ? "wb" : "w");
+    if (global_TraceFile == NULL) {
+        printf("[WARN] Could not open trace file (%s)\n", path);
+        return false;
+    }
+    global_TraceBuffer = malloc(TRACE_BUFFER_SIZE);
+    setvbuf(global_TraceFile, global_TraceBuffer, _IOFBF, TRACE_BUFFER_SIZE);
+
+    if (global_TraceBinary) {
+        TraceFileHeader header = { .version = TRACE_VERSION };
+        memcpy(header.magic, TRACE_MAGIC, 4);
+        fwrite(&header, sizeof(header), 1, global_TraceFile);
+    }
+    return true;
+}
+
+bool setTraceLevels(const char* spec) {
+    while (*spec) {
+        const char* end   = strchr(spec, ',');
+        const size_t len  = end ? (size_t)(end - spec) : strlen(spec);
+        const char*  eq   = memchr(spec, '=', len);
+        const size_t name = eq ? (size_t)(eq - spec) : len;
+
+        int level = TRACE_Debug;
+        if (eq) level = atoi(eq+1);
+        if (level < TRACE_Off || level >= TRACE_LEVEL_LENGTH) {
+            printf("[WARN] Trace level for (%.*s) must be 0-%d\n", (int)name, spec, TRACE_LEVEL_LENGTH-1);
+            return false;
+        }
+
+        const bool all   = name==3 && strncmp(spec, "all", 3)==0;
+        bool       found = false;
+        for (enum TraceCategory cat = 0; cat<TRACE_CATEGORY_LENGTH; cat++) {
+            if (all || (strncmp(spec, traceCategory2Str[cat], name)==0 && traceCategory2Str[cat][name]==0)) {
+                global_TraceLevel[cat] = level;
+                found = true;
+            }
+        }
+        if (!found) {
+            printf("[WARN] Unknown trace category (%.*s)\n", (int)name, spec);
+            return false;
+        }
+
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+    return true;
+}
+
+void traceRecord(const enum TraceCategory category, const enum TraceLevel level, const char* fmt, ...) {
+    if (global_TraceFile == NULL) return;
+
+    char message[TRACE_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    if (length < 0) return;
+    if (length >= (int)sizeof(message)) length = sizeof(message)-1;
+
+    const uint64_t elapsed = nowNanoseconds() - global_TraceStart;
+    if (global_TraceBinary) {
+        const TraceRecord record = {
+            .nanoseconds = elapsed,
+            .category    = category,
+            .level       = level,
+            .length      = length,
+        };
+        flockfile(global_TraceFile); /* Workers trace too, a header must stay next to its message */
+        fwrite(&record, sizeof(record), 1, global_TraceFile);
+        fwrite(message, 1, length, global_TraceFile);
+        funlockfile(global_TraceFile);
+    } else {
+        fprintf(global_TraceFile, "[%4llu.%06llu] %-7s %u| %s\n",
+            (unsigned long long)(elapsed/1000000000ull), (unsigned long long)(elapsed/1000ull%1000000ull),
+            traceCategory2Str[category], level, message);
+    }
+}
+
+void flushTrace(void) {
+    if (global_TraceFile) fflush(global_TraceFile);
+}
+
+void closeTrace(void) {
+    if (global_TraceFile && global_TraceFile != stdout) fclose(global_TraceFile);
+    else flushTrace();
+    free(global_TraceBuffer);
+    global_TraceFile   = NULL;
+    global_TraceBuffer = NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef QUEBEC_TRACE_H
+#define QUEBEC_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Highest trace level compiled in. Release builds set it to 0 and every
+   trace point, arguments included, disappears from the binary. */
+#ifndef QUEBEC_TRACE_LEVEL
+#define QUEBEC_TRACE_LEVEL 3
+#endif
+
+enum TraceCategory {
+    TRACE_Lexer=0,
+    TRACE_Tree,
+    TRACE_Grammar,
+    TRACE_Codegen,
+    TRACE_Driver,
+TRACE_CATEGORY_LENGTH
+};
+
+enum TraceLevel {
+    TRACE_Off=0,
+    TRACE_Info,
+    TRACE_Debug,
+    TRACE_Dump, /* Every line, node and prediction */
+TRACE_LEVEL_LENGTH
+};
+
+__attribute_maybe_unused__ static const char* traceCategory2Str[TRACE_CATEGORY_LENGTH] = {
+    "lexer",
+    "tree",
+    "grammar",
+    "codegen",
+    "driver",
+};
+
+/* Binary traces are a `TraceFileHeader` followed by `TraceRecord`s, each
+   trailed by `length` bytes of unterminated message text */
+#define TRACE_MAGIC   "QTRC"
+#define TRACE_VERSION 1
+
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+} TraceFileHeader;
+
+typedef struct {
+    uint64_t nanoseconds; /* Since the trace was opened */
+    uint8_t  category;
+    uint8_t  level;
+    uint16_t length;
+    uint32_t reserved; /* Keeps records 16 bytes with no uninitialized padding */
+} TraceRecord;
+
+extern uint8_t global_TraceLevel[TRACE_CATEGORY_LENGTH];
+
+#if QUEBEC_TRACE_LEVEL > 0
+    #define TRACING(CAT, LEVEL) ((LEVEL) <= QUEBEC_TRACE_LEVEL && __builtin_expect(global_TraceLevel[CAT] >= (LEVEL), 0))
+    #define TRACE(CAT, LEVEL, ...) do { if (TRACING(CAT, LEVEL)) traceRecord(CAT, LEVEL, __VA_ARGS__); } while (0)
+#else
+    #define TRACING(CAT, LEVEL) 0
+    #define TRACE(CAT, LEVEL, ...) do {} while (0)
+#endif
+
+bool openTrace     (const char* path, const bool binary); /* NULL traces text to `stdout` */
+bool setTraceLevels(const char* spec); /* e.g. `grammar=3,codegen`, bare names trace at `TRACE_Debug` */
+void traceRecord   (const enum TraceCategory category, const enum TraceLevel level, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void flushTrace    (void);
+void closeTrace    (void);
+
+#endif /* QUEBEC_TRACE_H */
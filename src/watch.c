@@ -0,0 +1,128 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "memory.h"
+
+typedef struct {
+    int   wd;
+    char* path;
+} WatchedDir;
+
+typedef struct {
+    uint  dir;
+    char* name;
+    char* path;
+    bool  changed;
+} WatchedFile;
+
+struct watcher_s {
+    int          fd;
+    WatchedDir*  dirs;
+    uint         num_dirs;
+    WatchedFile* files;
+    uint         num_files;
+};
+
+pWatcher newWatcher(void) {
+    const int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        WARN("inotify_init1() failed: %s", strerror(errno));
+        return NULL;
+    }
+    pWatcher watcher = callocMemory(MEM_Driver, 1, sizeof(*watcher));
+    watcher->fd = fd;
+    return watcher;
+}
+
+void delWatcher(pWatcher* watcher) {
+    if (watcher == NULL || *watcher == NULL) return;
+    close((*watcher)->fd);
+    for (uint i = 0; i<(*watcher)->num_dirs; i++) freeMemory((*watcher)->dirs[i].path);
+    for (uint i = 0; i<(*watcher)->num_files; i++) {
+        freeMemory((*watcher)->files[i].name);
+        freeMemory((*watcher)->files[i].path);
+    }
+    freeMemory((*watcher)->dirs);
+    freeMemory((*watcher)->files);
+    freeMemory(*watcher);
+    *watcher = NULL;
+}
+
+bool watchFile(pWatcher watcher, const char* path) {
+    for (uint i = 0; i<watcher->num_files; i++)
+        if (strcmp(watcher->files[i].path, path)==0) return true;
+
+    const char* slash = strrchr(path, '/');
+    char* dir = slash ? strdupMemory(MEM_Driver, path) : strdupMemory(MEM_Driver, ".");
+    if (slash) dir[slash == path ? 1 : slash - path] = 0;
+
+    uint index = 0;
+    while (index<watcher->num_dirs && strcmp(watcher->dirs[index].path, dir)!=0) index++;
+    if (index == watcher->num_dirs) {
+        const int wd = inotify_add_watch(watcher->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0) {
+            WARN("Could not watch (%s): %s", dir, strerror(errno));
+            freeMemory(dir);
+            return false;
+        }
+        watcher->dirs = reallocMemory(MEM_Driver, watcher->dirs, (watcher->num_dirs+1)*sizeof(WatchedDir));
+        watcher->dirs[watcher->num_dirs++] = (WatchedDir){ .wd = wd, .path = dir };
+    } else {
+        freeMemory(dir);
+    }
+
+    watcher->files = reallocMemory(MEM_Driver, watcher->files, (watcher->num_files+1)*sizeof(WatchedFile));
+    watcher->files[watcher->num_files++] = (WatchedFile){
+        .dir     = index,
+        .name    = strdupMemory(MEM_Driver, slash ? slash+1 : path),
+        .path    = strdupMemory(MEM_Driver, path),
+        .changed = false
+    };
+    TRACE(TRACE_Driver, TRACE_Debug, "Watching (%s)", path);
+    return true;
+}
+
+static bool markChanged(pWatcher watcher, const struct inotify_event* event) {
+    if (event->len == 0) return false;
+    bool any = false;
+    for (uint i = 0; i<watcher->num_files; i++) {
+        WatchedFile* file = &(watcher->files[i]);
+        if (watcher->dirs[file->dir].wd != event->wd || strcmp(file->name, event->name)!=0) continue;
+        TRACE(TRACE_Driver, TRACE_Info, "Changed (%s)", file->path);
+        file->changed = any = true;
+    }
+    return any;
+}
+
+bool waitForChanges(pWatcher watcher) {
+    for (uint i = 0; i<watcher->num_files; i++) watcher->files[i].changed = false;
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int  timeout = -1; /* Until the first relevant event, then until things settle */
+    while (true) {
+        struct pollfd pfd = { .fd = watcher->fd, .events = POLLIN };
+        const int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) return false;
+        if (ready == 0) return true;
+
+        const ssize_t length = read(watcher->fd, events, sizeof(events));
+        if (length <= 0) return false;
+        for (char* at = events; at < events+length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)at;
+            if (markChanged(watcher, event)) timeout = WATCH_SETTLE_MS;
+            at += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+bool fileChanged(const pWatcher watcher, const char* path) {
+    for (uint i = 0; i<watcher->num_files; i++)
+        if (strcmp(watcher->files[i].path, path)==0) return watcher->files[i].changed;
+    return false;
+}
@@ -0,0 +1,24 @@
+#ifndef QUEBEC_WATCH_H
+#define QUEBEC_WATCH_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+#define WATCH_SETTLE_MS 50 /* Editors often save in several steps */
+
+/* Notices files being rewritten through inotify. Directories are watched
+   rather than the files themselves, so saves that replace a file by
+   renaming over it are seen too. */
+typedef struct watcher_s* pWatcher;
+
+pWatcher newWatcher(void);
+void     delWatcher(pWatcher* watcher);
+bool     watchFile (pWatcher watcher, const char* path); /* Watching twice is harmless */
+
+/* Blocks until something watched changes and stays quiet for `WATCH_SETTLE_MS`.
+   Returns false if interrupted by a signal. */
+bool     waitForChanges(pWatcher watcher);
+bool     fileChanged   (const pWatcher watcher, const char* path); /* During the last wait */
+
+#endif /* QUEBEC_WATCH_H */